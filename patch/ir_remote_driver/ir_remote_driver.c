@@ -15,6 +15,7 @@
 #include "ci112x_spiflash.h"
 #include "ci112x_gpio.h"
 #include "ci112x_core_eclic.h"
+#include "ci112x_core_misc.h"
 #include "platform_config.h"
 #include "sdk_default_config.h"
 #include "ir_remote_driver.h"
@@ -29,8 +30,12 @@
 #define IR_CARRIER_DUTY (300)           //占空比
 #define IR_CARRIER_DUTY_MAX (1000)           //最大占空比
 #define IR_MAX_DATA_COUNT (1024)        //最大接收长度
+#define IR_CARRIER_TOLERANCE (10)       //分频取整后载波频率允许的误差, 千分之
+#define IR_CLOCK_MIN_CORE (20000000)    //主频低于此值时中断来不及按时切换载波
 
-#define TIMER0_ONEUS_COUNT (get_apb_clk() / 1000000)/*FPCLK/FEQDIV*/
+/*us和定时器计数值用定点数换算, 12.288MHz这类不是整数MHz的时钟截断成整数会差2%以上*/
+#define IR_US_TO_TICKS(us) ((uint32_t)(((uint64_t)(us)*ir_tick_per_us)>>16))
+#define IR_TICKS_TO_US(ticks) ((uint32_t)(((uint64_t)(ticks)*ir_us_per_tick)>>24))
 
 #define IR_RECEIVE_DATA_TIMEOUT         (60000L)
 #define IR_RECEIVE_DATA_TIMEOUT_USED    (100000L)
@@ -59,10 +64,104 @@ static uint32_t ir_code_send_count = 0;
 static uint16_t *ir_level_code = NULL;
 static uint32_t ir_level_code_size = 0;
 static uint8_t odd_even_carry_pwm_wave = 1;
+static bool ir_send_precompute = true;/*是否允许发送前把电平换算成定时器计数值*/
+static bool ir_send_table = false;/*当前发送是否使用换算好的计数值表*/
+static ir_send_level_generator_t ir_send_generator = NULL;/*流式发送时逐个产生电平, NULL表示从数据buf发送*/
+static void *ir_send_generator_arg = NULL;
+static uint32_t ir_stream_next = 0;/*流式发送时下一个电平的计数值, 0表示已经没有电平*/
+static bool ir_stream_error = false;
+static bool ir_send_capture = false;/*只把电平留在数据buf中, 不真正发送*/
+static uint32_t ir_capture_count = 0;/*最后一次截获的电平数量*/
+static uint32_t ir_capture_sends = 0;/*截获的发送次数*/
+static uint32_t ir_tick_per_us = 1<<16;/*定时器每us的计数值, 16位小数, 时钟改变后由ir_clock_update更新*/
+static uint32_t ir_us_per_tick = 1<<24;/*定时器每个计数值的us数, 24位小数, 接收中断里用乘法代替除法*/
+static bool ir_clock_ready = true;/*当前时钟能否准确产生载波*/
+static volatile bool ir_carrier_stale = false;/*时钟变了, 载波还没有按新时钟重新配置*/
+static uint32_t ir_deferred_sends = 0;/*时钟不能准确产生载波而推迟的发送次数*/
+
+#if IR_ISR_STATS
+static ir_isr_stats_t ir_isr_stats;
+
+/**
+ * @brief 累计一次中断的耗时
+ */
+static inline void ir_isr_stats_add(bool tx, uint32_t cycles)
+{
+    if(tx)
+    {
+        ir_isr_stats.tx_edges++;
+        ir_isr_stats.tx_cycles_total += cycles;
+        if(cycles > ir_isr_stats.tx_cycles_max)
+        {
+            ir_isr_stats.tx_cycles_max = cycles;
+        }
+    }
+    else
+    {
+        ir_isr_stats.rx_edges++;
+        ir_isr_stats.rx_cycles_total += cycles;
+        if(cycles > ir_isr_stats.rx_cycles_max)
+        {
+            ir_isr_stats.rx_cycles_max = cycles;
+        }
+    }
+}
+#endif
+
+#if IR_SEND_JITTER_MEASURE
+static ir_send_jitter_t ir_jitter;
+static uint32_t jitter_last_cycle = 0;
+static uint32_t jitter_expect_cycle = 0;/*正在发送的电平应该持续的周期数*/
+static uint32_t jitter_cycle_per_tick = 1;
+#endif
 
 static uint32_t ir_receive_state = IR_RECEIVE_STATE_IDLE;
 static uint32_t ir_receive_level_flag = IR_RECEIVE_FIRST_LEVEL;/*1 high ,0 low*/
 uint32_t ir_receive_level_count = 0;
+static uint32_t ir_receive_end_gap = IR_RECEIVE_DATA_TIMEOUT_USED;/*没有边沿超过这么久认为接收结束, 单位us*/
+static uint32_t ir_receive_end_ticks = 0;
+
+/*流式NEC解码, 单位us*/
+#define NEC_HDR_MARK_MIN        (7000)
+#define NEC_HDR_MARK_MAX        (11000)
+#define NEC_HDR_SPACE_MIN       (3500)
+#define NEC_HDR_SPACE_MAX       (5500)
+#define NEC_RPT_SPACE_MIN       (1700)
+#define NEC_RPT_SPACE_MAX       (2800)
+#define NEC_BIT_MARK_MIN        (300)
+#define NEC_BIT_MARK_MAX        (900)
+#define NEC_ZERO_SPACE_MAX      (900)
+#define NEC_ONE_SPACE_MIN       (1200)
+#define NEC_ONE_SPACE_MAX       (2200)
+#define NEC_BIT_COUNT           (32)
+
+typedef enum
+{
+    NEC_STATE_IDLE = 0,     /*等待引导码*/
+    NEC_STATE_HDR_SPACE,    /*引导码低电平之后的间隔*/
+    NEC_STATE_BIT_MARK,
+    NEC_STATE_BIT_SPACE,
+    NEC_STATE_REPEAT_MARK,  /*重复码的结束位*/
+}nec_stream_state_t;
+
+typedef struct
+{
+    uint32_t hdr_mark_min, hdr_mark_max;
+    uint32_t hdr_space_min, hdr_space_max;
+    uint32_t rpt_space_min, rpt_space_max;
+    uint32_t bit_mark_min, bit_mark_max;
+    uint32_t zero_space_max;
+    uint32_t one_space_min, one_space_max;
+    uint32_t timeout;
+}nec_stream_ticks_t;
+
+static bool ir_receive_stream = false;/*true:流式NEC解码, 不保存电平*/
+static bool nec_edge_valid = false;/*定时器是否在计量上一个边沿以来的时间*/
+static bool nec_other_reported = false;/*这次接收是否已经上报过不是NEC的载波*/
+static nec_stream_state_t nec_state = NEC_STATE_IDLE;
+static uint32_t nec_code = 0;
+static uint32_t nec_bits = 0;
+static nec_stream_ticks_t nec_ticks;
 
 static void ir_receive_process(void);
 static gpio_irq_callback_list_t ir_gpio_callback = {ir_receive_process,NULL};
@@ -168,6 +267,182 @@ static void ir_pwm_out_pad_disable(void)
 }
 
 
+#if IR_SEND_JITTER_MEASURE
+/**
+ * @brief 记录一个发送边沿, 统计实际电平长度与期望长度的偏差
+ *
+ * @param ticks 新电平的定时器计数值
+ */
+static inline void ir_jitter_edge(uint32_t ticks)
+{
+    uint32_t now = read_csr(mcycle);
+    if(0 != ir_code_send_count)
+    {
+        int32_t err = (int32_t)(now - jitter_last_cycle - jitter_expect_cycle);
+        if((0 == ir_jitter.edges) || (err < ir_jitter.err_min))
+        {
+            ir_jitter.err_min = err;
+        }
+        if((0 == ir_jitter.edges) || (err > ir_jitter.err_max))
+        {
+            ir_jitter.err_max = err;
+        }
+        ir_jitter.edges++;
+    }
+    jitter_last_cycle = now;
+    jitter_expect_cycle = ticks*jitter_cycle_per_tick;
+}
+#else
+#define ir_jitter_edge(ticks)
+#endif
+
+
+/**
+ * @brief 发送结束处理
+ *
+ */
+static void send_ir_code_finish(void)
+{
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
+    ir_pwm_out_pad_disable();
+    ir_send_table = false;
+    ir_send_generator = NULL;
+    ir_state.is_busy = false;
+    /*调用回调*/
+    if(is_callback_vaild())
+    {
+        g_ir_callback(&ir_state);
+    }
+}
+
+
+/**
+ * @brief 按换算好的计数值表发送
+ * @note 载波一直开着, 每个边沿只切换管脚复用并装载下一个计数值
+ *
+ */
+static void send_ir_table_continue(void)
+{
+    uint32_t *reload = (uint32_t *)ir_level_code;
+
+    if(ir_code_send_count >= ir_code_total_count)
+    {
+        ir_state.event = IR_SEND_END;
+        send_ir_code_finish();
+        return;
+    }
+
+    if(0 == (ir_code_send_count & odd_even_carry_pwm_wave))/*high level*/
+    {
+        Scu_SetIOReuse(ir_driver_info.outPin.PinName,ir_driver_info.outPin.PwmFun);
+    }
+    else
+    {
+        Scu_SetIOReuse(ir_driver_info.outPin.PinName,ir_driver_info.outPin.IoFun);
+    }
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
+    timer_set_count(ir_driver_info.irTimer.ir_use_timer,reload[ir_code_send_count]);
+    timer_start(ir_driver_info.irTimer.ir_use_timer);
+    ir_jitter_edge(reload[ir_code_send_count]);
+    ir_code_send_count++;
+}
+
+
+/**
+ * @brief 流式发送时从生成器取出下一个电平并换算成计数值
+ *
+ */
+static void ir_stream_fetch(void)
+{
+    uint16_t level;
+
+    ir_stream_next = 0;
+    if(ir_send_generator(ir_send_generator_arg,&level))
+    {
+        if(100 > level)
+        {
+            ir_stream_error = true;
+        }
+        else
+        {
+            ir_stream_next = IR_US_TO_TICKS((uint32_t)level*IR_DATA_DIV_COEFFICIENT);
+        }
+    }
+}
+
+
+/**
+ * @brief 流式发送底半部
+ * @note 载波一直开着, 先装载提前取好的电平, 定时器开始计时后再取下一个电平,
+ *       生成器的耗时不会影响边沿的时刻, 只要比最短的电平短即可
+ *
+ */
+static void send_ir_stream_continue(void)
+{
+    if(0 == ir_stream_next)
+    {
+        if(ir_stream_error)
+        {
+            /*在中断里打印会拖长后面的边沿, 由回调转到任务里报告*/
+            ir_state.event = IR_SEND_DATA_ERR;
+        }
+        else
+        {
+            ir_state.event = IR_SEND_END;
+        }
+        send_ir_code_finish();
+        return;
+    }
+
+    if(0 == (ir_code_send_count & odd_even_carry_pwm_wave))/*high level*/
+    {
+        Scu_SetIOReuse(ir_driver_info.outPin.PinName,ir_driver_info.outPin.PwmFun);
+    }
+    else
+    {
+        Scu_SetIOReuse(ir_driver_info.outPin.PinName,ir_driver_info.outPin.IoFun);
+    }
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
+    timer_set_count(ir_driver_info.irTimer.ir_use_timer,ir_stream_next);
+    timer_start(ir_driver_info.irTimer.ir_use_timer);
+    ir_jitter_edge(ir_stream_next);
+    ir_code_send_count++;
+
+    ir_stream_fetch();
+}
+
+
+/**
+ * @brief 发送前把电平换算成定时器计数值, 原地写回数据buf
+ * @note 从后往前换算, 第i个计数值只会覆盖第2i和2i+1个电平, 不会覆盖还没换算的电平
+ *
+ * @param count 电平数量
+ * @retval RETURN_OK 换算成功
+ * @retval RETURN_ERR 数据buf放不下或者数据错误, 不能使用计数值表
+ */
+static int32_t ir_build_reload_table(uint32_t count)
+{
+    uint32_t *reload = (uint32_t *)ir_level_code;
+
+    if((!ir_send_precompute) || (count*sizeof(uint32_t) > ir_level_code_size) || (0 != ((uint32_t)ir_level_code & 3)))
+    {
+        return RETURN_ERR;
+    }
+    for(uint32_t i=0;i<count;i++)
+    {
+        if(100 > ir_level_code[i])
+        {
+            return RETURN_ERR;
+        }
+    }
+    for(uint32_t i=count;i>0;i--)
+    {
+        reload[i-1] = IR_US_TO_TICKS((uint32_t)ir_level_code[i-1]*IR_DATA_DIV_COEFFICIENT);
+    }
+    return RETURN_OK;
+}
+
+
 /**
  * @brief 数据发送底半部
  *
@@ -175,6 +450,7 @@ static void ir_pwm_out_pad_disable(void)
 static void send_ir_code_continue(void)
 {
     bool send_end_flag = false;
+    uint32_t ticks;
 
     /*发送结束*/
     if(ir_code_send_count >= ir_code_total_count)
@@ -188,13 +464,14 @@ static void send_ir_code_continue(void)
     if(100 > ir_level_code[ir_code_send_count])
     {
         send_end_flag = true;
+        /*在中断里打印会拖长后面的边沿, 由回调转到任务里报告*/
         ir_state.event = IR_SEND_DATA_ERR;
-        ci_logerr(LOG_IR,"ir data error,wave value is 0\n");
         goto callback;
     }
 
+    ticks = IR_US_TO_TICKS((uint32_t)ir_level_code[ir_code_send_count]*IR_DATA_DIV_COEFFICIENT);
     timer_stop(ir_driver_info.irTimer.ir_use_timer);
-    timer_set_count(ir_driver_info.irTimer.ir_use_timer,(uint32_t)ir_level_code[ir_code_send_count]*TIMER0_ONEUS_COUNT*IR_DATA_DIV_COEFFICIENT);
+    timer_set_count(ir_driver_info.irTimer.ir_use_timer,ticks);
     timer_start(ir_driver_info.irTimer.ir_use_timer);
 
     if(0 == (ir_code_send_count & odd_even_carry_pwm_wave))/*high level*/
@@ -205,20 +482,14 @@ static void send_ir_code_continue(void)
     {
         ir_pwm_out_pad_disable();
     }
+    ir_jitter_edge(ticks);
     ir_code_send_count++;
 
 callback:
     /*结束处理*/
     if(send_end_flag)
     {
-        timer_stop(ir_driver_info.irTimer.ir_use_timer);
-        ir_pwm_out_pad_disable();
-        ir_state.is_busy = false;
-        /*调用回调*/
-        if(is_callback_vaild())
-        {
-            g_ir_callback(&ir_state);
-        }
+        send_ir_code_finish();
         return;
     }
 }
@@ -235,6 +506,8 @@ void ir_receive_end(void)
     ir_state.is_busy = false;
     ir_state.event = IR_RECEIVE_END;
 
+    /*边沿中断里结束接收时定时器还在计时, 超时后会被当作发送中断处理*/
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
     ir_time_function = 1;
     gpio_irq_mask(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
     //gpio_set_output_mode(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
@@ -272,6 +545,13 @@ void ir_receive_end(void)
 static void ir_receive_timeout_deal(void)
 {
 //    int msg = 0;
+    if(ir_receive_stream)
+    {
+        /*超时说明一帧已经结束或者是干扰, 继续等待下一个引导码*/
+        nec_edge_valid = false;
+        nec_state = NEC_STATE_IDLE;
+        return;
+    }
     switch(ir_receive_state)
     {
         case IR_RECEIVE_STATE_INIT:
@@ -299,16 +579,91 @@ static void ir_receive_timeout_deal(void)
  */
 static void ir_timer_timeout_deal(void)
 {
+#if IR_ISR_STATS
+    uint32_t start = read_csr(mcycle);
+    bool tx = (1 == ir_time_function);
+#endif
     timer_clear_irq(ir_driver_info.irTimer.ir_use_timer);
 
     if(1 == ir_time_function)
     {
-        send_ir_code_continue();
+        if(NULL != ir_send_generator)
+        {
+            send_ir_stream_continue();
+        }
+        else if(ir_send_table)
+        {
+            send_ir_table_continue();
+        }
+        else
+        {
+            send_ir_code_continue();
+        }
     }
     else
     {
         ir_receive_timeout_deal();
     }
+#if IR_ISR_STATS
+    ir_isr_stats_add(tx, read_csr(mcycle) - start);
+#endif
+}
+
+
+/**
+ * @brief 按APB时钟计算us和定时器计数值的换算系数
+ *
+ * @param apb APB时钟
+ */
+static void ir_tick_scale_init(uint32_t apb)
+{
+    if(1000000 > apb)
+    {
+        /*低于1MHz时不能发送, 保留原来的系数*/
+        return;
+    }
+    ir_tick_per_us = (uint32_t)(((uint64_t)apb<<16)/1000000);
+    ir_us_per_tick = (uint32_t)((1000000ULL<<24)/apb);
+}
+
+
+/**
+ * @brief 检查当前时钟能否准确产生载波和电平
+ * @note 电平的计数值用定点数换算, 误差远小于1us, 只需要检查载波分频和主频
+ *
+ * @retval true 可以发送
+ */
+static bool ir_clock_accurate(void)
+{
+    uint32_t apb = get_apb_clk();
+    uint32_t div = apb / IR_CARRIER_FREQUENCY;
+    uint32_t actual,error;
+
+    if((0 == div) || (0 == apb / 1000000) || (get_ipcore_clk() < IR_CLOCK_MIN_CORE))
+    {
+        return false;
+    }
+    actual = apb / div;
+    error = (actual > IR_CARRIER_FREQUENCY) ? (actual - IR_CARRIER_FREQUENCY) : (IR_CARRIER_FREQUENCY - actual);
+    return (error * 1000 <= IR_CARRIER_FREQUENCY * IR_CARRIER_TOLERANCE);
+}
+
+
+/**
+ * @brief 按当前时钟配置载波
+ * @note pwm_init比较重, 不在中断中调用
+ *
+ */
+static void ir_carrier_init(void)
+{
+    pwm_init_t pwm_38k_init;
+
+    /*先清标志, 配置期间时钟又变了就留到下次发送再配置*/
+    ir_carrier_stale = false;
+    pwm_38k_init.freq = IR_CARRIER_FREQUENCY;
+    pwm_38k_init.duty = IR_CARRIER_DUTY;
+    pwm_38k_init.duty_max = IR_CARRIER_DUTY_MAX;
+    pwm_init(ir_driver_info.outPin.PwmBase,pwm_38k_init);
 }
 
 
@@ -320,16 +675,14 @@ static void ir_timer_timeout_deal(void)
  */
 int32_t ir_hw_init(void)
 {
-    pwm_init_t pwm_38k_init;
     timer_init_t timer0_init;
 
     Scu_SetDeviceGate(ir_driver_info.outPin.PwmBase,ENABLE);
     Scu_SetIOReuse(ir_driver_info.outPin.PinName,ir_driver_info.outPin.PwmFun);
-    pwm_38k_init.freq = IR_CARRIER_FREQUENCY;
-    pwm_38k_init.duty = IR_CARRIER_DUTY;
-    pwm_38k_init.duty_max = IR_CARRIER_DUTY_MAX;
-    pwm_init(ir_driver_info.outPin.PwmBase,pwm_38k_init);
+    ir_carrier_init();
     ir_pwm_out_pad_disable();
+    ir_tick_scale_init(get_apb_clk());
+    ir_clock_ready = ir_clock_accurate();
 
     //配置TIMER0的中断
     __eclic_irq_set_vector(ir_driver_info.irTimer.ir_use_timer_IRQ,(int)ir_timer_timeout_deal);
@@ -362,20 +715,144 @@ int32_t ir_hw_init(void)
 
 
 /**
- * @brief gpio中断处理函数
+ * @brief 流式NEC解码上报事件
  *
+ * @param event IR_RECEIVE_NEC_FRAME, IR_RECEIVE_NEC_REPEAT或IR_RECEIVE_NEC_OTHER
  */
-static void ir_receive_process(void)
+static void ir_nec_stream_report(IrRemoteEvent event)
+{
+    ir_state.event = event;
+    ir_state.code = nec_code;
+    if(is_callback_vaild())
+    {
+        g_ir_callback(&ir_state);
+    }
+}
+
+
+/**
+ * @brief 流式NEC解码, 每个边沿处理一次上一段电平
+ * @note 只比较定时器计数值, 中断中没有除法
+ *
+ */
+static void ir_nec_stream_edge(void)
+{
+    uint32_t count = 0;
+    uint32_t ticks;
+    bool mark;
+
+    timer_get_count(ir_driver_info.irTimer.ir_use_timer,(unsigned int*)(&count));
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
+    timer_set_count(ir_driver_info.irTimer.ir_use_timer,nec_ticks.timeout);
+    timer_start(ir_driver_info.irTimer.ir_use_timer);
+
+    if(!nec_edge_valid)
+    {
+        /*第一个边沿, 只开始计时*/
+        nec_edge_valid = true;
+        nec_state = NEC_STATE_IDLE;
+        return;
+    }
+    ticks = nec_ticks.timeout - count;
+    /*接收头空闲为高电平, 边沿之后为高电平说明刚结束的是有载波的低电平*/
+    mark = (0 != gpio_get_input_level_single(ir_driver_info.revPin.GpioBase,ir_driver_info.revPin.PinNum));
+
+    switch(nec_state)
+    {
+        case NEC_STATE_HDR_SPACE:
+            if(!mark && ticks >= nec_ticks.hdr_space_min && ticks <= nec_ticks.hdr_space_max)
+            {
+                nec_code = 0;
+                nec_bits = 0;
+                nec_state = NEC_STATE_BIT_MARK;
+                return;
+            }
+            if(!mark && ticks >= nec_ticks.rpt_space_min && ticks <= nec_ticks.rpt_space_max)
+            {
+                nec_state = NEC_STATE_REPEAT_MARK;
+                return;
+            }
+            break;
+        case NEC_STATE_BIT_MARK:
+            if(mark && ticks >= nec_ticks.bit_mark_min && ticks <= nec_ticks.bit_mark_max)
+            {
+                if(NEC_BIT_COUNT == nec_bits)
+                {
+                    nec_state = NEC_STATE_IDLE;
+                    ir_nec_stream_report(IR_RECEIVE_NEC_FRAME);
+                }
+                else
+                {
+                    nec_state = NEC_STATE_BIT_SPACE;
+                }
+                return;
+            }
+            break;
+        case NEC_STATE_BIT_SPACE:
+            if(!mark && ticks >= nec_ticks.bit_mark_min && ticks <= nec_ticks.zero_space_max)
+            {
+                nec_bits++;
+                nec_state = NEC_STATE_BIT_MARK;
+                return;
+            }
+            if(!mark && ticks >= nec_ticks.one_space_min && ticks <= nec_ticks.one_space_max)
+            {
+                nec_code |= (1UL << nec_bits);
+                nec_bits++;
+                nec_state = NEC_STATE_BIT_MARK;
+                return;
+            }
+            break;
+        case NEC_STATE_REPEAT_MARK:
+            if(mark && ticks >= nec_ticks.bit_mark_min && ticks <= nec_ticks.bit_mark_max)
+            {
+                nec_state = NEC_STATE_IDLE;
+                ir_nec_stream_report(IR_RECEIVE_NEC_REPEAT);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    /*不符合当前状态, 看这一段是不是新的引导码*/
+    if(mark && ticks >= nec_ticks.hdr_mark_min && ticks <= nec_ticks.hdr_mark_max)
+    {
+        nec_state = NEC_STATE_HDR_SPACE;
+    }
+    else
+    {
+        nec_state = NEC_STATE_IDLE;
+        /*不是毛刺的载波却对不上NEC, 多半是其他协议的遥控器, 每次接收只上报一次*/
+        if(mark && ticks >= nec_ticks.bit_mark_min && !nec_other_reported)
+        {
+            nec_other_reported = true;
+            ir_nec_stream_report(IR_RECEIVE_NEC_OTHER);
+        }
+    }
+}
+
+
+/**
+ * @brief 接收边沿处理
+ *
+ */
+static void ir_receive_edge(void)
 {
     uint32_t count = 0;
 
     if(gpio_get_irq_mask_status_single(ir_driver_info.revPin.GpioBase,ir_driver_info.revPin.PinNum))
     {
+        if(ir_receive_stream)
+        {
+            ir_nec_stream_edge();
+            return;
+        }
         timer_get_count(ir_driver_info.irTimer.ir_use_timer,(unsigned int*)(&count));
 
         timer_stop(ir_driver_info.irTimer.ir_use_timer);
 
-        timer_set_count(ir_driver_info.irTimer.ir_use_timer,TIMER0_ONEUS_COUNT*IR_RECEIVE_DATA_TIMEOUT_USED);
+        timer_set_count(ir_driver_info.irTimer.ir_use_timer,ir_receive_end_ticks);
         timer_start(ir_driver_info.irTimer.ir_use_timer);
 
         if(IR_RECEIVE_STATE_INIT == ir_receive_state)
@@ -387,16 +864,18 @@ static void ir_receive_process(void)
         {
             if (ir_receive_level_count >= (IR_MAX_DATA_COUNT - 1))
             {
+                /*buf已满, 这个边沿不再计入, 也不能再做电平检查, 否则会把收到的数据当作错误清掉*/
                 ir_receive_state = IR_RECEIVE_STATE_END;
                 ir_receive_end();
+                return;
             }
             else
             {
 
                 ir_receive_level_flag ^= 1;
 
-                count = TIMER0_ONEUS_COUNT*IR_RECEIVE_DATA_TIMEOUT_USED - count;
-                ir_level_code[ir_receive_level_count] = count/TIMER0_ONEUS_COUNT/IR_DATA_DIV_COEFFICIENT;
+                count = ir_receive_end_ticks - count;
+                ir_level_code[ir_receive_level_count] = IR_TICKS_TO_US(count)/IR_DATA_DIV_COEFFICIENT;
                 ir_receive_level_count ++;
             }
         }
@@ -414,6 +893,22 @@ static void ir_receive_process(void)
 }
 
 
+/**
+ * @brief gpio中断处理函数
+ *
+ */
+static void ir_receive_process(void)
+{
+#if IR_ISR_STATS
+    uint32_t start = read_csr(mcycle);
+#endif
+    ir_receive_edge();
+#if IR_ISR_STATS
+    ir_isr_stats_add(false, read_csr(mcycle) - start);
+#endif
+}
+
+
 /**
  * @brief 红外收发硬件管脚配置，定时器配置
  *
@@ -505,14 +1000,12 @@ uint16_t * get_ir_driver_buf(void)
 
 
 /**
- * @brief 红外数据发送
- * @note no support multi thread,used this only one task!
- * @param count uint32_t freq,uint32_t dutycycle  now just 38khz 50%
+ * @brief 发送开始, 占用驱动并通知回调
  *
- * @retval RETURN_OK 发送成功
- * @retval RETURN_ERR 发送失败
+ * @retval RETURN_OK 可以发送
+ * @retval RETURN_ERR 驱动忙
  */
-int32_t send_ir_code_start(uint32_t count)
+static int32_t ir_send_claim(void)
 {
     int ret = RETURN_OK;
     /*if busy just discard message, demo code no return error*/
@@ -521,6 +1014,13 @@ int32_t send_ir_code_start(uint32_t count)
         ir_state.event = IR_EVENT_ERR;
         ret = RETURN_ERR;
     }
+    else if((!ir_clock_ready) && (!ir_send_capture))
+    {
+        /*时钟不能准确产生载波, 由上层等IR_CLOCK_READY后再发送*/
+        ir_deferred_sends++;
+        ir_state.event = IR_SEND_DEFERRED;
+        ret = RETURN_ERR;
+    }
     else
     {
         ir_state.is_busy = true;
@@ -536,15 +1036,203 @@ int32_t send_ir_code_start(uint32_t count)
     if(ir_state.event == IR_SEND_START)
     {
         ir_code_send_count = 0;
+        if(ir_carrier_stale && (!ir_send_capture))
+        {
+            ir_carrier_init();
+        }
+#if IR_SEND_JITTER_MEASURE
+        memset(&ir_jitter,0,sizeof(ir_jitter));
+        jitter_cycle_per_tick = get_ipcore_clk()/get_apb_clk();
+#endif
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief 红外数据发送
+ * @note no support multi thread,used this only one task!
+ * @param count uint32_t freq,uint32_t dutycycle  now just 38khz 50%
+ *
+ * @retval RETURN_OK 发送成功
+ * @retval RETURN_ERR 发送失败
+ */
+int32_t send_ir_code_start(uint32_t count)
+{
+    int ret = ir_send_claim();
+
+    if((ir_state.event == IR_SEND_START) && ir_send_capture)
+    {
+        /*电平原样留在数据buf中, 不换算成计数值*/
+        ir_capture_count = count;
+        ir_capture_sends++;
+        ir_state.is_busy = false;
+        ir_state.event = IR_SEND_END;
+        if(is_callback_vaild())
+        {
+            g_ir_callback(&ir_state);
+        }
+        return ret;
+    }
+
+    if(ir_state.event == IR_SEND_START)
+    {
         ir_code_total_count = count;
         ci_loginfo(LOG_IR,"read ir ok\n");
-        send_ir_code_continue();
+        if(RETURN_OK == ir_build_reload_table(count))
+        {
+            /*载波整串发送期间一直开着, 由管脚复用控制有无载波*/
+            ir_send_table = true;
+            pwm_start(ir_driver_info.outPin.PwmBase);
+            send_ir_table_continue();
+        }
+        else
+        {
+            send_ir_code_continue();
+        }
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief 流式红外数据发送, 不使用数据buf
+ * @note 电平由生成器在定时器中断中逐个产生, 总是提前一个电平取出,
+ *       生成器要足够快, 不能阻塞, 返回false表示发送结束
+ *
+ * @param generator 电平生成器, 第一个电平有载波, 之后交替
+ * @param arg 传给生成器的参数
+ *
+ * @retval RETURN_OK 发送成功
+ * @retval RETURN_ERR 发送失败
+ */
+int32_t send_ir_code_stream(ir_send_level_generator_t generator, void *arg)
+{
+    int ret = ir_send_claim();
+
+    if(ir_state.event == IR_SEND_START)
+    {
+        ir_send_generator = generator;
+        ir_send_generator_arg = arg;
+        ir_stream_error = false;
+        ir_time_function = 1;
+        ir_stream_fetch();
+        if(0 == ir_stream_next)
+        {
+            /*一个电平都没有, 和从数据buf发送一样按数据错误结束*/
+            ir_stream_error = true;
+        }
+        pwm_start(ir_driver_info.outPin.PwmBase);
+        send_ir_stream_continue();
     }
 
     return ret;
 }
 
 
+/**
+ * @brief 中止正在进行的发送
+ * @note 用于等待发送结束超时, 停止后不再调用流式发送的生成器, 也不调用回调
+ *
+ */
+void ir_send_stop(void)
+{
+    /*关中断, 防止定时器中断同时在发下一个电平*/
+    eclic_irq_disable(ir_driver_info.irTimer.ir_use_timer_IRQ);
+    if(ir_state.is_busy && (1 == ir_time_function))
+    {
+        timer_stop(ir_driver_info.irTimer.ir_use_timer);
+        ir_pwm_out_pad_disable();
+        ir_send_table = false;
+        ir_send_generator = NULL;
+        ir_state.is_busy = false;
+        ir_state.event = IR_IDEL;
+    }
+    eclic_irq_enable(ir_driver_info.irTimer.ir_use_timer_IRQ);
+}
+
+
+/**
+ * @brief 设置截获模式, 用于预先生成红外码
+ * @note 截获模式下send_ir_code_start不发送, 电平留在数据buf中, 立即以IR_SEND_END结束,
+ *       打开时清空截获计数
+ *
+ * @param enable true:截获 false:正常发送
+ */
+void set_ir_send_capture(bool enable)
+{
+    ir_send_capture = enable;
+    ir_capture_count = 0;
+    ir_capture_sends = 0;
+}
+
+
+/**
+ * @brief 获取截获的电平
+ *
+ * @param sends 截获的发送次数, 大于1时数据buf中只有最后一次的电平, 可以为NULL
+ * @return uint32_t 最后一次截获的电平数量
+ */
+uint32_t get_ir_send_capture(uint32_t *sends)
+{
+    if(NULL != sends)
+    {
+        *sends = ir_capture_sends;
+    }
+    return ir_capture_count;
+}
+
+
+/**
+ * @brief 设置发送前是否把电平换算成定时器计数值
+ * @note 换算会改写数据buf, 关闭后每个边沿在中断中换算, 用于对比边沿抖动
+ *
+ * @param enable true:换算 false:不换算
+ */
+void set_ir_send_precompute(bool enable)
+{
+    ir_send_precompute = enable;
+}
+
+
+#if IR_ISR_STATS
+/**
+ * @brief 获取红外中断耗时统计
+ *
+ * @param stats 统计结果
+ */
+void ir_get_isr_stats(ir_isr_stats_t *stats)
+{
+    memcpy(stats,&ir_isr_stats,sizeof(ir_isr_stats_t));
+}
+
+
+/**
+ * @brief 清除红外中断耗时统计
+ *
+ */
+void ir_clear_isr_stats(void)
+{
+    memset(&ir_isr_stats,0,sizeof(ir_isr_stats_t));
+}
+#endif
+
+
+#if IR_SEND_JITTER_MEASURE
+/**
+ * @brief 获取最近一次发送的边沿抖动统计
+ *
+ * @param jitter 统计结果
+ */
+void ir_get_send_jitter(ir_send_jitter_t *jitter)
+{
+    memcpy(jitter,&ir_jitter,sizeof(ir_send_jitter_t));
+}
+#endif
+
+
 /**
  * @brief 红外数据开始接收
  *
@@ -578,18 +1266,32 @@ void ir_receive_start(int time_out)
         gpio_clear_irq_single(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
 
         timer_stop(ir_driver_info.irTimer.ir_use_timer);
-        timer_set_count(ir_driver_info.irTimer.ir_use_timer,time_out*1000*TIMER0_ONEUS_COUNT);
+        timer_set_count(ir_driver_info.irTimer.ir_use_timer,IR_US_TO_TICKS(time_out*1000));
         timer_start(ir_driver_info.irTimer.ir_use_timer);
 
         ir_receive_state = IR_RECEIVE_STATE_INIT;
         ir_receive_level_flag = IR_RECEIVE_FIRST_LEVEL;
         ir_receive_level_count = 0;
+        ir_receive_end_ticks = IR_US_TO_TICKS(ir_receive_end_gap);
     }
 
 
 }
 
 
+/**
+ * @brief 设置接收结束的静默时间, 下次ir_receive_start时生效
+ * @note 默认100ms, 按住遥控器时的重复码也会收进来; 设置得比帧间隔短时,
+ *       第一帧结束后很快就能拿到数据, 适合学习按键
+ *
+ * @param gap_us 没有边沿超过这么久认为接收结束, 单位us
+ */
+void set_ir_receive_end_gap(uint32_t gap_us)
+{
+    ir_receive_end_gap = gap_us;
+}
+
+
 /**
  * @brief 检查红外接收是否正确
  *
@@ -628,6 +1330,78 @@ int32_t check_ir_busy_state(void)
     }
 }
 
+/**
+ * @brief 开始流式NEC接收
+ * @note 不使用电平缓冲区, 每收到一帧或一个重复码通过回调上报IR_RECEIVE_NEC_FRAME或IR_RECEIVE_NEC_REPEAT,
+ *       第一次收到对不上NEC的载波时上报IR_RECEIVE_NEC_OTHER,
+ *       一直接收直到调用ir_receive_nec_stop
+ *
+ * @retval RETURN_OK 开始接收
+ * @retval RETURN_ERR 正在收发
+ */
+int32_t ir_receive_nec_start(void)
+{
+    if(ir_state.is_busy)
+    {
+        return RETURN_ERR;
+    }
+    ir_state.is_busy = true;
+    ir_state.event = IR_RECEIVE_START;
+
+    /*门限在开始时换算成定时器计数值, 中断中直接比较*/
+    nec_ticks.hdr_mark_min = IR_US_TO_TICKS(NEC_HDR_MARK_MIN);
+    nec_ticks.hdr_mark_max = IR_US_TO_TICKS(NEC_HDR_MARK_MAX);
+    nec_ticks.hdr_space_min = IR_US_TO_TICKS(NEC_HDR_SPACE_MIN);
+    nec_ticks.hdr_space_max = IR_US_TO_TICKS(NEC_HDR_SPACE_MAX);
+    nec_ticks.rpt_space_min = IR_US_TO_TICKS(NEC_RPT_SPACE_MIN);
+    nec_ticks.rpt_space_max = IR_US_TO_TICKS(NEC_RPT_SPACE_MAX);
+    nec_ticks.bit_mark_min = IR_US_TO_TICKS(NEC_BIT_MARK_MIN);
+    nec_ticks.bit_mark_max = IR_US_TO_TICKS(NEC_BIT_MARK_MAX);
+    nec_ticks.zero_space_max = IR_US_TO_TICKS(NEC_ZERO_SPACE_MAX);
+    nec_ticks.one_space_min = IR_US_TO_TICKS(NEC_ONE_SPACE_MIN);
+    nec_ticks.one_space_max = IR_US_TO_TICKS(NEC_ONE_SPACE_MAX);
+    nec_ticks.timeout = IR_US_TO_TICKS(NEC_HDR_MARK_MAX*2);
+
+    nec_edge_valid = false;
+    nec_other_reported = false;
+    nec_state = NEC_STATE_IDLE;
+    ir_receive_stream = true;
+    ir_time_function = 0;
+
+    if(is_callback_vaild())
+    {
+        g_ir_callback(&ir_state);
+    }
+
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
+    gpio_set_input_mode(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
+    gpio_clear_irq_single(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
+    gpio_irq_unmask(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
+
+    return RETURN_OK;
+}
+
+
+/**
+ * @brief 停止流式NEC接收
+ *
+ */
+void ir_receive_nec_stop(void)
+{
+    if(!ir_receive_stream)
+    {
+        return;
+    }
+    gpio_irq_mask(ir_driver_info.revPin.GpioBase, ir_driver_info.revPin.PinNum);
+    timer_stop(ir_driver_info.irTimer.ir_use_timer);
+    ir_receive_stream = false;
+    nec_edge_valid = false;
+    ir_time_function = 1;
+    ir_state.is_busy = false;
+    ir_state.event = IR_IDEL;
+}
+
+
 uint32_t get_receive_level_count(void)
 {
     return ir_receive_level_count;
@@ -649,3 +1423,93 @@ int32_t set_odd_even_carry_pwm_wave(int odd_even)
     odd_even_carry_pwm_wave = (1 == (odd_even%2)) ? 1 : 0;
     return 0;
 }
+
+/**
+ * @brief 时钟改变后重新计算定时器计数值, 切换功耗模式后调用
+ * @note 可以在中断中调用. 正在发送时, 还没发送的计数值按新时钟换算;
+ *       载波要用pwm_init重新配置, 只在任务中且没有发送时立即配置, 否则推迟到下次发送开始时,
+ *       正在发送的这一串之后的载波频率会跟着时钟变;
+ *       时钟从不能发送变为可以发送时以IR_CLOCK_READY通知回调, 回调可能在任务中也可能在中断中
+ */
+void ir_clock_update(void)
+{
+    uint32_t apb = get_apb_clk();
+    bool was_ready = ir_clock_ready;
+    bool sending;
+
+    if((false == hw_Init) || (1000000 > apb))
+    {
+        ir_clock_ready = false;
+        return;
+    }
+
+    /*关掉红外定时器中断, 防止换算到一半时中断用新旧混合的计数值*/
+    eclic_irq_disable(ir_driver_info.irTimer.ir_use_timer_IRQ);
+    sending = ir_state.is_busy && (1 == ir_time_function);
+    if(((uint32_t)(((uint64_t)apb<<16)/1000000)) != ir_tick_per_us)
+    {
+        /*新旧时钟之比, 16位小数, 已经换算好的计数值乘上它, 中断关着时不做除法*/
+        uint32_t old_tick_per_us = ir_tick_per_us;
+        uint32_t ratio;
+
+        ir_tick_scale_init(apb);
+        ratio = (uint32_t)(((uint64_t)ir_tick_per_us<<16)/old_tick_per_us);
+        if(sending && ir_send_table)
+        {
+            uint32_t *reload = (uint32_t *)ir_level_code;
+            for(uint32_t i=ir_code_send_count;i<ir_code_total_count;i++)
+            {
+                reload[i] = (uint32_t)(((uint64_t)reload[i]*ratio)>>16);
+            }
+        }
+        if(sending && (NULL != ir_send_generator))
+        {
+            ir_stream_next = (uint32_t)(((uint64_t)ir_stream_next*ratio)>>16);
+        }
+        if(ir_state.is_busy && (0 == ir_time_function))
+        {
+            ir_receive_end_ticks = IR_US_TO_TICKS(ir_receive_end_gap);
+        }
+    }
+    ir_carrier_stale = true;
+    eclic_irq_enable(ir_driver_info.irTimer.ir_use_timer_IRQ);
+
+    if((!sending) && (0 == check_curr_trap()))
+    {
+        ir_carrier_init();
+    }
+
+    ir_clock_ready = ir_clock_accurate();
+    if((!was_ready) && ir_clock_ready && is_callback_vaild())
+    {
+        IrRemoteState state = {ir_state.is_busy, IR_CLOCK_READY, 0};
+        g_ir_callback(&state);
+    }
+}
+
+
+/**
+ * @brief 当前时钟能否发送
+ *
+ * @retval RETURN_OK 可以发送
+ * @retval RETURN_ERR 时钟不能准确产生载波, 发送会被推迟
+ */
+int32_t check_ir_clock_ready(void)
+{
+    return ir_clock_ready ? RETURN_OK : RETURN_ERR;
+}
+
+
+/**
+ * @brief 获取因时钟不能准确产生载波而推迟的发送次数
+ */
+uint32_t get_ir_deferred_sends(void)
+{
+    return ir_deferred_sends;
+}
+
+/*获取奇数还是偶数电平载波*/
+int32_t get_odd_even_carry_pwm_wave(void)
+{
+    return odd_even_carry_pwm_wave;
+}
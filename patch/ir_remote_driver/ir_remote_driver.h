@@ -70,9 +70,14 @@ typedef enum
     IR_SEND_END,               //发送结束
     IR_RECEIVE_START,          //开始接收
     IR_RECEIVE_END,            //结束接收
+    IR_RECEIVE_NEC_FRAME,      //流式接收到一帧NEC码
+    IR_RECEIVE_NEC_REPEAT,     //流式接收到NEC重复码
+    IR_RECEIVE_NEC_OTHER,      //流式接收到不是NEC的载波
+    IR_CLOCK_READY,            //时钟恢复到可以发送
     IR_EVENT_ERR = -1,         //错误事件
     IR_SEND_DATA_ERR = -2,     //发送数据错误
     IR_RECEIVE_SHORT_ERR = -3, //接收数据太短错误
+    IR_SEND_DEFERRED = -4,     //时钟不能准确产生载波, 发送被推迟
 
 } IrRemoteEvent;
 
@@ -80,9 +85,12 @@ typedef struct
 {
     bool is_busy;        //忙碌
     IrRemoteEvent event; //事件
+    uint32_t code;       //流式接收到的NEC码, 第一个字节在最低位
 } IrRemoteState;
 
 typedef void (*ir_remote_event_callback_t)(IrRemoteState *state);
+/*流式发送的电平生成器, 在定时器中断中调用, 取出一个电平返回true, 没有电平时返回false*/
+typedef bool (*ir_send_level_generator_t)(void *arg, uint16_t *level);
 
 /*ir send and receive config*/
 #define IR_OUT_PWM_PIN_NAME                      PWM3_PAD
@@ -113,6 +121,32 @@ typedef void (*ir_remote_event_callback_t)(IrRemoteState *state);
 #define IR_REV_IO_IRQ_PRIORITY_PREEMPTION        GPIO0_PRIORITY_PREEMPTION
 #define IR_REV_IO_IRQ_PRIORITY_SUB               GPIO0_PRIORITY_SUB
 #define IR_DATA_DIV_COEFFICIENT (2)
+/*统计发送边沿抖动, 每个边沿在中断中多读一次mcycle, 调试时打开*/
+#ifndef IR_SEND_JITTER_MEASURE
+#define IR_SEND_JITTER_MEASURE  (0)
+#endif
+
+/*统计每次红外中断的耗时, 进出中断各读一次mcycle, 调试时打开*/
+#ifndef IR_ISR_STATS
+#define IR_ISR_STATS            (0)
+#endif
+
+typedef struct
+{
+    uint32_t tx_edges;        //发送中断次数
+    uint32_t tx_cycles_max;   //单次发送中断的最大耗时, 单位CPU周期
+    uint64_t tx_cycles_total; //发送中断的总耗时, 除以tx_edges即为每个边沿的平均耗时
+    uint32_t rx_edges;        //接收中断次数, 包括接收超时
+    uint32_t rx_cycles_max;   //单次接收中断的最大耗时, 单位CPU周期
+    uint64_t rx_cycles_total; //接收中断的总耗时
+} ir_isr_stats_t;
+
+typedef struct
+{
+    uint32_t edges;  //统计的边沿数
+    int32_t err_min; //实际电平长度减去期望长度的最小值, 单位CPU周期
+    int32_t err_max; //实际电平长度减去期望长度的最大值, 单位CPU周期, 与err_min之差即为抖动
+} ir_send_jitter_t;
 
 
 /**
@@ -128,11 +162,28 @@ int32_t set_ir_level_code_addr(uint32_t addr, uint32_t size);
 /* 发送API */
 void ir_send_init(void);
 int32_t send_ir_code_start(uint32_t count);
+int32_t send_ir_code_stream(ir_send_level_generator_t generator, void *arg);
+void ir_send_stop(void);
+void set_ir_send_precompute(bool enable);
+void set_ir_send_capture(bool enable);
+uint32_t get_ir_send_capture(uint32_t *sends);
+#if IR_SEND_JITTER_MEASURE
+void ir_get_send_jitter(ir_send_jitter_t *jitter);
+#endif
+
+/* 中断耗时统计API */
+#if IR_ISR_STATS
+void ir_get_isr_stats(ir_isr_stats_t *stats);
+void ir_clear_isr_stats(void);
+#endif
 
 /* 接收API */
 void ir_receive_start(int time_out);
 int32_t check_ir_receive(void);
 void ir_receive_end(void);
+void set_ir_receive_end_gap(uint32_t gap_us);
+int32_t ir_receive_nec_start(void);
+void ir_receive_nec_stop(void);
 
 /* 状态查询API */
 uint16_t *get_ir_level_code_addr(void);
@@ -143,6 +194,12 @@ void set_receive_level_count(uint32_t level_cnt);
 
 /*设置奇数还是偶数电平载波*/
 int32_t set_odd_even_carry_pwm_wave(int odd_even);
+int32_t get_odd_even_carry_pwm_wave(void);
+
+/*切换功耗模式后重新计算时钟*/
+void ir_clock_update(void);
+int32_t check_ir_clock_ready(void);
+uint32_t get_ir_deferred_sends(void);
 
 /**
  * @brief 注册IR事件回调函数
@@ -0,0 +1,602 @@
+#include "aircon.h"
+
+#if AIRCON_ENABLE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "sdk_default_config.h"
+#include "ci_nvdata_manage.h"
+#include "ci_log.h"
+#include "nv_store.h"
+#include "light.h"
+#include "ir_remote_driver.h"
+#include "ir_protocol.h"
+#include "ir_code.h"
+#include "system_msg_deal.h"
+#include "prompt_player.h"
+
+#define ARRAY_LENGTH(arr) (sizeof(arr) / sizeof(arr[0]))
+
+#define NVDATA_ID_AIRCON (NVDATA_ID_USER_START + 3)
+// 码库自己发送时最多等这么久
+#define AIRCON_LIVE_TIMEOUT_MS 2000
+// 发送队列中的特殊消息, 空调命令都小于这两个值
+#define AIRCON_MSG_MATCH 0xFF
+#define AIRCON_MSG_CONFIRM 0xFE
+// 超过这么久的space认为是帧间隔, 特征只看第一帧(单位同驱动电平)
+#define AIRCON_FRAME_GAP 2500
+// 特征时长相差不超过这么多时认为一致, 百分比加上固定误差(单位同驱动电平)
+#define AIRCON_MATCH_TOLERANCE 25
+#define AIRCON_MATCH_SKEW 50
+// 接收头可能多收或者漏掉边沿, 电平数量相差不超过这么多时认为一致
+#define AIRCON_MATCH_COUNT_SKEW 2
+// 等待用户按遥控器的时间
+#define AIRCON_MATCH_TIMEOUT_MS 10000
+// 空调遥控器一次按键会连发几帧, 没有边沿超过这么久才认为接收结束
+#define AIRCON_MATCH_END_GAP_US 100000
+// 发送候选码后等待用户确认的时间
+#define AIRCON_MATCH_CONFIRM_MS 6000
+
+typedef struct
+{
+    uint32_t codeid;          // 码库ID
+    normal_status_t status;   // 当前空调状态
+} AirconConfig;
+
+typedef struct
+{
+    normal_status_t from;     // 发送前的状态
+    normal_status_t to;       // 发送后的状态
+    uint8_t cmd;              // 空调命令, 0表示空闲
+    uint8_t parity;           // 码库要求的载波电平奇偶
+    uint32_t used;            // 最后一次使用的序号, 最小的先淘汰
+    uint8_t code[AIRCON_CODE_SIZE];
+} AirconFrame;
+
+/**
+ * 一种码的时序特征, 同一个码库ID的所有按键都是整帧发送空调状态, 特征与按键无关
+ */
+typedef struct
+{
+    uint32_t codeid;
+    uint16_t count;           // 第一帧的电平数量
+    uint16_t header[2];       // 引导码的mark和space
+    uint16_t mark;            // 数据位的平均mark
+    uint16_t space[2];        // 数据位最短和最长的space
+} AirconSignature;
+
+// 空闲时预先生成的命令, 按常用程度排列, 一次只生成当前状态出发的一步, 不能超过缓存条数
+static const uint8_t precompute_cmds[] =
+{
+    AIRCON_CMD_ON,
+    AIRCON_CMD_OFF,
+    AIRCON_CMD_TEMP_UP,
+    AIRCON_CMD_TEMP_DOWN,
+    AIRCON_CMD_TEMP(26),
+    AIRCON_CMD_MODE_COOL,
+    AIRCON_CMD_MODE_HEAT,
+    AIRCON_CMD_TEMP(24),
+    AIRCON_CMD_TEMP(25),
+    AIRCON_CMD_TEMP(20),
+    AIRCON_CMD_FAN_UP,
+    AIRCON_CMD_FAN_DOWN,
+    AIRCON_CMD_MODE_FAN,
+    AIRCON_CMD_SWING_ON,
+    AIRCON_CMD_SWING_OFF,
+};
+
+static AirconConfig config;
+static AirconFrame cache[AIRCON_CACHE_SIZE];
+static uint32_t use_count = 0;
+static bool cacheable = true;           // 码库一条命令要发多帧或者码太长时不缓存
+static uint8_t precompute_next = 0;     // 下一个预先生成的命令在precompute_cmds中的下标
+static volatile int32_t brand_request = -1;
+static QueueHandle_t cmd_queue = NULL;
+// 码库中各个品牌的特征, 按电平数量排序, 第一次匹配时生成
+static AirconSignature signatures[BRAND_MAX];
+static uint8_t signature_count = 0;
+
+static bool is_same_status(const normal_status_t *a, const normal_status_t *b)
+{
+    return memcmp(a, b, sizeof(normal_status_t)) == 0;
+}
+
+static AirconFrame *cache_find(const normal_status_t *from, uint8_t cmd)
+{
+    for (uint8_t i = 0; i < AIRCON_CACHE_SIZE; i++)
+    {
+        if (cache[i].cmd == cmd && is_same_status(&cache[i].from, from))
+        {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 让码库在截获模式下从当前状态生成codeid的cmd命令, 不真正发送, 电平留在驱动缓冲区中
+ *      - 需要持有ir_protocol_lock, 码库中的状态会变为发送后的状态
+ *
+ * @param parity 输出码库要求的载波电平奇偶
+ * @param sends 输出码库发送的次数, 大于1时缓冲区中只有最后一次的电平
+ * @return 电平数量
+ */
+static uint32_t aircon_dry_run(uint32_t codeid, uint8_t cmd, uint8_t *parity, uint32_t *sends)
+{
+    uint32_t count;
+
+    save_air_normal_status_val(&config.status);
+    set_ir_send_capture(true);
+    ir_data_Air_Send_Ctl(codeid, cmd);
+    set_ir_send_capture(false);
+    count = get_ir_send_capture(sends);
+    *parity = get_odd_even_carry_pwm_wave();
+    set_odd_even_carry_pwm_wave(1);
+    return count;
+}
+
+/**
+ * @brief 生成cmd的红外码并压缩进缓存
+ *      - 需要持有ir_protocol_lock, 码库中的状态会变为发送后的状态
+ *
+ * @return 缓存的红外码, 码库一条命令要发多帧或者压缩后放不下时为NULL
+ */
+static AirconFrame *aircon_capture(uint8_t cmd)
+{
+    AirconFrame *frame = &cache[0];
+    uint32_t count, sends;
+    uint8_t parity;
+
+    count = aircon_dry_run(config.codeid, cmd, &parity, &sends);
+    if (count == 0 || sends != 1)
+    {
+        return NULL;
+    }
+
+    for (uint8_t i = 1; i < AIRCON_CACHE_SIZE; i++)
+    {
+        if (cache[i].used < frame->used)
+        {
+            frame = &cache[i];
+        }
+    }
+    frame->cmd = 0;
+    if (ir_code_compress(get_ir_driver_buf(), count, frame->code, sizeof(frame->code)) == 0)
+    {
+        return NULL;
+    }
+    frame->from = config.status;
+    frame->to = *get_air_normal_status_val();
+    frame->cmd = cmd;
+    frame->parity = parity;
+    frame->used = ++use_count;
+    return frame;
+}
+
+/**
+ * @brief 码库自己发送, 用于不能缓存的品牌
+ */
+static int aircon_send_live(uint8_t cmd)
+{
+    uint32_t waited = 0;
+
+    save_air_normal_status_val(&config.status);
+    ir_data_Air_Send_Ctl(config.codeid, cmd);
+    // 码库改了载波奇偶, 发送完才能改回来
+    while (check_ir_busy_state() == RETURN_OK && waited < AIRCON_LIVE_TIMEOUT_MS)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        waited += 10;
+    }
+    set_odd_even_carry_pwm_wave(1);
+    config.status = *get_air_normal_status_val();
+    return waited < AIRCON_LIVE_TIMEOUT_MS ? RETURN_OK : RETURN_ERR;
+}
+
+static int aircon_send(uint8_t cmd)
+{
+    AirconFrame *frame;
+    int ret;
+
+    ir_protocol_lock();
+    frame = cache_find(&config.status, cmd);
+    if (frame == NULL && cacheable)
+    {
+        frame = aircon_capture(cmd);
+        if (frame == NULL)
+        {
+            ci_logwarn(LOG_USER, "aircon: code %d can't be cached\n", config.codeid);
+            cacheable = false;
+        }
+    }
+    if (frame != NULL)
+    {
+        frame->used = ++use_count;
+        set_odd_even_carry_pwm_wave(frame->parity);
+        ret = ir_code_send(frame->code);
+        set_odd_even_carry_pwm_wave(1);
+        config.status = frame->to;
+    }
+    else
+    {
+        ret = aircon_send_live(cmd);
+    }
+    ir_protocol_unlock();
+
+    // 状态变了, 从新状态出发重新预先生成
+    precompute_next = 0;
+    nv_store_write(NVDATA_ID_AIRCON, &config, sizeof(config));
+    return ret;
+}
+
+/**
+ * @brief 预先生成一条从当前状态出发的命令
+ */
+static void aircon_precompute(void)
+{
+    uint8_t cmd = precompute_cmds[precompute_next++];
+
+    if (cache_find(&config.status, cmd) != NULL)
+    {
+        return;
+    }
+    ir_protocol_lock();
+    if (aircon_capture(cmd) == NULL)
+    {
+        cacheable = false;
+    }
+    // 预先生成不改变空调状态
+    save_air_normal_status_val(&config.status);
+    ir_protocol_unlock();
+}
+
+static void aircon_use_brand(uint32_t codeid)
+{
+    ir_protocol_lock();
+    config.codeid = codeid;
+    memset(cache, 0, sizeof(cache));
+    use_count = 0;
+    cacheable = true;
+    precompute_next = 0;
+    ir_protocol_unlock();
+    nv_store_write(NVDATA_ID_AIRCON, &config, sizeof(config));
+}
+
+/**
+ * @brief 提取第一帧的时序特征
+ *
+ * @param levels 电平, 偶数位置为mark
+ * @return false 电平太少, 不像是空调遥控器
+ */
+static bool aircon_fingerprint(const uint16_t *levels, uint32_t count, AirconSignature *sig)
+{
+    uint32_t n = 2;
+    uint32_t mark_sum = 0;
+
+    while (n < count && !((n & 1) && levels[n] >= AIRCON_FRAME_GAP))
+    {
+        n++;
+    }
+    // 至少要有引导码和8个数据位
+    if (n < 2 + 8 * 2)
+    {
+        return false;
+    }
+    sig->count = n;
+    sig->header[0] = levels[0];
+    sig->header[1] = levels[1];
+    sig->space[0] = UINT16_MAX;
+    sig->space[1] = 0;
+    for (uint32_t i = 2; i < n; i++)
+    {
+        if (i & 1)
+        {
+            sig->space[0] = levels[i] < sig->space[0] ? levels[i] : sig->space[0];
+            sig->space[1] = levels[i] > sig->space[1] ? levels[i] : sig->space[1];
+        }
+        else
+        {
+            mark_sum += levels[i];
+        }
+    }
+    sig->mark = mark_sum / ((n - 1) / 2);
+    return true;
+}
+
+static bool is_near(uint16_t expected, uint16_t actual, uint32_t *distance)
+{
+    uint16_t diff = expected > actual ? expected - actual : actual - expected;
+    *distance += diff;
+    return diff <= (uint32_t) expected * AIRCON_MATCH_TOLERANCE / 100 + AIRCON_MATCH_SKEW;
+}
+
+/**
+ * @brief 比较两个特征
+ *
+ * @return 各项时长的差值之和, 不一致时为UINT32_MAX
+ */
+static uint32_t signature_distance(const AirconSignature *expected, const AirconSignature *actual)
+{
+    uint32_t distance = 0;
+
+    if (!is_near(expected->header[0], actual->header[0], &distance)
+        || !is_near(expected->header[1], actual->header[1], &distance)
+        || !is_near(expected->mark, actual->mark, &distance)
+        || !is_near(expected->space[0], actual->space[0], &distance)
+        || !is_near(expected->space[1], actual->space[1], &distance))
+    {
+        return UINT32_MAX;
+    }
+    return distance;
+}
+
+static int signature_compare(const void *a, const void *b)
+{
+    return ((const AirconSignature *) a)->count - ((const AirconSignature *) b)->count;
+}
+
+/**
+ * @brief 生成码库中各个品牌的特征索引
+ *      - 每个品牌截获一次开机命令, 每次只占用驱动几毫秒
+ */
+static void aircon_build_index(void)
+{
+    uint32_t count, sends;
+    uint8_t parity;
+    uint8_t i;
+
+    if (signature_count > 0)
+    {
+        return;
+    }
+    for (int brand = 0; brand < BRAND_MAX; brand++)
+    {
+        int codeid = get_airc_brand_id(brand);
+        if (codeid < 0)
+        {
+            continue;
+        }
+        // 有的品牌共用一套码
+        for (i = 0; i < signature_count && signatures[i].codeid != (uint32_t) codeid; i++);
+        if (i < signature_count)
+        {
+            continue;
+        }
+        ir_protocol_lock();
+        count = aircon_dry_run(codeid, AIRCON_CMD_ON, &parity, &sends);
+        // 码库要求奇数电平有载波时第一个电平是space
+        if (count > 1 && aircon_fingerprint(get_ir_driver_buf() + !parity, count - !parity, &signatures[i]))
+        {
+            signatures[i].codeid = codeid;
+            signature_count++;
+        }
+        save_air_normal_status_val(&config.status);
+        ir_protocol_unlock();
+    }
+    qsort(signatures, signature_count, sizeof(AirconSignature), signature_compare);
+    ci_loginfo(LOG_USER, "aircon: indexed %d codes\n", signature_count);
+}
+
+/**
+ * @brief 在索引中查找特征一致的码
+ *
+ * @param codeids 输出候选的码库ID, 最像的在前
+ * @return 候选数量
+ */
+static uint8_t aircon_lookup(const AirconSignature *sig, uint32_t *codeids)
+{
+    uint32_t distances[AIRCON_MATCH_CANDIDATES];
+    uint8_t found = 0;
+    uint8_t low = 0, high = signature_count;
+
+    // 索引按电平数量排序, 二分找到数量相近的第一个
+    while (low < high)
+    {
+        uint8_t mid = (low + high) / 2;
+        if (signatures[mid].count + AIRCON_MATCH_COUNT_SKEW < sig->count)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    for (uint8_t i = low; i < signature_count && signatures[i].count <= sig->count + AIRCON_MATCH_COUNT_SKEW; i++)
+    {
+        uint32_t d = signature_distance(&signatures[i], sig);
+        uint8_t j;
+        if (d == UINT32_MAX || (found == AIRCON_MATCH_CANDIDATES && d >= distances[found - 1]))
+        {
+            continue;
+        }
+        j = found < AIRCON_MATCH_CANDIDATES ? found++ : found - 1;
+        while (j > 0 && distances[j - 1] > d)
+        {
+            distances[j] = distances[j - 1];
+            codeids[j] = codeids[j - 1];
+            j--;
+        }
+        distances[j] = d;
+        codeids[j] = signatures[i].codeid;
+    }
+    return found;
+}
+
+/**
+ * @brief 等待用户确认空调有反应
+ */
+static bool aircon_wait_confirm(void)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(AIRCON_MATCH_CONFIRM_MS);
+    TickType_t elapsed;
+    uint8_t msg;
+
+    while ((elapsed = xTaskGetTickCount() - start) < timeout)
+    {
+        // 匹配期间的其他命令直接丢掉
+        if (xQueueReceive(cmd_queue, &msg, timeout - elapsed) == pdTRUE && msg == AIRCON_MSG_CONFIRM)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void aircon_match_report(bool ok)
+{
+    pause_voice_in();
+    prompt_play_by_cmd_string(ok ? "<match_ok>" : "<match_fail>", -1, default_play_done_callback, true);
+}
+
+/**
+ * @brief 收一帧用户遥控器的码, 按特征在索引中找到候选, 依次发送开机命令让用户确认
+ */
+static void aircon_match(void)
+{
+    AirconConfig saved = config;
+    AirconSignature sig;
+    uint32_t codeids[AIRCON_MATCH_CANDIDATES];
+    const uint16_t *levels;
+    uint32_t count;
+    uint8_t found = 0;
+
+    aircon_build_index();
+    ci_loginfo(LOG_USER, "aircon: press any key on the remote\n");
+    ir_protocol_lock();
+    count = ir_protocol_receive(&levels, AIRCON_MATCH_END_GAP_US, AIRCON_MATCH_TIMEOUT_MS);
+    if (count > 0 && aircon_fingerprint(levels, count, &sig))
+    {
+        found = aircon_lookup(&sig, codeids);
+    }
+    ir_protocol_unlock();
+    ci_loginfo(LOG_USER, "aircon: %d levels, %d candidates\n", count, found);
+
+    for (uint8_t i = 0; i < found; i++)
+    {
+        aircon_use_brand(codeids[i]);
+        aircon_send(AIRCON_CMD_ON);
+        if (aircon_wait_confirm())
+        {
+            ci_loginfo(LOG_USER, "aircon: matched code %d\n", codeids[i]);
+            aircon_match_report(true);
+            return;
+        }
+    }
+    // 都不对, 恢复原来的码
+    aircon_use_brand(saved.codeid);
+    config.status = saved.status;
+    nv_store_write(NVDATA_ID_AIRCON, &config, sizeof(config));
+    aircon_match_report(false);
+}
+
+/**
+ * @brief 空调发送任务
+ *      - 有命令时立即发送, 空闲时每次预先生成一条命令, 两条之间检查一次有没有新命令
+ */
+static void aircon_task(void *p_arg)
+{
+    uint8_t cmd;
+
+    while (1)
+    {
+        bool idle = cacheable && precompute_next < ARRAY_LENGTH(precompute_cmds);
+        if (xQueueReceive(cmd_queue, &cmd, idle ? 0 : portMAX_DELAY) != pdTRUE)
+        {
+            aircon_precompute();
+            continue;
+        }
+        if (brand_request >= 0)
+        {
+            aircon_use_brand(brand_request);
+            brand_request = -1;
+        }
+        if (cmd == AIRCON_MSG_MATCH)
+        {
+            aircon_match();
+        }
+        else if (cmd != 0 && cmd != AIRCON_MSG_CONFIRM)
+        {
+            aircon_send(cmd);
+        }
+    }
+}
+
+int aircon_init(void)
+{
+    stIrPinInfo irPinInfo;
+    int ret;
+
+    ret = ir_protocol_pin_info(&irPinInfo);
+    if (ret == RETURN_OK)
+    {
+        ret = ir_init(&irPinInfo);
+    }
+    if (ret == RETURN_OK)
+    {
+        ret = ir_protocol_init();
+    }
+    if (ret != RETURN_OK)
+    {
+        ci_logerr(LOG_USER, "aircon init failed!\n");
+        return RETURN_ERR;
+    }
+#if !LIGHT_IR_ENABLE
+    // 红外夜灯在light_init中初始化驱动
+    ir_hw_init();
+#endif
+
+    config.codeid = get_airc_brand_id(AIRCON_DEFAULT_BRAND);
+    set_air_status_default();
+    config.status = *get_air_normal_status_val();
+    nv_store_load(NVDATA_ID_AIRCON, &config, sizeof(config));
+
+    cmd_queue = xQueueCreate(4, sizeof(uint8_t));
+    if (cmd_queue == NULL || xTaskCreate(aircon_task, "aircon", 256, NULL, 2, NULL) != pdPASS)
+    {
+        ci_logerr(LOG_USER, "aircon task create failed!\n");
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+int aircon_control(aircon_cmd_t cmd)
+{
+    uint8_t msg = cmd;
+
+    if (cmd_queue == NULL || xQueueSend(cmd_queue, &msg, 0) != pdTRUE)
+    {
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+int aircon_set_brand(eAirBrand brand)
+{
+    uint8_t msg = 0;
+    int codeid = get_airc_brand_id(brand);
+
+    if (cmd_queue == NULL || codeid < 0)
+    {
+        return RETURN_ERR;
+    }
+    brand_request = codeid;
+    return xQueueSend(cmd_queue, &msg, 0) == pdTRUE ? RETURN_OK : RETURN_ERR;
+}
+
+int aircon_match_start(void)
+{
+    return aircon_control(AIRCON_MSG_MATCH);
+}
+
+int aircon_match_confirm(void)
+{
+    return aircon_control(AIRCON_MSG_CONFIRM);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _AIRCON_H
+#define _AIRCON_H
+
+#include <stdint.h>
+#include "user_config.h"
+#include "ir_data.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 预先生成的空调码缓存条数
+#define AIRCON_CACHE_SIZE 16
+// 每条缓存的压缩码的最大字节数, 放不下的长码每次都现场生成
+#define AIRCON_CODE_SIZE 112
+// 匹配空调时最多依次尝试的候选码数
+#define AIRCON_MATCH_CANDIDATES 4
+
+// 空调控制命令, 数值就是码库ir_data_Air_Send_Ctl的命令
+typedef enum
+{
+    AIRCON_CMD_ON = 5,
+    AIRCON_CMD_OFF = 6,
+    AIRCON_CMD_FAN_HIGH = 7,
+    AIRCON_CMD_FAN_MID = 8,
+    AIRCON_CMD_FAN_LOW = 9,
+    AIRCON_CMD_FAN_AUTO = 10,
+    AIRCON_CMD_SWING_OFF = 11,
+    AIRCON_CMD_SWING_ON = 12,
+    AIRCON_CMD_MODE_COOL = 25,
+    AIRCON_CMD_MODE_HEAT = 26,
+    AIRCON_CMD_MODE_FAN = 27,
+    AIRCON_CMD_MODE_DRY = 28,
+    AIRCON_CMD_MODE_AUTO = 29,
+    AIRCON_CMD_TEMP_UP = 72,
+    AIRCON_CMD_TEMP_DOWN = 73,
+    AIRCON_CMD_FAN_UP = 74,
+    AIRCON_CMD_FAN_DOWN = 75,
+} aircon_cmd_t;
+
+// 设置到t度(16~30)的命令, 19~30度是13~24, 16~18度是30~32
+#define AIRCON_CMD_TEMP(t) ((t) >= 19 ? (t) - 6 : (t) + 14)
+
+/**
+ * @brief 初始化空调码库和发送任务, 需要在light_init之前调用
+ *      - 码库的ir_init会换掉红外驱动的缓冲区, 这里再换回ir_protocol的缓冲区
+ */
+int aircon_init(void);
+/**
+ * @brief 发送一条空调命令, 由发送任务异步发送
+ *      - 命令对应的红外码已经预先生成时直接发送缓存的码, 不用等码库编码
+ */
+int aircon_control(aircon_cmd_t cmd);
+/**
+ * @brief 切换空调品牌, 清空缓存的红外码
+ */
+int aircon_set_brand(eAirBrand brand);
+/**
+ * @brief 开始匹配空调, 由发送任务异步执行
+ *      - 先收一帧用户空调遥控器的码, 按引导码、数据位时长和帧长度在码库特征索引中找出候选
+ *      - 再依次用候选码发送开机命令, 空调有反应时用户调用aircon_match_confirm确认
+ *      - 比码库逐个品牌轮流发送(ir_data_search_ctl, 每个至少3秒)快得多
+ */
+int aircon_match_start(void);
+/**
+ * @brief 确认刚才发送的候选码能控制空调
+ */
+int aircon_match_confirm(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _CRC16_H
+#define _CRC16_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CRC16_INIT 0xFFFF
+
+/**
+ * @brief 计算CRC16-CCITT(多项式0x1021)
+ *
+ * @param crc 初始值, 分段计算时传入上一段的结果
+ * @param data 数据
+ * @param len 数据长度
+ */
+uint16_t crc16_ccitt(uint16_t crc, const void *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,409 @@
+#include "hw_timer.h"
+
+#include <stddef.h>
+#include <string.h>
+#include "sdk_default_config.h"
+#include "ci112x_scu.h"
+#include "ci112x_system.h"
+#include "ci112x_core_eclic.h"
+#include "ci112x_core_misc.h"
+#include "ci_log.h"
+#if CONFIG_CLI_EN
+#include <stdio.h>
+#include "FreeRTOS.h"
+#include "FreeRTOS_CLI.h"
+#endif
+
+typedef struct
+{
+    timer_base_t base;
+    IRQn_Type irq;
+} HwTimer;
+
+static const HwTimer timers[HW_TIMER_COUNT] =
+{
+    { TIMER0, TIMER0_IRQn },
+    { TIMER1, TIMER1_IRQn },
+    { TIMER2, TIMER2_IRQn },
+    { TIMER3, TIMER3_IRQn },
+};
+
+static const char *owners[HW_TIMER_COUNT] =
+{
+#if CPU_RATE_PRINT
+    // CPU占用率统计固定使用TIMER3
+    [3] = "cpu_rate",
+#endif
+};
+static hw_timer_stats_t stats;
+
+static timer_base_t mux_timer;
+static bool mux_ready = false;
+static hw_timer_event_t *mux_queue = NULL;  // 按到期时刻排序, 同时到期的按启动顺序
+static uint32_t mux_now = 0;                // 定时器上一次装载时的时刻
+static uint32_t mux_loaded = 0;             // 定时器装载的计数值, 0表示没有运行
+static uint32_t mux_tick_per_us = 1;
+
+/**
+ * @brief 关中断, 返回之前的中断状态, 可以嵌套
+ */
+static inline uint32_t irq_lock(void)
+{
+    uint32_t mstatus = read_csr(mstatus);
+    clear_csr(mstatus, MSTATUS_MIE);
+    return mstatus;
+}
+
+static inline void irq_unlock(uint32_t mstatus)
+{
+    if (mstatus & MSTATUS_MIE)
+    {
+        set_csr(mstatus, MSTATUS_MIE);
+    }
+}
+
+static int find_timer(timer_base_t timer)
+{
+    for (int i = 0; i < HW_TIMER_COUNT; i++)
+    {
+        if (timers[i].base == timer)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool is_owner(int index, const char *owner)
+{
+    return owners[index] != NULL && strcmp(owners[index], owner) == 0;
+}
+
+int hw_timer_claim(timer_base_t timer, const char *owner)
+{
+    int index = find_timer(timer);
+    int ret = RETURN_OK;
+    uint32_t s;
+
+    if (index < 0)
+    {
+        return RETURN_ERR;
+    }
+    s = irq_lock();
+    if (owners[index] == NULL)
+    {
+        owners[index] = owner;
+        stats.claims++;
+    }
+    else if (!is_owner(index, owner))
+    {
+        stats.conflicts++;
+        ret = RETURN_ERR;
+    }
+    irq_unlock(s);
+    if (ret != RETURN_OK)
+    {
+        ci_logerr(LOG_USER, "hw_timer: timer %d is owned by %s, %s can't use it\n", index, owners[index], owner);
+    }
+    return ret;
+}
+
+int hw_timer_alloc(const char *owner, timer_base_t *timer)
+{
+    int index = -1;
+    uint32_t s = irq_lock();
+
+    for (int i = 0; i < HW_TIMER_COUNT; i++)
+    {
+        if (is_owner(i, owner))
+        {
+            index = i;
+            break;
+        }
+        if (index < 0 && owners[i] == NULL)
+        {
+            index = i;
+        }
+    }
+    if (index >= 0 && owners[index] == NULL)
+    {
+        owners[index] = owner;
+        stats.claims++;
+    }
+    else if (index < 0)
+    {
+        stats.exhausted++;
+    }
+    irq_unlock(s);
+
+    if (index < 0)
+    {
+        ci_logerr(LOG_USER, "hw_timer: no free timer for %s\n", owner);
+        return RETURN_ERR;
+    }
+    *timer = timers[index].base;
+    return RETURN_OK;
+}
+
+int hw_timer_release(timer_base_t timer, const char *owner)
+{
+    int index = find_timer(timer);
+    int ret = RETURN_ERR;
+    uint32_t s = irq_lock();
+
+    if (index >= 0 && is_owner(index, owner))
+    {
+        owners[index] = NULL;
+        ret = RETURN_OK;
+    }
+    irq_unlock(s);
+    return ret;
+}
+
+const char *hw_timer_owner(timer_base_t timer)
+{
+    int index = find_timer(timer);
+    return index < 0 ? NULL : owners[index];
+}
+
+IRQn_Type hw_timer_irq(timer_base_t timer)
+{
+    int index = find_timer(timer);
+    return timers[index < 0 ? 0 : index].irq;
+}
+
+/**
+ * @brief 定时器已经走过的计数, 需要关中断调用
+ */
+static uint32_t mux_elapsed(void)
+{
+    unsigned int remain = 0;
+
+    if (mux_loaded == 0)
+    {
+        return 0;
+    }
+    timer_get_count(mux_timer, &remain);
+    return remain < mux_loaded ? mux_loaded - remain : 0;
+}
+
+/**
+ * @brief 按队首的到期时刻重新装载定时器, 需要关中断调用
+ */
+static void mux_program(void)
+{
+    int32_t wait;
+
+    mux_now += mux_elapsed();
+    timer_stop(mux_timer);
+    // 停下前可能刚好到期, 清掉挂起的中断, 免得把还没走完的新装载值当成已经走过
+    timer_clear_irq(mux_timer);
+    mux_loaded = 0;
+    if (mux_queue == NULL)
+    {
+        return;
+    }
+    wait = (int32_t) (mux_queue->deadline - mux_now);
+    mux_loaded = wait > HW_TIMER_MUX_MIN_TICKS ? wait : HW_TIMER_MUX_MIN_TICKS;
+    timer_set_count(mux_timer, mux_loaded);
+    timer_start(mux_timer);
+}
+
+/**
+ * @brief 把定时从队列中移除, 需要关中断调用
+ *
+ * @return true 定时在队列中
+ */
+static bool mux_remove(hw_timer_event_t *event)
+{
+    for (hw_timer_event_t **p = &mux_queue; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == event)
+        {
+            *p = event->next;
+            event->next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mux_timer_handler(void)
+{
+    bool first = true;
+
+    timer_clear_irq(mux_timer);
+    // 按实际走过的计数推进, 单次模式到期后停在0, 就是整个装载值
+    mux_now += mux_elapsed();
+    mux_loaded = 0;
+    while (mux_queue != NULL && (int32_t) (mux_queue->deadline - mux_now) <= 0)
+    {
+        hw_timer_event_t *event = mux_queue;
+        mux_queue = event->next;
+        event->next = NULL;
+        stats.mux_fired++;
+        if (!first)
+        {
+            stats.mux_batched++;
+        }
+        first = false;
+        event->callback(event->arg);
+    }
+    mux_program();
+}
+
+int hw_timer_mux_init(void)
+{
+    timer_init_t init;
+
+    if (mux_ready)
+    {
+        return RETURN_OK;
+    }
+    if (hw_timer_alloc("mux", &mux_timer) != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    mux_tick_per_us = get_apb_clk() / 1000000;
+    __eclic_irq_set_vector(hw_timer_irq(mux_timer), (int) mux_timer_handler);
+    eclic_irq_enable(hw_timer_irq(mux_timer));
+    Scu_SetDeviceGate(mux_timer, ENABLE);
+    init.mode = timer_count_mode_single;
+    init.div = timer_clk_div_0;
+    init.width = timer_iqr_width_f;
+    init.count = 0xFFFFFFFF;
+    timer_init(mux_timer, init);
+    timer_stop(mux_timer);
+    mux_ready = true;
+    return RETURN_OK;
+}
+
+int hw_timer_mux_start(hw_timer_event_t *event, uint32_t us, hw_timer_callback_t callback, void *arg)
+{
+    hw_timer_event_t **p;
+    uint32_t pending = 0;
+    uint32_t s;
+
+    if (!mux_ready || callback == NULL || us > HW_TIMER_MUX_MAX_US)
+    {
+        return RETURN_ERR;
+    }
+    s = irq_lock();
+    mux_remove(event);
+    event->deadline = mux_now + mux_elapsed() + us * mux_tick_per_us;
+    event->callback = callback;
+    event->arg = arg;
+    for (p = &mux_queue; *p != NULL && (int32_t) ((*p)->deadline - event->deadline) <= 0; p = &(*p)->next)
+    {
+        pending++;
+    }
+    event->next = *p;
+    *p = event;
+    for (hw_timer_event_t *e = event; e != NULL; e = e->next)
+    {
+        pending++;
+    }
+    if (pending > stats.mux_max_pending)
+    {
+        stats.mux_max_pending = pending;
+    }
+    stats.mux_started++;
+    if (mux_queue == event)
+    {
+        if (event->next != NULL)
+        {
+            stats.mux_preempted++;
+        }
+        mux_program();
+    }
+    irq_unlock(s);
+    return RETURN_OK;
+}
+
+bool hw_timer_mux_cancel(hw_timer_event_t *event)
+{
+    bool head, found;
+    uint32_t s = irq_lock();
+
+    head = mux_queue == event;
+    found = mux_remove(event);
+    if (found)
+    {
+        stats.mux_cancelled++;
+    }
+    if (head)
+    {
+        mux_program();
+    }
+    irq_unlock(s);
+    return found;
+}
+
+void hw_timer_clock_update(void)
+{
+    uint32_t tick_per_us = get_apb_clk() / 1000000;
+    uint32_t s;
+
+    if (!mux_ready || tick_per_us == 0 || tick_per_us == mux_tick_per_us)
+    {
+        return;
+    }
+    s = irq_lock();
+    mux_now += mux_elapsed();
+    mux_loaded = 0;
+    for (hw_timer_event_t *e = mux_queue; e != NULL; e = e->next)
+    {
+        int32_t remain = (int32_t) (e->deadline - mux_now);
+        e->deadline = mux_now + (remain > 0 ? (uint32_t) remain / mux_tick_per_us * tick_per_us : 0);
+    }
+    mux_tick_per_us = tick_per_us;
+    mux_program();
+    irq_unlock(s);
+}
+
+void hw_timer_get_stats(hw_timer_stats_t *out)
+{
+    uint32_t s = irq_lock();
+    *out = stats;
+    irq_unlock(s);
+}
+
+#if CONFIG_CLI_EN
+/**
+ * @brief 命令行: hw_timer 打印定时器的占用者和分配、复用统计
+ */
+static BaseType_t hw_timer_command_handler(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    hw_timer_stats_t st;
+    int len = 0;
+
+    hw_timer_get_stats(&st);
+    for (int i = 0; i < HW_TIMER_COUNT && len >= 0 && (size_t) len < xWriteBufferLen; i++)
+    {
+        len += snprintf(pcWriteBuffer + len, xWriteBufferLen - len, "timer%d %s, ", i, owners[i] != NULL ? owners[i] : "free");
+    }
+    if (len >= 0 && (size_t) len < xWriteBufferLen)
+    {
+        snprintf(pcWriteBuffer + len, xWriteBufferLen - len,
+                "claims %u, conflicts %u, exhausted %u\r\n"
+                "mux started %u, fired %u, cancelled %u, preempted %u, batched %u, max pending %u\r\n",
+                (unsigned int) st.claims, (unsigned int) st.conflicts, (unsigned int) st.exhausted,
+                (unsigned int) st.mux_started, (unsigned int) st.mux_fired, (unsigned int) st.mux_cancelled,
+                (unsigned int) st.mux_preempted, (unsigned int) st.mux_batched, (unsigned int) st.mux_max_pending);
+    }
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t hw_timer_command =
+{
+    "hw_timer",
+    "\r\nhw_timer:\r\n Show hardware timer owners and multiplexing stats\r\n",
+    hw_timer_command_handler,
+    0
+};
+
+void hw_timer_register_cli(void)
+{
+    FreeRTOS_CLIRegisterCommand(&hw_timer_command);
+}
+#endif
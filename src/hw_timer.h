@@ -0,0 +1,109 @@
+#ifndef _HW_TIMER_H
+#define _HW_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ci112x_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 硬件定时器数量
+#define HW_TIMER_COUNT 4
+// 复用定时器一次最多定时这么久, 保证到期时刻在32位计数值内不会回绕
+#define HW_TIMER_MUX_MAX_US 10000000
+// 复用定时器最短装载的计数值, 已经到期的定时在这么多计数后的中断中执行
+#define HW_TIMER_MUX_MIN_TICKS 16
+
+typedef void (*hw_timer_callback_t)(void *arg);
+
+/**
+ * 复用定时器上的一次性定时, 由使用者分配, 在到期或取消前不能释放
+ */
+typedef struct hw_timer_event
+{
+    struct hw_timer_event *next;
+    uint32_t deadline;              // 复用定时器时间轴上的到期时刻, 单位为定时器计数
+    hw_timer_callback_t callback;   // 在定时器中断中调用, 可以再次启动定时
+    void *arg;
+} hw_timer_event_t;
+
+typedef struct
+{
+    uint32_t claims;          // 成功占用定时器的次数
+    uint32_t conflicts;       // 定时器已被其他模块占用而拒绝的次数
+    uint32_t exhausted;       // 没有空闲定时器而分配失败的次数
+    uint32_t mux_started;     // 复用定时器上启动的定时数
+    uint32_t mux_fired;       // 到期执行的定时数
+    uint32_t mux_cancelled;   // 到期前取消的定时数
+    uint32_t mux_preempted;   // 新的定时比正在等待的都早而重新装载定时器的次数
+    uint32_t mux_batched;     // 和前一个定时在同一次中断中到期的定时数
+    uint32_t mux_max_pending; // 同时等待的最大定时数
+} hw_timer_stats_t;
+
+/**
+ * @brief 占用指定的硬件定时器和它的中断
+ *      - 同一个owner重复占用直接成功
+ *
+ * @param owner 使用者名字, 用于检查归属和打印, 需要是常量字符串
+ * @retval RETURN_ERR 已被其他模块占用
+ */
+int hw_timer_claim(timer_base_t timer, const char *owner);
+/**
+ * @brief 分配一个空闲的硬件定时器, owner已经占用了定时器时返回它占用的
+ *
+ * @param timer 输出分配到的定时器
+ * @retval RETURN_ERR 没有空闲的定时器
+ */
+int hw_timer_alloc(const char *owner, timer_base_t *timer);
+/**
+ * @brief 释放定时器, 只有占用者可以释放
+ */
+int hw_timer_release(timer_base_t timer, const char *owner);
+/**
+ * @brief 获取定时器的占用者, 空闲时为NULL
+ */
+const char *hw_timer_owner(timer_base_t timer);
+/**
+ * @brief 获取定时器对应的中断号
+ */
+IRQn_Type hw_timer_irq(timer_base_t timer);
+
+/**
+ * @brief 分配一个硬件定时器给多个一次性定时复用, 可以重复调用
+ *      - 定时按到期时刻排成队列, 定时器只装载最早到期的一个
+ */
+int hw_timer_mux_init(void);
+/**
+ * @brief 启动一次性定时, 可以在中断中调用
+ *      - event正在等待时重新开始计时
+ *
+ * @param us 定时时长, 不超过HW_TIMER_MUX_MAX_US
+ * @param callback 到期时在定时器中断中调用
+ */
+int hw_timer_mux_start(hw_timer_event_t *event, uint32_t us, hw_timer_callback_t callback, void *arg);
+/**
+ * @brief 取消还没到期的定时, 可以在中断中调用
+ *
+ * @return true 定时还在等待, 已经取消
+ */
+bool hw_timer_mux_cancel(hw_timer_event_t *event);
+/**
+ * @brief APB时钟改变后按新时钟换算还在等待的定时, 切换功耗模式后调用
+ */
+void hw_timer_clock_update(void);
+/**
+ * @brief 获取分配和复用统计
+ */
+void hw_timer_get_stats(hw_timer_stats_t *stats);
+/**
+ * @brief 注册命令行hw_timer, 打印定时器的占用者和统计, 需要打开CONFIG_CLI_EN
+ */
+void hw_timer_register_cli(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
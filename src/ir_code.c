@@ -0,0 +1,209 @@
+#include "ir_code.h"
+
+#include <string.h>
+#include "ci_log.h"
+#include "ir_remote_driver.h"
+#include "ir_protocol.h"
+
+#define READ_U16(p) ((uint16_t) ((p)[0] | ((p)[1] << 8)))
+
+static uint8_t symbol_bits(uint8_t count)
+{
+    uint8_t bits = 0;
+    while ((1 << bits) < count)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * @brief 找到电平对应的符号, 在误差范围内的符号有多个时取时长最接近的, 没有时返回count
+ */
+static uint8_t find_symbol(const uint16_t *symbols, uint8_t count, uint16_t level)
+{
+    uint8_t best = count;
+    uint16_t best_diff = UINT16_MAX;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint16_t diff = symbols[i] > level ? symbols[i] - level : level - symbols[i];
+        if (diff <= (uint32_t) symbols[i] * IR_CODE_TOLERANCE / 100 + IR_CODE_SKEW && diff < best_diff)
+        {
+            best = i;
+            best_diff = diff;
+        }
+    }
+    return best;
+}
+
+uint32_t ir_code_compress(const uint16_t *levels, uint32_t count, uint8_t *out, uint32_t size)
+{
+    uint16_t symbols[IR_CODE_MAX_SYMBOLS];
+    uint32_t sums[IR_CODE_MAX_SYMBOLS];
+    uint16_t counts[IR_CODE_MAX_SYMBOLS];
+    uint8_t symbol_count = 0;
+    uint8_t bits;
+    uint32_t total;
+
+    if (count == 0 || count > UINT16_MAX)
+    {
+        return 0;
+    }
+    // 先聚类, 每个符号取所有相近时长的平均值, 接收时的抖动就被平均掉了
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t s = find_symbol(symbols, symbol_count, levels[i]);
+        if (s == symbol_count)
+        {
+            if (symbol_count >= IR_CODE_MAX_SYMBOLS)
+            {
+                ci_logwarn(LOG_USER, "ir_code: too many symbols\n");
+                return 0;
+            }
+            sums[s] = 0;
+            counts[s] = 0;
+            symbol_count++;
+        }
+        sums[s] += levels[i];
+        counts[s]++;
+        symbols[s] = sums[s] / counts[s];
+    }
+
+    bits = symbol_bits(symbol_count);
+    total = IR_CODE_HEADER_SIZE + symbol_count * 2 + (count * bits + 7) / 8;
+    if (total > size)
+    {
+        return 0;
+    }
+    out[0] = count & 0xFF;
+    out[1] = count >> 8;
+    out[2] = symbol_count;
+    for (uint8_t s = 0; s < symbol_count; s++)
+    {
+        out[IR_CODE_HEADER_SIZE + s * 2] = symbols[s] & 0xFF;
+        out[IR_CODE_HEADER_SIZE + s * 2 + 1] = symbols[s] >> 8;
+    }
+
+    uint8_t *stream = out + IR_CODE_HEADER_SIZE + symbol_count * 2;
+    memset(stream, 0, (count * bits + 7) / 8);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // 平均值可能让边缘的时长落到相邻的符号上, 重新找一次最近的
+        uint8_t s = find_symbol(symbols, symbol_count, levels[i]);
+        if (s == symbol_count)
+        {
+            return 0;
+        }
+        uint32_t pos = i * bits;
+        for (uint8_t b = 0; b < bits; b++, pos++)
+        {
+            stream[pos >> 3] |= ((s >> b) & 1) << (pos & 7);
+        }
+    }
+    ci_logdebug(LOG_USER, "ir_code: %d levels, %d symbols -> %d bytes\n", count, symbol_count, total);
+    return total;
+}
+
+uint32_t ir_code_size(const uint8_t *code)
+{
+    uint16_t count = READ_U16(code);
+    uint8_t symbol_count = code[2];
+    return IR_CODE_HEADER_SIZE + symbol_count * 2 + (count * symbol_bits(symbol_count) + 7) / 8;
+}
+
+void ir_code_iter_init(ir_code_iter_t *iter, const uint8_t *code)
+{
+    iter->code = code;
+    iter->count = READ_U16(code);
+    iter->index = 0;
+    iter->bits = symbol_bits(code[2]);
+    iter->symbols = code + IR_CODE_HEADER_SIZE;
+    iter->stream = iter->symbols + code[2] * 2;
+}
+
+/**
+ * @brief 读出下一个电平的符号下标
+ */
+static uint8_t read_symbol(const ir_code_iter_t *iter)
+{
+    uint32_t pos = (uint32_t) iter->index * iter->bits;
+    uint8_t s = 0;
+
+    for (uint8_t b = 0; b < iter->bits; b++, pos++)
+    {
+        s |= ((iter->stream[pos >> 3] >> (pos & 7)) & 1) << b;
+    }
+    return s;
+}
+
+bool ir_code_check(const uint8_t *code, uint32_t size)
+{
+    ir_code_iter_t iter;
+
+    if (size < IR_CODE_HEADER_SIZE || READ_U16(code) == 0
+        || code[2] == 0 || code[2] > IR_CODE_MAX_SYMBOLS || ir_code_size(code) != size)
+    {
+        return false;
+    }
+    // 符号数不是2的幂时, 损坏的符号流可能指到符号表外面
+    ir_code_iter_init(&iter, code);
+    for (; iter.index < iter.count; iter.index++)
+    {
+        if (read_symbol(&iter) >= code[2])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ir_code_iter_next(ir_code_iter_t *iter, uint16_t *level)
+{
+    if (iter->index >= iter->count)
+    {
+        return false;
+    }
+    *level = READ_U16(iter->symbols + read_symbol(iter) * 2);
+    iter->index++;
+    return true;
+}
+
+uint32_t ir_code_decompress(const uint8_t *code, uint16_t *levels, uint32_t size)
+{
+    ir_code_iter_t iter;
+    uint32_t count = 0;
+
+    ir_code_iter_init(&iter, code);
+    if (iter.count > size)
+    {
+        return 0;
+    }
+    while (ir_code_iter_next(&iter, &levels[count]))
+    {
+        count++;
+    }
+    return count;
+}
+
+// 在红外驱动的定时器中断中调用
+static bool code_generator(void *arg, uint16_t *level)
+{
+    return ir_code_iter_next((ir_code_iter_t *) arg, level);
+}
+
+int ir_code_send(const uint8_t *code)
+{
+    ir_code_iter_t iter;
+    uint16_t level;
+    uint32_t duration = 0;
+
+    ir_code_iter_init(&iter, code);
+    while (ir_code_iter_next(&iter, &level))
+    {
+        duration += level;
+    }
+    // 驱动边发送边解码, 不需要缓冲区, 也不用等整串电平解压完
+    ir_code_iter_init(&iter, code);
+    return ir_protocol_send_stream(code_generator, &iter, duration * IR_DATA_DIV_COEFFICIENT / 1000 + 100);
+}
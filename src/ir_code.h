@@ -0,0 +1,82 @@
+#ifndef _IR_CODE_H
+#define _IR_CODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 压缩后的红外码格式, 多字节数据均为小端序:
+ *      - 2字节 电平数量
+ *      - 1字节 符号数量n, 即不同时长的个数
+ *      - 2n字节 符号表, 每个符号对应的时长, 单位同驱动电平
+ *      - 符号流, 每个电平一个符号下标, 按ceil(log2(n))位紧密排列, 从每个字节的低位开始
+ */
+#define IR_CODE_HEADER_SIZE 3
+// 最多的符号数量, 符号下标最多4位
+#define IR_CODE_MAX_SYMBOLS 16
+// 时长相差不超过这么多时合并为同一个符号, 百分比加上固定误差(单位同驱动电平)
+#define IR_CODE_TOLERANCE 20
+#define IR_CODE_SKEW 50
+
+typedef struct
+{
+    const uint8_t *code;
+    uint16_t count;      // 电平数量
+    uint16_t index;      // 下一个电平的下标
+    uint8_t bits;        // 每个符号的位数
+    const uint8_t *symbols;
+    const uint8_t *stream;
+} ir_code_iter_t;
+
+/**
+ * @brief 把驱动格式的电平压缩成符号表加符号流
+ *
+ * @param levels 电平, 偶数位置为mark, 奇数位置为space
+ * @param count 电平数量
+ * @param out 输出缓冲区
+ * @param size 输出缓冲区大小
+ * @return 压缩后的字节数, 不同的时长超过IR_CODE_MAX_SYMBOLS个或者放不下时为0
+ */
+uint32_t ir_code_compress(const uint16_t *levels, uint32_t count, uint8_t *out, uint32_t size);
+/**
+ * @brief 获取压缩后的红外码的字节数
+ */
+uint32_t ir_code_size(const uint8_t *code);
+/**
+ * @brief 检查从flash读出的压缩红外码, 读取电平前调用, 读取时不再检查
+ *
+ * @param code 压缩后的红外码
+ * @param size 保存时记录的字节数
+ * @return true 头部有效, 字节数和size一致, 所有符号下标都在符号表内
+ */
+bool ir_code_check(const uint8_t *code, uint32_t size);
+/**
+ * @brief 开始逐个读取电平, 不需要把整串电平解压出来
+ */
+void ir_code_iter_init(ir_code_iter_t *iter, const uint8_t *code);
+/**
+ * @brief 读取下一个电平
+ *
+ * @return false 已经读完
+ */
+bool ir_code_iter_next(ir_code_iter_t *iter, uint16_t *level);
+/**
+ * @brief 解压成驱动格式的电平
+ *
+ * @return 电平数量, 放不下时为0
+ */
+uint32_t ir_code_decompress(const uint8_t *code, uint16_t *levels, uint32_t size);
+/**
+ * @brief 发送压缩的红外码, 由驱动在中断中逐个解出电平, 阻塞到发送完成
+ */
+int ir_code_send(const uint8_t *code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#include "ir_profile.h"
+
+#include <stddef.h>
+#include "ir_protocol.h"
+
+#define ARRAY_LENGTH(arr) (sizeof(arr) / sizeof(arr[0]))
+
+/**
+ * 遥控器配置库, 放在.rodata_in_flash段, 通过总线直接读flash
+ * 新增夜灯时在末尾添加, 已保存的配置序号不会变
+ */
+static const ir_profile_t profiles[] __attribute__((section(".rodata_in_flash"))) =
+{
+    {
+        // 常见的24键RGB遥控器, 注释是遥控器上标的按键名
+        .name = "rgb24",
+        .protocol = IR_PROTO_NEC_EXT,
+        .max_brightness = 9,
+        .mid_brightness = 3,
+        .color_count = 16,
+        .white = 0,
+        .cool = 8,
+        .warm = 4,
+        .address = 0xEF00,
+        .keys =
+        {
+            [IR_KEY_POWER_ON] = 0x03,     // ON
+            [IR_KEY_POWER_OFF] = 0x02,    // OFF
+            [IR_KEY_BRIGHT_INC] = 0x00,   // BRIGHT
+            [IR_KEY_BRIGHT_DEC] = 0x01,   // DARK
+            [IR_KEY_MODE_FLASH] = 0x0B,   // FLASH
+            [IR_KEY_MODE_BREATH] = 0x0F,  // STROBE
+            [IR_KEY_MODE_RAINBOW] = 0x13, // FADE
+            [IR_KEY_MODE_SMOOTH] = 0x17,  // SMOOTH
+        },
+        .colors =
+        {
+            0x07, // W
+            0x04, 0x08, 0x0C, 0x10, 0x14, // R
+            0x05, 0x09, 0x0D, 0x11, 0x15, // G
+            0x06, 0x0A, 0x0E, 0x12, 0x16, // B
+        },
+    },
+    {
+        // 同样键位的24键遥控器, 使用标准NEC的0地址
+        .name = "rgb24-nec0",
+        .protocol = IR_PROTO_NEC,
+        .max_brightness = 9,
+        .mid_brightness = 3,
+        .color_count = 16,
+        .white = 0,
+        .cool = 8,
+        .warm = 4,
+        .address = 0x00,
+        .keys =
+        {
+            [IR_KEY_POWER_ON] = 0x03,
+            [IR_KEY_POWER_OFF] = 0x02,
+            [IR_KEY_BRIGHT_INC] = 0x00,
+            [IR_KEY_BRIGHT_DEC] = 0x01,
+            [IR_KEY_MODE_FLASH] = 0x0B,
+            [IR_KEY_MODE_BREATH] = 0x0F,
+            [IR_KEY_MODE_RAINBOW] = 0x13,
+            [IR_KEY_MODE_SMOOTH] = 0x17,
+        },
+        .colors =
+        {
+            0x07,
+            0x04, 0x08, 0x0C, 0x10, 0x14,
+            0x05, 0x09, 0x0D, 0x11, 0x15,
+            0x06, 0x0A, 0x0E, 0x12, 0x16,
+        },
+    },
+};
+
+uint8_t ir_profile_count(void)
+{
+    return ARRAY_LENGTH(profiles);
+}
+
+const ir_profile_t *ir_profile_get(uint8_t index)
+{
+    if (index >= ARRAY_LENGTH(profiles))
+    {
+        return NULL;
+    }
+    return &profiles[index];
+}
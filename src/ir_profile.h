@@ -0,0 +1,63 @@
+#ifndef _IR_PROFILE_H
+#define _IR_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 配置名的最大长度, 包括结尾的0
+#define IR_PROFILE_NAME_SIZE 16
+// 每个配置最多的颜色按键数
+#define IR_PROFILE_MAX_COLORS 16
+
+// 除颜色以外的功能按键
+typedef enum
+{
+    IR_KEY_POWER_ON,
+    IR_KEY_POWER_OFF,
+    IR_KEY_BRIGHT_INC,
+    IR_KEY_BRIGHT_DEC,
+    IR_KEY_MODE_FLASH,
+    IR_KEY_MODE_BREATH,
+    IR_KEY_MODE_RAINBOW,
+    IR_KEY_MODE_SMOOTH,
+
+    IR_KEY_COUNT
+} ir_profile_key_t;
+
+/**
+ * 一种夜灯或遥控器的配置, 放在flash中直接读取, 不占用RAM
+ * 名字也放在结构体里, 避免指向RAM中的字符串
+ * 波形的时序由protocol对应的协议描述表决定
+ */
+typedef struct
+{
+    char name[IR_PROFILE_NAME_SIZE];
+    uint8_t protocol;                        // ir_protocol_id_t
+    uint8_t max_brightness;                  // 亮度档位是0 ~ max_brightness, 从任何档位按这么多次都能调到头
+    uint8_t mid_brightness;                  // 中等亮度的档位
+    uint8_t color_count;                     // colors中的按键数
+    uint8_t white, cool, warm;               // 白光、冷色和暖色在colors中的下标
+    uint16_t address;                        // 遥控器地址码
+    uint16_t keys[IR_KEY_COUNT];             // 功能按键的命令码
+    uint16_t colors[IR_PROFILE_MAX_COLORS];  // 颜色按键的命令码, 改变颜色时依次循环
+} ir_profile_t;
+
+/**
+ * @brief 获取配置数量
+ */
+uint8_t ir_profile_count(void);
+/**
+ * @brief 获取第index个配置, 返回的指针直接指向flash
+ *
+ * @return 配置, index超出范围时为NULL
+ */
+const ir_profile_t *ir_profile_get(uint8_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
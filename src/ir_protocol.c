@@ -0,0 +1,757 @@
+#include "ir_protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "ci_log.h"
+#include "ci112x_core_misc.h"
+#include "ir_remote_driver.h"
+#include "hw_timer.h"
+
+// 驱动缓冲区中电平的单位是IR_DATA_DIV_COEFFICIENT us
+#define US_TO_LEVEL(us) ((uint16_t) ((us) / IR_DATA_DIV_COEFFICIENT))
+#define LEVEL_TO_US(level) ((int32_t) (level) * IR_DATA_DIV_COEFFICIENT)
+// 解码时允许的时长误差, 百分比加上接收头本身造成的mark变宽、space变窄的固定误差
+#define DECODE_TOLERANCE 25
+#define DECODE_SKEW 100
+
+// NEC系列共用的位编码
+#define PULSE_DISTANCE_BITS { { 560, -560 }, { 560, -1690 } }
+
+static const ir_protocol_t protocols[IR_PROTO_COUNT] =
+{
+    [IR_PROTO_NEC] =
+    {
+        .name = "NEC",
+        .header = { 9000, -4500 },
+        .bit = PULSE_DISTANCE_BITS,
+        .trailer = { 560 },
+        .repeat = { 9000, -2250, 560 },
+        .min_frames = 1,
+        .period = 110000,
+        .fields =
+        {
+            { IR_FIELD_ADDR, 8 },
+            { IR_FIELD_ADDR_INV, 8 },
+            { IR_FIELD_CMD, 8 },
+            { IR_FIELD_CMD_INV, 8 },
+        },
+    },
+    [IR_PROTO_NEC_EXT] =
+    {
+        .name = "NEC-ext",
+        .header = { 9000, -4500 },
+        .bit = PULSE_DISTANCE_BITS,
+        .trailer = { 560 },
+        .repeat = { 9000, -2250, 560 },
+        .min_frames = 1,
+        .period = 110000,
+        .fields =
+        {
+            { IR_FIELD_ADDR, 16 },
+            { IR_FIELD_CMD, 8 },
+            { IR_FIELD_CMD_INV, 8 },
+        },
+    },
+    [IR_PROTO_SAMSUNG] =
+    {
+        .name = "Samsung",
+        .header = { 4500, -4500 },
+        .bit = PULSE_DISTANCE_BITS,
+        .trailer = { 560 },
+        .min_frames = 1,
+        .period = 108000,
+        .fields =
+        {
+            { IR_FIELD_ADDR, 8 },
+            { IR_FIELD_ADDR, 8 },
+            { IR_FIELD_CMD, 8 },
+            { IR_FIELD_CMD_INV, 8 },
+        },
+    },
+    [IR_PROTO_SONY12] =
+    {
+        .name = "Sony12",
+        .header = { 2400, -600 },
+        .bit = { { 600, -600 }, { 1200, -600 } },
+        .min_frames = 3,
+        .period = 45000,
+        .fields =
+        {
+            { IR_FIELD_CMD, 7 },
+            { IR_FIELD_ADDR, 5 },
+        },
+    },
+    [IR_PROTO_RC5] =
+    {
+        .name = "RC5",
+        .bit = { { 889, -889 }, { -889, 889 } },
+        .msb_first = true,
+        .min_frames = 1,
+        .period = 113778,
+        .fields =
+        {
+            { IR_FIELD_CONST, 1, 0, 1 },
+            { IR_FIELD_CMD_INV, 1, 6 },
+            { IR_FIELD_TOGGLE, 1 },
+            { IR_FIELD_ADDR, 5 },
+            { IR_FIELD_CMD, 6 },
+        },
+    },
+    [IR_PROTO_RC6] =
+    {
+        .name = "RC6",
+        .header = { 2666, -889 },
+        .bit = { { -444, 444 }, { 444, -444 } },
+        .wide = { { -889, 889 }, { 889, -889 } },
+        .msb_first = true,
+        .min_frames = 1,
+        .period = 106667,
+        .fields =
+        {
+            { IR_FIELD_CONST, 1, 0, 1 },
+            { IR_FIELD_CONST, 3, 0, 0 },
+            { IR_FIELD_TOGGLE, 1, 0, 0, 1 },
+            { IR_FIELD_ADDR, 8 },
+            { IR_FIELD_CMD, 8 },
+        },
+    },
+};
+
+typedef struct
+{
+    uint16_t *buf;
+    uint32_t size;
+    uint32_t count;
+    uint32_t frame_us; // 当前帧已经编码的时长
+    bool overflow;
+} ir_writer_t;
+
+typedef struct
+{
+    const uint16_t *buf;
+    uint32_t count;
+    uint32_t index;
+    int32_t remain;  // 当前电平还没有匹配掉的时长
+    bool started;    // 是否已经匹配到第一个mark
+    bool partial;    // 当前电平是否只匹配了一部分
+    int32_t expect;  // 当前电平已经匹配掉的时长
+    uint32_t error;  // 匹配完的电平的相对误差之和, 单位千分之一
+    uint32_t levels; // 匹配完的电平数量
+} ir_reader_t;
+
+// 驱动发送前会把电平原地换算成32位定时器计数值, 需要4字节对齐
+static uint16_t level_buf[IR_PROTOCOL_BUF_LEVELS] __attribute__((aligned(4)));
+static SemaphoreHandle_t send_done = NULL;
+static SemaphoreHandle_t driver_lock = NULL;
+static SemaphoreHandle_t clock_ready = NULL;
+static volatile IrRemoteEvent send_result = IR_IDEL;
+// 流式NEC接收到的第一帧
+static volatile uint32_t nec_code = 0;
+static bool toggle = false;
+
+/**
+ * @brief 追加一段时长, 与上一个电平极性相同时合并
+ */
+static void put(ir_writer_t *w, int32_t us)
+{
+    uint16_t level = US_TO_LEVEL(abs(us));
+    w->frame_us += abs(us);
+    if (w->count == 0 && us < 0)
+    {
+        // 空闲就是没有载波, 开头的space不用发
+        return;
+    }
+    if (w->count > 0 && ((w->count - 1) & 1) == (us < 0))
+    {
+        w->buf[w->count - 1] += level;
+        return;
+    }
+    if (w->count >= w->size)
+    {
+        w->overflow = true;
+        return;
+    }
+    w->buf[w->count++] = level;
+}
+
+static void put_seq(ir_writer_t *w, const int16_t *seq, uint32_t len)
+{
+    for (uint32_t i = 0; i < len && seq[i] != 0; i++)
+    {
+        put(w, seq[i]);
+    }
+}
+
+static uint32_t field_value(const ir_field_t *field, const ir_protocol_code_t *code)
+{
+    switch (field->source)
+    {
+        case IR_FIELD_ADDR:
+            return code->address >> field->shift;
+        case IR_FIELD_ADDR_INV:
+            return ~code->address >> field->shift;
+        case IR_FIELD_CMD:
+            return code->command >> field->shift;
+        case IR_FIELD_CMD_INV:
+            return ~code->command >> field->shift;
+        case IR_FIELD_TOGGLE:
+            return code->toggle;
+        default:
+            return field->value;
+    }
+}
+
+static void put_frame(ir_writer_t *w, const ir_protocol_t *p, const ir_protocol_code_t *code)
+{
+    put_seq(w, p->header, 4);
+    for (int i = 0; i < IR_PROTOCOL_MAX_FIELDS && p->fields[i].width > 0; i++)
+    {
+        const ir_field_t *field = &p->fields[i];
+        const int16_t (*enc)[2] = field->wide ? p->wide : p->bit;
+        uint32_t value = field_value(field, code);
+        for (int n = 0; n < field->width; n++)
+        {
+            uint32_t bit = (value >> (p->msb_first ? field->width - 1 - n : n)) & 1;
+            put(w, enc[bit][0]);
+            put(w, enc[bit][1]);
+        }
+    }
+    put_seq(w, p->trailer, 2);
+}
+
+/**
+ * @brief 用space把当前帧补齐到一个帧周期
+ */
+static void put_gap(ir_writer_t *w, const ir_protocol_t *p)
+{
+    uint32_t gap = p->period > w->frame_us + IR_PROTOCOL_MIN_GAP ? p->period - w->frame_us : IR_PROTOCOL_MIN_GAP;
+    put(w, -(int32_t) gap);
+    w->frame_us = 0;
+}
+
+const ir_protocol_t *ir_protocol_get(ir_protocol_id_t id)
+{
+    return id < IR_PROTO_COUNT ? &protocols[id] : NULL;
+}
+
+uint32_t ir_protocol_encode(const ir_protocol_code_t *code, uint8_t repeat, uint16_t *buf, uint32_t size)
+{
+    const ir_protocol_t *p = ir_protocol_get(code->protocol);
+    ir_writer_t w = { buf, size, 0, 0, false };
+
+    if (p == NULL)
+    {
+        return 0;
+    }
+    if (repeat + 1 < p->min_frames)
+    {
+        repeat = p->min_frames - 1;
+    }
+    put_frame(&w, p, code);
+    put_gap(&w, p);
+    for (int i = 0; i < repeat; i++)
+    {
+        if (p->repeat[0] != 0)
+        {
+            put_seq(&w, p->repeat, 4);
+        }
+        else
+        {
+            put_frame(&w, p, code);
+        }
+        put_gap(&w, p);
+    }
+    return w.overflow ? 0 : w.count;
+}
+
+/**
+ * @brief 匹配一段时长, 一个电平可以分几次匹配, 用于曼彻斯特编码中合并了的电平
+ */
+static bool take(ir_reader_t *r, int32_t us)
+{
+    int32_t len = abs(us);
+    int32_t slack = len * DECODE_TOLERANCE / 100;
+    int32_t tolerance = slack + DECODE_SKEW;
+
+    if (us < 0 && (!r->started || r->index >= r->count))
+    {
+        // 开头的space看不到, 结尾的space和帧间隔连在一起
+        return true;
+    }
+    if (r->index >= r->count || ((r->index & 1) != 0) != (us < 0) || r->remain < len - tolerance)
+    {
+        return false;
+    }
+    r->started = true;
+    r->remain -= len;
+    r->expect += len;
+    // 接收头只会让mark变宽、space变窄, space剩下的超过百分比误差就是合并进来的下一段
+    r->partial = r->remain > (us > 0 ? tolerance : slack);
+    if (!r->partial)
+    {
+        r->error += abs(r->remain) * 1000 / r->expect;
+        r->levels++;
+        r->index++;
+        r->remain = r->index < r->count ? LEVEL_TO_US(r->buf[r->index]) : 0;
+        r->expect = 0;
+    }
+    return true;
+}
+
+static bool take_seq(ir_reader_t *r, const int16_t *seq, uint32_t len)
+{
+    for (uint32_t i = 0; i < len && seq[i] != 0; i++)
+    {
+        if (!take(r, seq[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 把字段的值合并到地址或命令中, 与已经解出的位冲突时返回false
+ */
+static bool merge_field(uint16_t *value, uint16_t *mask, uint32_t bits, const ir_field_t *field)
+{
+    uint16_t field_mask = ((1 << field->width) - 1) << field->shift;
+    uint16_t field_bits = (bits << field->shift) & field_mask;
+    if ((*value & *mask & field_mask) != (field_bits & *mask))
+    {
+        return false;
+    }
+    *value = (*value & ~field_mask) | field_bits;
+    *mask |= field_mask;
+    return true;
+}
+
+/**
+ * @brief 按指定协议解码, 同ir_protocol_decode
+ *
+ * @param error 输出每个电平的平均相对误差, 单位千分之一
+ */
+static int decode(ir_protocol_code_t *code, const uint16_t *buf, uint32_t count, uint32_t *error)
+{
+    const ir_protocol_t *p = ir_protocol_get(code->protocol);
+    uint32_t values[IR_PROTOCOL_MAX_FIELDS];
+    uint16_t addr_mask = 0, cmd_mask = 0;
+    ir_reader_t r;
+
+    if (p == NULL || count == 0)
+    {
+        return RETURN_ERR;
+    }
+    code->repeat = false;
+    code->toggle = false;
+    code->address = 0;
+    code->command = 0;
+    memset(&r, 0, sizeof(r));
+    r.buf = buf;
+    r.count = count;
+    r.remain = LEVEL_TO_US(buf[0]);
+    if (p->repeat[0] != 0 && take_seq(&r, p->repeat, 4) && r.index >= count - 1)
+    {
+        code->repeat = true;
+        *error = r.levels > 0 ? r.error / r.levels : 0;
+        return RETURN_OK;
+    }
+    memset(&r, 0, sizeof(r));
+    r.buf = buf;
+    r.count = count;
+    r.remain = LEVEL_TO_US(buf[0]);
+    if (!take_seq(&r, p->header, 4))
+    {
+        return RETURN_ERR;
+    }
+    for (int i = 0; i < IR_PROTOCOL_MAX_FIELDS && p->fields[i].width > 0; i++)
+    {
+        const ir_field_t *field = &p->fields[i];
+        const int16_t (*enc)[2] = field->wide ? p->wide : p->bit;
+        values[i] = 0;
+        for (int n = 0; n < field->width; n++)
+        {
+            uint32_t shift = p->msb_first ? field->width - 1 - n : n;
+            ir_reader_t zero = r, one = r;
+            bool is_zero = take(&zero, enc[0][0]) && take(&zero, enc[0][1]);
+            bool is_one = take(&one, enc[1][0]) && take(&one, enc[1][1]);
+            if (field->source == IR_FIELD_CONST)
+            {
+                // 常量只匹配已知的值, RC5开头的space看不到, 0和1都能匹配上
+                is_one = is_one && ((field->value >> shift) & 1);
+                is_zero = is_zero && !((field->value >> shift) & 1);
+            }
+            // 两种编码都能匹配时, 取刚好匹配完整个电平的那种, 如NEC的1690us不能当成0的560us加上剩余部分
+            if (is_zero && is_one)
+            {
+                is_zero = !zero.partial || one.partial;
+                is_one = !is_zero;
+            }
+            if (!is_zero && !is_one)
+            {
+                return RETURN_ERR;
+            }
+            r = is_zero ? zero : one;
+            values[i] |= (uint32_t) is_one << shift;
+        }
+    }
+    if (!take_seq(&r, p->trailer, 2))
+    {
+        return RETURN_ERR;
+    }
+    if (r.index < count && ((r.index & 1) == 0 || LEVEL_TO_US(buf[r.index]) < IR_PROTOCOL_MIN_GAP))
+    {
+        // 后面还有电平, 不是一个完整的帧
+        return RETURN_ERR;
+    }
+
+    // 先取直接给出的位, 再用反码校验或补上没有直接给出的位
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < IR_PROTOCOL_MAX_FIELDS && p->fields[i].width > 0; i++)
+        {
+            const ir_field_t *field = &p->fields[i];
+            bool ok = true;
+            if (pass == 0 && field->source == IR_FIELD_ADDR)
+                ok = merge_field(&code->address, &addr_mask, values[i], field);
+            else if (pass == 0 && field->source == IR_FIELD_CMD)
+                ok = merge_field(&code->command, &cmd_mask, values[i], field);
+            else if (pass == 1 && field->source == IR_FIELD_ADDR_INV)
+                ok = merge_field(&code->address, &addr_mask, ~values[i], field);
+            else if (pass == 1 && field->source == IR_FIELD_CMD_INV)
+                ok = merge_field(&code->command, &cmd_mask, ~values[i], field);
+            else if (pass == 0 && field->source == IR_FIELD_TOGGLE)
+                code->toggle = values[i];
+            else if (pass == 0 && field->source == IR_FIELD_CONST)
+                ok = values[i] == field->value;
+            if (!ok)
+            {
+                return RETURN_ERR;
+            }
+        }
+    }
+    *error = r.levels > 0 ? r.error / r.levels : 0;
+    return RETURN_OK;
+}
+
+int ir_protocol_decode(ir_protocol_code_t *code, const uint16_t *buf, uint32_t count)
+{
+    uint32_t error;
+    return decode(code, buf, count, &error);
+}
+
+int ir_protocol_decode_any(ir_protocol_code_t *code, const uint16_t *buf, uint32_t count)
+{
+    ir_protocol_code_t best, tried;
+    uint32_t best_error = UINT32_MAX, error;
+
+    // 时长误差放得比较宽, 如RC5的帧也能按索尼解出来, 取误差最小的协议, 一样时取编号小的
+    for (uint8_t id = 0; id < IR_PROTO_COUNT; id++)
+    {
+        tried.protocol = id;
+        if (decode(&tried, buf, count, &error) == RETURN_OK && error < best_error)
+        {
+            best = tried;
+            best_error = error;
+        }
+    }
+    if (best_error == UINT32_MAX)
+    {
+        return RETURN_ERR;
+    }
+    *code = best;
+    return RETURN_OK;
+}
+
+/**
+ * @brief 在中断或任务中释放信号量
+ */
+static void give(SemaphoreHandle_t sem)
+{
+    if (check_curr_trap() != 0)
+    {
+        xSemaphoreGiveFromISR(sem, NULL);
+    }
+    else
+    {
+        xSemaphoreGive(sem);
+    }
+}
+
+/**
+ * @brief 红外驱动事件回调, 发送或接收结束时多半在中断中调用,
+ *      截获发送、主动结束接收和在任务中切换时钟时在任务中调用
+ */
+static void ir_protocol_callback(IrRemoteState *state)
+{
+    if (state->event == IR_SEND_END || state->event == IR_SEND_DATA_ERR
+        || state->event == IR_RECEIVE_END || state->event == IR_RECEIVE_SHORT_ERR)
+    {
+        send_result = state->event;
+        give(send_done);
+    }
+    else if (state->event == IR_SEND_DEFERRED)
+    {
+        send_result = state->event;
+    }
+    else if (state->event == IR_CLOCK_READY)
+    {
+        give(clock_ready);
+    }
+    else if ((state->event == IR_RECEIVE_NEC_FRAME || state->event == IR_RECEIVE_NEC_OTHER)
+        && send_result == IR_IDEL)
+    {
+        // 只留第一次的结果, 任务停止接收之前还可能收到按住按键时的下一帧
+        nec_code = state->code;
+        send_result = state->event;
+        give(send_done);
+    }
+}
+
+int ir_protocol_pin_info(stIrPinInfo *info)
+{
+    timer_base_t timer;
+
+    // 红外夜灯和空调共用一个定时器
+    if (hw_timer_alloc("ir", &timer) != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    memset(info, 0, sizeof(stIrPinInfo));
+    // config outpin
+    info->outPin.PinName  = PWM3_PAD;
+    info->outPin.GpioBase = GPIO1;
+    info->outPin.PinNum   = gpio_pin_4;
+    info->outPin.PwmFun   = SECOND_FUNCTION;
+    info->outPin.IoFun    = FIRST_FUNCTION;
+    info->outPin.PwmBase  = PWM3;
+    // config revpin
+    info->revPin.PinName  = PWM4_PAD;
+    info->revPin.GpioBase = GPIO1;
+    info->revPin.PinNum   = gpio_pin_5;
+    info->revPin.IoFun    = FIRST_FUNCTION;
+    info->revPin.GpioIRQ  = GPIO1_IRQn;
+    // config timer
+    info->irTimer.ir_use_timer     = timer;
+    info->irTimer.ir_use_timer_IRQ = hw_timer_irq(timer);
+    return RETURN_OK;
+}
+
+int ir_protocol_init(void)
+{
+    // 空调码库初始化时会换掉驱动缓冲区, 之后要再调用一次换回来
+    if (send_done == NULL)
+    {
+        send_done = xSemaphoreCreateBinary();
+        clock_ready = xSemaphoreCreateBinary();
+        driver_lock = xSemaphoreCreateRecursiveMutex();
+    }
+    if (send_done == NULL || clock_ready == NULL || driver_lock == NULL)
+    {
+        return RETURN_ERR;
+    }
+    if (set_ir_level_code_addr((uint32_t) level_buf, sizeof(level_buf)) != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    registe_ir_remote_callback(ir_protocol_callback);
+    return RETURN_OK;
+}
+
+void ir_protocol_lock(void)
+{
+    xSemaphoreTakeRecursive(driver_lock, portMAX_DELAY);
+}
+
+void ir_protocol_unlock(void)
+{
+    xSemaphoreGiveRecursive(driver_lock);
+}
+
+int ir_protocol_send(ir_protocol_id_t protocol, uint16_t address, uint16_t command, uint8_t repeat)
+{
+    ir_protocol_code_t code = { protocol, toggle, false, address, command };
+    const ir_protocol_t *p = ir_protocol_get(protocol);
+    uint16_t *buf;
+    uint32_t count;
+    int ret;
+
+    ir_protocol_lock();
+    buf = get_ir_driver_buf();
+    if (buf == NULL || p == NULL)
+    {
+        ir_protocol_unlock();
+        ci_logerr(LOG_USER, "ir: driver busy\n");
+        return RETURN_ERR;
+    }
+    toggle = !toggle;
+    // 驱动要把电平换算成32位计数值, 只能用到缓冲区的一半
+    count = ir_protocol_encode(&code, repeat, buf, IR_PROTOCOL_BUF_LEVELS / 2);
+    if (count == 0)
+    {
+        ir_protocol_unlock();
+        ci_logerr(LOG_USER, "ir: %s code too long\n", p->name);
+        return RETURN_ERR;
+    }
+
+    // 整串码的时长是确定的, 多等一帧还没结束就是驱动出了问题
+    repeat = repeat + 1 < p->min_frames ? p->min_frames - 1 : repeat;
+    ret = ir_protocol_send_levels(count, (repeat + 2) * p->period / 1000);
+    ir_protocol_unlock();
+    return ret;
+}
+
+/**
+ * @brief 启动发送, 时钟不能准确产生载波时驱动会推迟发送, 等时钟恢复后重试
+ *
+ * @param generator 为NULL时发送驱动缓冲区中的count个电平, 否则流式发送
+ */
+static int32_t start_send(uint32_t count, ir_send_level_generator_t generator, void *arg)
+{
+    int32_t ret;
+
+    xSemaphoreTake(clock_ready, 0);
+    while (1)
+    {
+        xSemaphoreTake(send_done, 0);
+        send_result = IR_IDEL;
+        ret = generator != NULL ? send_ir_code_stream(generator, arg) : send_ir_code_start(count);
+        if (ret == RETURN_OK || send_result != IR_SEND_DEFERRED)
+        {
+            return ret;
+        }
+        ci_logdebug(LOG_USER, "ir: send deferred until clock is ready\n");
+        if (xSemaphoreTake(clock_ready, pdMS_TO_TICKS(IR_PROTOCOL_DEFER_MS)) != pdTRUE)
+        {
+            ci_logerr(LOG_USER, "ir: clock not ready\n");
+            return RETURN_ERR;
+        }
+    }
+}
+
+/**
+ * @brief 等待驱动发送完成
+ *
+ * @param started 启动发送的返回值
+ */
+static int wait_send_done(int32_t started, uint32_t timeout_ms)
+{
+    if (started != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    if (xSemaphoreTake(send_done, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+    {
+        // 流式发送的生成器参数多半在调用者的栈上, 返回前一定要停下驱动
+        ir_send_stop();
+        ci_logerr(LOG_USER, "ir: send timeout\n");
+        return RETURN_ERR;
+    }
+#if IR_SEND_JITTER_MEASURE
+    ir_send_jitter_t jitter;
+    ir_get_send_jitter(&jitter);
+    ci_logdebug(LOG_USER, "ir: %d edges, error %d ~ %d cycles\n", jitter.edges, jitter.err_min, jitter.err_max);
+#endif
+    if (send_result == IR_SEND_DATA_ERR)
+    {
+        // 驱动在中断里只记下事件, 日志在这里打印
+        ci_logerr(LOG_USER, "ir: send data error, level is 0\n");
+    }
+    return send_result == IR_SEND_END ? RETURN_OK : RETURN_ERR;
+}
+
+int ir_protocol_send_levels(uint32_t count, uint32_t timeout_ms)
+{
+    int ret;
+    ir_protocol_lock();
+    ret = wait_send_done(start_send(count, NULL, NULL), timeout_ms);
+    ir_protocol_unlock();
+    return ret;
+}
+
+int ir_protocol_send_stream(ir_send_level_generator_t generator, void *arg, uint32_t timeout_ms)
+{
+    int ret;
+    ir_protocol_lock();
+    ret = wait_send_done(start_send(0, generator, arg), timeout_ms);
+    ir_protocol_unlock();
+    return ret;
+}
+
+uint32_t ir_protocol_receive(const uint16_t **levels, uint32_t end_gap_us, uint32_t timeout_ms)
+{
+    uint32_t count = 0;
+
+    ir_protocol_lock();
+    if (get_ir_driver_buf() == NULL)
+    {
+        ir_protocol_unlock();
+        ci_logerr(LOG_USER, "ir: driver busy\n");
+        return 0;
+    }
+    xSemaphoreTake(send_done, 0);
+    set_ir_receive_end_gap(end_gap_us);
+    ir_receive_start(timeout_ms);
+    // 驱动在超时后自己结束接收, 多等一会儿只是防止驱动出问题时一直卡住
+    if (xSemaphoreTake(send_done, pdMS_TO_TICKS(timeout_ms + 1000)) != pdTRUE)
+    {
+        ci_logerr(LOG_USER, "ir: receive timeout\n");
+        ir_receive_end();
+    }
+    else if (send_result == IR_RECEIVE_END && check_ir_receive() == RETURN_OK)
+    {
+        *levels = level_buf;
+        count = get_receive_level_count();
+    }
+    ir_protocol_unlock();
+    return count;
+}
+
+int ir_protocol_receive_nec(ir_protocol_code_t *code, bool *other, uint32_t timeout_ms)
+{
+    uint8_t addr, addr_inv, cmd, cmd_inv;
+    int ret = RETURN_ERR;
+
+    *other = false;
+    ir_protocol_lock();
+    xSemaphoreTake(send_done, 0);
+    send_result = IR_IDEL;
+    if (ir_receive_nec_start() != RETURN_OK)
+    {
+        ir_protocol_unlock();
+        ci_logerr(LOG_USER, "ir: driver busy\n");
+        return RETURN_ERR;
+    }
+    xSemaphoreTake(send_done, pdMS_TO_TICKS(timeout_ms));
+    ir_receive_nec_stop();
+    if (send_result == IR_RECEIVE_NEC_FRAME)
+    {
+        // 第一个字节在最低位
+        addr = nec_code;
+        addr_inv = nec_code >> 8;
+        cmd = nec_code >> 16;
+        cmd_inv = nec_code >> 24;
+        if ((uint8_t) ~cmd == cmd_inv)
+        {
+            memset(code, 0, sizeof(ir_protocol_code_t));
+            // 地址反码对得上时按标准NEC, 和ir_protocol_decode_any的选择一致
+            code->protocol = (uint8_t) ~addr == addr_inv ? IR_PROTO_NEC : IR_PROTO_NEC_EXT;
+            code->address = code->protocol == IR_PROTO_NEC ? addr : addr | (addr_inv << 8);
+            code->command = cmd;
+            ret = RETURN_OK;
+        }
+        else
+        {
+            *other = true;
+        }
+    }
+    else if (send_result == IR_RECEIVE_NEC_OTHER)
+    {
+        *other = true;
+    }
+    ir_protocol_unlock();
+    return ret;
+}
@@ -0,0 +1,176 @@
+#ifndef _IR_PROTOCOL_H
+#define _IR_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ir_remote_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 电平缓冲区长度, 驱动要求至少1024个电平, 发送前换算成32位计数值后只能用一半
+#define IR_PROTOCOL_BUF_LEVELS 1024
+// 每个协议最多的字段数
+#define IR_PROTOCOL_MAX_FIELDS 6
+// 帧周期小于帧长度时, 两帧之间至少间隔这么久
+#define IR_PROTOCOL_MIN_GAP 5000
+// 时钟不能准确产生载波时最多推迟发送这么久
+#define IR_PROTOCOL_DEFER_MS 3000
+
+typedef enum
+{
+    IR_PROTO_NEC,     // NEC, 8位地址+反码, 8位命令+反码
+    IR_PROTO_NEC_EXT, // NEC扩展, 16位地址, 8位命令+反码
+    IR_PROTO_SAMSUNG, // 三星, 8位地址发两次, 8位命令+反码
+    IR_PROTO_SONY12,  // 索尼SIRC 12位, 7位命令, 5位地址
+    IR_PROTO_RC5,     // 飞利浦RC5, 5位地址, 7位命令(第7位反相作为第二个起始位)
+    IR_PROTO_RC6,     // 飞利浦RC6 mode 0, 8位地址, 8位命令
+
+    IR_PROTO_COUNT
+} ir_protocol_id_t;
+
+// 字段的数据来源
+typedef enum
+{
+    IR_FIELD_CONST,    // 常量value
+    IR_FIELD_ADDR,     // 地址
+    IR_FIELD_ADDR_INV, // 地址的反码
+    IR_FIELD_CMD,      // 命令
+    IR_FIELD_CMD_INV,  // 命令的反码
+    IR_FIELD_TOGGLE,   // 翻转位, 每次按键翻转一次
+} ir_field_source_t;
+
+typedef struct
+{
+    uint8_t source; // ir_field_source_t
+    uint8_t width;  // 位数
+    uint8_t shift;  // 取数据来源的第shift位开始的width位
+    uint8_t value;  // IR_FIELD_CONST的值
+    uint8_t wide;   // 使用协议的wide位编码
+} ir_field_t;
+
+/**
+ * 协议描述表, 所有时长的单位都是us, 正数为有载波的mark, 负数为没有载波的space, 以0结尾
+ * 相邻的同极性时长在编码时会合并成一个电平
+ */
+typedef struct
+{
+    const char *name;
+    int16_t header[4];        // 引导码
+    int16_t bit[2][2];        // 0和1的编码
+    int16_t wide[2][2];       // 加宽的0和1的编码, 如RC6的翻转位
+    int16_t trailer[2];       // 结束码
+    int16_t repeat[4];        // 重复码, 为空时重复发送整帧
+    bool msb_first;           // 每个字段是否高位先发
+    uint8_t min_frames;       // 至少发送的帧数, 如索尼要求至少发3帧
+    uint32_t period;          // 两帧起始之间的间隔
+    ir_field_t fields[IR_PROTOCOL_MAX_FIELDS];
+} ir_protocol_t;
+
+typedef struct
+{
+    uint8_t protocol; // ir_protocol_id_t
+    bool toggle;      // 翻转位
+    bool repeat;      // 是否是重复码
+    uint16_t address;
+    uint16_t command;
+} ir_protocol_code_t;
+
+/**
+ * @brief 获取协议描述表
+ */
+const ir_protocol_t *ir_protocol_get(ir_protocol_id_t id);
+/**
+ * @brief 把一次按键编码成驱动的电平, 电平单位为IR_DATA_DIV_COEFFICIENT us
+ *      - 发送一帧后紧跟repeat次重复, 每帧之间按协议的帧周期补齐间隔
+ *
+ * @param code 要编码的按键, 忽略其中的repeat
+ * @param repeat 重复次数, 协议有重复码时发送重复码, 否则重复发送整帧
+ * @param buf 电平缓冲区, 偶数位置为mark, 奇数位置为space
+ * @param size 电平缓冲区长度
+ * @return 电平数量, 缓冲区放不下时为0
+ */
+uint32_t ir_protocol_encode(const ir_protocol_code_t *code, uint8_t repeat, uint16_t *buf, uint32_t size);
+/**
+ * @brief 按指定协议解码一帧电平
+ *
+ * @param code 输入协议, 输出地址、命令、翻转位以及是否是重复码
+ * @param buf 电平缓冲区, 格式同ir_protocol_encode
+ * @param count 电平数量
+ * @retval RETURN_OK 解码成功
+ * @retval RETURN_ERR 不符合该协议
+ */
+int ir_protocol_decode(ir_protocol_code_t *code, const uint16_t *buf, uint32_t count);
+/**
+ * @brief 尝试所有协议解码一帧电平, 取时长误差最小的协议, 参数同ir_protocol_decode, 输出匹配的协议
+ */
+int ir_protocol_decode_any(ir_protocol_code_t *code, const uint16_t *buf, uint32_t count);
+
+/**
+ * @brief 获取板子上红外发射、接收管脚的配置并分配定时器, 用于ir_setPinInfo
+ *
+ * @retval RETURN_ERR 没有空闲的硬件定时器
+ */
+int ir_protocol_pin_info(stIrPinInfo *info);
+/**
+ * @brief 初始化红外发送, 需要在ir_setPinInfo之后、ir_hw_init之前调用
+ *      - 可以重复调用, 重新把驱动缓冲区设为本模块的缓冲区
+ */
+int ir_protocol_init(void);
+/**
+ * @brief 独占红外驱动, 可以嵌套
+ *      - 本模块的收发函数内部都会加锁, 直接使用驱动缓冲区或者调用空调码库时需要自己加锁
+ */
+void ir_protocol_lock(void);
+/**
+ * @brief 释放红外驱动
+ */
+void ir_protocol_unlock(void);
+/**
+ * @brief 发送一次按键, 并紧跟repeat次重复, 相当于按住遥控器按键
+ *      - 整串电平一次性写入驱动缓冲区, 由定时器中断连续发送, 阻塞到发送完成
+ *      - 所有发送在低功耗时钟下都会推迟到时钟恢复, 最多推迟IR_PROTOCOL_DEFER_MS
+ *      - RC5和RC6的翻转位每次调用翻转一次
+ */
+int ir_protocol_send(ir_protocol_id_t protocol, uint16_t address, uint16_t command, uint8_t repeat);
+/**
+ * @brief 发送已经写入驱动缓冲区的count个电平, 阻塞到发送完成
+ *      - 缓冲区用get_ir_driver_buf获取, 最多写入IR_PROTOCOL_BUF_LEVELS / 2个电平, 写入前要调用ir_protocol_lock
+ *
+ * @param timeout_ms 超过这么久还没发送完就认为驱动出了问题, 停止发送并返回RETURN_ERR
+ */
+int ir_protocol_send_levels(uint32_t count, uint32_t timeout_ms);
+/**
+ * @brief 流式发送, 驱动在定时器中断中调用generator逐个取出电平, 阻塞到发送完成
+ *      - 不占用驱动缓冲区, 电平数量不受缓冲区限制
+ *
+ * @param timeout_ms 同ir_protocol_send_levels
+ */
+int ir_protocol_send_stream(ir_send_level_generator_t generator, void *arg, uint32_t timeout_ms);
+/**
+ * @brief 接收一串遥控码, 阻塞到接收结束
+ *      - 电平格式同ir_protocol_encode, 最后一个电平是结束时补上的长间隔
+ *
+ * @param levels 输出收到的电平, 指向驱动缓冲区, 下一次收发之前有效
+ * @param end_gap_us 没有边沿超过这么久认为接收结束
+ * @param timeout_ms 等待第一个边沿的时间
+ * @return 电平数量, 没有收到或者出错时为0
+ */
+uint32_t ir_protocol_receive(const uint16_t **levels, uint32_t end_gap_us, uint32_t timeout_ms);
+/**
+ * @brief 用驱动的流式NEC接收等一帧NEC码, 收完最后一位就返回, 不用等接收结束的间隔
+ *
+ * @param code 输出收到的码, 协议为IR_PROTO_NEC或IR_PROTO_NEC_EXT
+ * @param other 输出是否收到了不是NEC的载波, 这时应该改用ir_protocol_receive接收波形
+ * @param timeout_ms 等待的时间
+ * @retval RETURN_OK 收到一帧NEC码
+ * @retval RETURN_ERR 超时、收到其他协议或驱动忙
+ */
+int ir_protocol_receive_nec(ir_protocol_code_t *code, bool *other, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
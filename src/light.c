@@ -0,0 +1,155 @@
+#include "light.h"
+
+#include <stdint.h>
+#include "sdk_default_config.h"
+#include "ci112x_system.h"
+#include "ci_log.h"
+#include "light_backend.h"
+
+#if LIGHT_BACKEND_COUNT == 1
+
+// 只启用一个夜灯时直接调用它的实现, 灯光命令不经过函数指针
+#if LIGHT_PWM_ENABLE
+#define LIGHT_ONLY(fn) light_pwm_##fn
+#elif LIGHT_RGB_ENABLE
+#define LIGHT_ONLY(fn) light_rgb_##fn
+#else
+#define LIGHT_ONLY(fn) light_ir_##fn
+#endif
+
+int light_init(void)
+{
+    return LIGHT_ONLY(init)();
+}
+
+int light_early_restore(void)
+{
+    return LIGHT_ONLY(early_restore)();
+}
+
+void light_snapshot(void)
+{
+    LIGHT_ONLY(snapshot)();
+}
+
+int light_deinit(void)
+{
+    return LIGHT_ONLY(deinit)();
+}
+
+int light_control(LightCommand cmd)
+{
+    return LIGHT_ONLY(control)(cmd);
+}
+
+int light_cue(bool wakeup)
+{
+    return LIGHT_ONLY(cue)(wakeup);
+}
+
+#else
+
+static const light_ops_t *const backends[] =
+{
+#if LIGHT_PWM_ENABLE
+    &light_pwm_ops,
+#endif
+#if LIGHT_RGB_ENABLE
+    &light_rgb_ops,
+#endif
+#if LIGHT_IR_ENABLE
+    &light_ir_ops,
+#endif
+};
+
+// 初始化成功的夜灯, 每个backends一位, 没有初始化成功的夜灯不接收命令
+static uint32_t active = 0;
+
+#define for_each_active(i) \
+    for (int i = 0; i < LIGHT_BACKEND_COUNT; i++) \
+        if (active & (1 << i))
+
+int light_init(void)
+{
+    for (int i = 0; i < LIGHT_BACKEND_COUNT; i++)
+    {
+        if (backends[i]->init() == RETURN_OK)
+        {
+            active |= 1 << i;
+        }
+        else
+        {
+            ci_logerr(LOG_USER, "light %s init failed!\n", backends[i]->name);
+        }
+    }
+    return active != 0 ? RETURN_OK : RETURN_ERR;
+}
+
+int light_early_restore(void)
+{
+    int ret = RETURN_ERR;
+
+    // 在light_init之前调用, 交给所有启用的夜灯自己判断
+    for (int i = 0; i < LIGHT_BACKEND_COUNT; i++)
+    {
+        if (backends[i]->early_restore() == RETURN_OK)
+        {
+            ret = RETURN_OK;
+        }
+    }
+    return ret;
+}
+
+void light_snapshot(void)
+{
+    // 异常处理中也会调用, 夜灯自己判断有没有可以保存的状态
+    for (int i = 0; i < LIGHT_BACKEND_COUNT; i++)
+    {
+        backends[i]->snapshot();
+    }
+}
+
+int light_deinit(void)
+{
+    int ret = RETURN_OK;
+
+    for_each_active(i)
+    {
+        if (backends[i]->deinit() != RETURN_OK)
+        {
+            ret = RETURN_ERR;
+        }
+    }
+    active = 0;
+    return ret;
+}
+
+int light_control(LightCommand cmd)
+{
+    int ret = active != 0 ? RETURN_OK : RETURN_ERR;
+
+    for_each_active(i)
+    {
+        if (backends[i]->control(cmd) != RETURN_OK)
+        {
+            ret = RETURN_ERR;
+        }
+    }
+    return ret;
+}
+
+int light_cue(bool wakeup)
+{
+    int ret = active != 0 ? RETURN_OK : RETURN_ERR;
+
+    for_each_active(i)
+    {
+        if (backends[i]->cue(wakeup) != RETURN_OK)
+        {
+            ret = RETURN_ERR;
+        }
+    }
+    return ret;
+}
+
+#endif
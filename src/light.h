@@ -1,20 +1,24 @@
 #ifndef _LIGHT_H
 #define _LIGHT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// 夜灯种类
-#define LIGHT_NONE 0
-#define LIGHT_PWM 1
-#define LIGHT_RGB 2
-#define LIGHT_IR 3
-// 在此选择夜灯种类
-#define LIGHT_TYPE LIGHT_RGB
-#if (LIGHT_TYPE != LIGHT_PWM && LIGHT_TYPE != LIGHT_RGB && LIGHT_TYPE != LIGHT_IR)
+// 在此选择要启用的夜灯, 可以同时启用多个, 每个灯光命令会依次发给所有启用的夜灯
+#define LIGHT_PWM_ENABLE 0 // PWM控制的单色灯
+#define LIGHT_RGB_ENABLE 1 // ws2812彩灯
+#define LIGHT_IR_ENABLE 0  // 红外遥控的夜灯
+#define LIGHT_BACKEND_COUNT (LIGHT_PWM_ENABLE + LIGHT_RGB_ENABLE + LIGHT_IR_ENABLE)
+#if LIGHT_BACKEND_COUNT == 0
 #error "Please choose light type first!"
 #endif
+#if LIGHT_PWM_ENABLE && LIGHT_RGB_ENABLE
+#error "PWM light and RGB light both use PWM5 pad!"
+#endif
 
 typedef enum {
     LIGHT_POWER_ON,  // 开灯
@@ -39,17 +43,74 @@ typedef enum {
 } LightCommand;
 
 /**
- * @brief 初始化小夜灯
+ * @brief 初始化所有启用的小夜灯
+ *      - 初始化失败的夜灯之后不再接收命令, 不影响其他夜灯
+ *
+ * @retval RETURN_ERR 所有夜灯都初始化失败
  */
 int light_init(void);
+/**
+ * @brief 异常复位后尽早恢复复位前的灯光, 在操作系统、flash和nvdata初始化之前调用
+ *
+ * @retval RETURN_OK 至少一个夜灯已恢复
+ * @retval RETURN_ERR 正常上电或没有可用的灯光状态
+ */
+int light_early_restore(void);
+/**
+ * @brief 把当前灯光状态保存到不初始化的RAM中, 供异常复位后恢复
+ */
+void light_snapshot(void);
 /**
  * @brief 释放小夜灯
  */
 int light_deinit(void);
 /**
- * @brief 向小夜灯发送控制命令
+ * @brief 向所有启用的小夜灯发送控制命令
+ *
+ * @retval RETURN_ERR 有夜灯执行失败
  */
 int light_control(LightCommand cmd);
+/**
+ * @brief 唤醒/退出唤醒时的灯光提示, 在当前灯效上叠加一次短暂的亮度脉冲
+ *
+ * @param wakeup true:进入唤醒 false:退出唤醒
+ */
+int light_cue(bool wakeup);
+
+#if LIGHT_PWM_ENABLE
+typedef struct
+{
+    uint8_t resolution_bits;   // 有效分辨率, 占空比级数加上抖动的小数位
+    uint32_t isr_count;        // 抖动中断次数
+    uint32_t isr_cycles_max;   // 单次抖动中断的最大耗时, 单位CPU周期
+    uint64_t isr_cycles_total; // 抖动中断的总耗时
+    uint32_t load_ppm;         // 抖动时中断占用的CPU, 单位百万分之一, 不抖动时没有中断
+} light_pwm_dither_stats_t;
+
+/**
+ * @brief 获取PWM夜灯占空比抖动的有效分辨率和中断开销
+ */
+void light_pwm_get_dither_stats(light_pwm_dither_stats_t *stats);
+/**
+ * @brief APB时钟改变后按新时钟重新装载抖动定时器, 切换功耗模式后调用, 可以在中断中调用
+ */
+void light_pwm_clock_update(void);
+#endif
+
+#if LIGHT_IR_ENABLE
+/**
+ * @brief 切换红外夜灯使用的遥控器配置, 选择会保存到nvdata
+ *
+ * @param index 配置序号, 小于0时切换到下一个配置
+ */
+int light_ir_select_profile(int index);
+/**
+ * @brief 开始学习遥控器按键
+ *      - 之后的第一个灯光命令不发送, 而是作为要学习的命令, 然后连续按两次遥控器上的按键
+ *      - 学到的按键保存在nvdata中, 之后代替配置中的按键发送
+ */
+int light_ir_learn(void);
+#endif
 
 #ifdef __cplusplus
 }
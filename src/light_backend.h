@@ -0,0 +1,62 @@
+#ifndef _LIGHT_BACKEND_H
+#define _LIGHT_BACKEND_H
+
+#include <stdbool.h>
+#include "light.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 夜灯后端的接口表, 每种夜灯实现一份, 由light.c注册并把light.h的接口分发给所有启用的夜灯
+ * 各函数的含义与light.h中同名的light_*接口相同
+ */
+typedef struct
+{
+    const char *name;
+    int (*init)(void);
+    int (*early_restore)(void);
+    void (*snapshot)(void);
+    int (*deinit)(void);
+    int (*control)(LightCommand cmd);
+    int (*cue)(bool wakeup);
+} light_ops_t;
+
+/**
+ * @brief 声明一个夜灯后端的实现函数和接口表
+ *      - 只启用一个夜灯时light.c直接调用这些函数, 不经过接口表
+ */
+#define LIGHT_BACKEND_DECLARE(type) \
+    int light_##type##_init(void); \
+    int light_##type##_early_restore(void); \
+    void light_##type##_snapshot(void); \
+    int light_##type##_deinit(void); \
+    int light_##type##_control(LightCommand cmd); \
+    int light_##type##_cue(bool wakeup); \
+    extern const light_ops_t light_##type##_ops
+
+/**
+ * @brief 在后端的源文件中定义接口表
+ */
+#define LIGHT_BACKEND_DEFINE(type) \
+    const light_ops_t light_##type##_ops = \
+    { \
+        .name = #type, \
+        .init = light_##type##_init, \
+        .early_restore = light_##type##_early_restore, \
+        .snapshot = light_##type##_snapshot, \
+        .deinit = light_##type##_deinit, \
+        .control = light_##type##_control, \
+        .cue = light_##type##_cue, \
+    }
+
+LIGHT_BACKEND_DECLARE(pwm);
+LIGHT_BACKEND_DECLARE(rgb);
+LIGHT_BACKEND_DECLARE(ir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,97 +1,506 @@
-#include "light.h"
+#include "light_backend.h"
 
-#if LIGHT_TYPE == LIGHT_IR
+#if LIGHT_IR_ENABLE
 
+#include <string.h>
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
+#include "sdk_default_config.h"
+#include "ci_nvdata_manage.h"
 #include "ci_log.h"
+#include "nv_store.h"
 #include "ir_remote_driver.h"
-#include "ir_data.h"
-
-#define ARRAY_LENGTH(arr) (sizeof(arr) / sizeof(arr[0]))
-#define MAX_BRIGHTNESS 9
-#define MID_BRIGHTNESS 3
-
-// 前两个字节为地址码(小端序), 第三个字节为命令码, 第四个字节为命令码的反码
-typedef uint8_t nec_key_t[4];
-
-// 注释是遥控器上标的按键名
-nec_key_t KEY_POWER_ON = { 0x00, 0xEF, 0x03, 0xFC }; // ON
-nec_key_t KEY_POWER_OFF = { 0x00, 0xEF, 0x02, 0xFD }; // OFF
-nec_key_t KEY_BRIGHT_INC = { 0x00, 0xEF, 0x00, 0xFF }; // BRIGHT
-nec_key_t KEY_BRIGHT_DEC = { 0x00, 0xEF, 0x01, 0xFE }; // DARK
-nec_key_t KEY_COLORS[] =
-{
-        { 0x00, 0xEF, 0x07, 0xF8 }, // W
-
-        { 0x00, 0xEF, 0x04, 0xFB }, // R
-        { 0x00, 0xEF, 0x08, 0xF7 },
-        { 0x00, 0xEF, 0x0C, 0xF3 },
-        { 0x00, 0xEF, 0x10, 0xEF },
-        { 0x00, 0xEF, 0x14, 0xEB },
-
-        { 0x00, 0xEF, 0x05, 0xFA }, // G
-        { 0x00, 0xEF, 0x09, 0xF6 },
-        { 0x00, 0xEF, 0x0D, 0xF2 },
-        { 0x00, 0xEF, 0x11, 0xEE },
-        { 0x00, 0xEF, 0x15, 0xEA },
-
-        { 0x00, 0xEF, 0x06, 0xF9 }, // B
-        { 0x00, 0xEF, 0x0A, 0xF5 },
-        { 0x00, 0xEF, 0x0E, 0xF1 },
-        { 0x00, 0xEF, 0x12, 0xED },
-        { 0x00, 0xEF, 0x16, 0xE9 },
-};
-nec_key_t KEY_MODE_FLASH = { 0x00, 0xEF, 0x0B, 0xF4 }; // FLASH
-nec_key_t KEY_MODE_BREATH = { 0x00, 0xEF, 0x0F, 0xF0 }; // STROBE
-nec_key_t KEY_MODE_RAINBOW = { 0x00, 0xEF, 0x13, 0xEC }; // FADE
-nec_key_t KEY_MODE_SMOOTH = { 0x00, 0xEF, 0x17, 0xE8 }; // SMOOTH
+#include "ir_protocol.h"
+#include "ir_profile.h"
+#include "ir_code.h"
+#include "system_msg_deal.h"
+#include "prompt_player.h"
+#if CONFIG_CLI_EN
+#include <stdio.h>
+#include <stdlib.h>
+#include "FreeRTOS_CLI.h"
+#endif
 
-uint8_t current_color = 0;
+// 夜灯状态的影子, 不和ws2812彩灯的灯光设置共用条目, 两种夜灯可以同时启用
+#define NVDATA_ID_LIGHT (NVDATA_ID_USER_START + 4)
+#define NVDATA_ID_IR_PROFILE (NVDATA_ID_USER_START + 1)
+#define NVDATA_ID_IR_LEARNED (NVDATA_ID_USER_START + 2)
+// 每个命令学到的按键单独保存, 只在发送时读取
+#define NVDATA_ID_IR_LEARN_BASE (NVDATA_ID_USER_START + 0x10)
+// 等待发送的命令数量
+#define TX_QUEUE_SIZE 8
+// 说出学习命令后, 这么久之内的下一个灯光命令作为要学习的命令
+#define LEARN_ARM_MS 30000
+// 等待按下遥控器的时间
+#define LEARN_TIMEOUT_MS 10000
+// 比所有协议的帧间隔都短, 收完第一帧就结束接收, 不用等松开按键
+#define LEARN_END_GAP_US 20000
+// 每个学到的按键占用的nvdata大小, 不能超过NV_STORE_LARGE_SIZE
+#define LEARN_RECORD_SIZE NV_STORE_LARGE_SIZE
 
-// TODO 我只想用send_nec_key, 但是这个函数在libir_lib.a这个库里, 看不到代码
-int device_common_sendmsg(void *msgtyp, void *pDevice, void *pKey, void *data)
+typedef enum {
+    MODE_NORMAL,  // 常亮
+    MODE_FLASH,   // 闪光模式
+    MODE_BREATH,  // 呼吸模式
+    MODE_RAINBOW, // 彩虹模式
+} IrMode;
+
+/**
+ * 夜灯状态的影子, 记录发出去的按键让夜灯变成了什么状态, 保存在nvdata中
+ * 红外是单向的, 影子和夜灯不一致时(如用了遥控器)由用户重复同一个命令触发重新同步
+ */
+typedef struct
 {
-    return RETURN_OK;
+    bool power;
+    bool synced;        // 亮度是否已知, 不知道时调亮度要先调到头
+    uint8_t brightness; // 0 ~ max_brightness
+    uint8_t color;      // 配置中colors的下标
+    uint8_t mode;       // IrMode
+} IrShadow;
+
+typedef enum {
+    LEARN_PROTOCOL, // 能按已知协议解码, 只保存地址和命令
+    LEARN_RAW,      // 未知协议, 用ir_code压缩保存波形
+} LearnType;
+
+typedef struct
+{
+    uint8_t type;   // LearnType
+    uint8_t length; // 压缩后的波形字节数
+    union
+    {
+        ir_protocol_code_t code;
+        uint8_t raw[LEARN_RECORD_SIZE - 2];
+    } data;
+} IrLearned;
+
+static IrShadow shadow;
+// 当前使用的遥控器配置, 指向flash
+static const ir_profile_t *profile = NULL;
+static uint8_t profile_index = 0;
+// 等待发送任务切换的配置
+static const ir_profile_t *profile_request = NULL;
+
+// 已经学习过的命令, 每个LightCommand一位
+static uint32_t learned_mask = 0;
+// 说出学习命令的时间, 为0时没有在等待要学习的命令
+static TickType_t learn_armed = 0;
+// 等待发送任务学习的命令, 为LIGHT_CMD_COUNT时没有
+static LightCommand learn_request = LIGHT_CMD_COUNT;
+
+// 等待发送的命令, 由发送任务依次取出
+static LightCommand tx_queue[TX_QUEUE_SIZE];
+static uint8_t tx_count = 0;
+static SemaphoreHandle_t tx_lock = NULL;
+static TaskHandle_t tx_task = NULL;
+
+static int send_key(uint16_t key)
+{
+    return ir_protocol_send(profile->protocol, profile->address, key, 0);
+}
+
+// 第一帧之后跟着的重复相当于按住按键, 夜灯会连续执行repeat次, repeat为0时和1一样只发一帧
+static int send_key_repeat(uint16_t key, uint8_t repeat)
+{
+    return ir_protocol_send(profile->protocol, profile->address, key, repeat > 0 ? repeat - 1 : 0);
+}
+
+static int ir_send_command(LightCommand cmd);
+
+static bool is_bright_command(LightCommand cmd)
+{
+    return cmd >= LIGHT_BRIGHT_INC && cmd <= LIGHT_BRIGHT_MIN;
+}
+
+static bool is_color_command(LightCommand cmd)
+{
+    return cmd >= LIGHT_SWITCH_COLOR && cmd <= LIGHT_MODE_RAINBOW;
 }
 
-// TODO 在换成自己写的send_nec_key之后换成发送重复码而非重复发送
-int send_nec_key_repeat(nec_key_t nec_key, uint8_t repeat)
+/**
+ * @brief 判断新命令发出后, 还没发送的命令old是否已经没有意义
+ */
+static bool is_superseded(LightCommand old, LightCommand cmd)
 {
-    for (uint8_t i = 0; i < repeat; i++)
+    switch (cmd)
     {
-        if (send_nec_key(nec_key) != RETURN_OK)
+        case LIGHT_POWER_OFF:
+            // 关灯之后其他命令都看不到效果了
+            return true;
+        case LIGHT_POWER_ON:
+            return old == LIGHT_POWER_ON || old == LIGHT_POWER_OFF;
+        case LIGHT_BRIGHT_MAX:
+        case LIGHT_BRIGHT_MID:
+        case LIGHT_BRIGHT_MIN:
+            return is_bright_command(old);
+        case LIGHT_COLOR_WHITE:
+        case LIGHT_COLOR_COOL:
+        case LIGHT_COLOR_WARM:
+        case LIGHT_MODE_FLASH:
+        case LIGHT_MODE_BREATH:
+        case LIGHT_MODE_RAINBOW:
+            return is_color_command(old);
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief 把命令加入发送队列, 并合并掉被它取代的命令
+ */
+static int ir_queue_command(LightCommand cmd)
+{
+    int ret = RETURN_OK;
+    uint8_t count = 0;
+
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    if (tx_count > 0 && ((cmd == LIGHT_BRIGHT_INC && tx_queue[tx_count - 1] == LIGHT_BRIGHT_DEC)
+        || (cmd == LIGHT_BRIGHT_DEC && tx_queue[tx_count - 1] == LIGHT_BRIGHT_INC)))
+    {
+        // 相反的两步亮度调节互相抵消
+        tx_count--;
+        xSemaphoreGive(tx_lock);
+        return RETURN_OK;
+    }
+    for (uint8_t i = 0; i < tx_count; i++)
+    {
+        if (!is_superseded(tx_queue[i], cmd))
+        {
+            tx_queue[count++] = tx_queue[i];
+        }
+    }
+    if (count < tx_count)
+    {
+        ci_logdebug(LOG_USER, "ir: %d commands collapsed by %d\n", tx_count - count, cmd);
+    }
+    tx_count = count;
+    if (tx_count < TX_QUEUE_SIZE)
+    {
+        tx_queue[tx_count++] = cmd;
+    }
+    else
+    {
+        ci_logwarn(LOG_USER, "ir: queue full, drop %d\n", cmd);
+        ret = RETURN_ERR;
+    }
+    xSemaphoreGive(tx_lock);
+    xTaskNotifyGive(tx_task);
+    return ret;
+}
+
+/**
+ * @brief 重置影子为新夜灯的初始状态, 第一次使用时不知道夜灯的亮度
+ */
+static void ir_shadow_reset(void)
+{
+    shadow.power = true;
+    shadow.synced = false;
+    shadow.brightness = profile->mid_brightness;
+    shadow.color = profile->white;
+    shadow.mode = MODE_NORMAL;
+}
+
+/**
+ * @brief 在发送任务中切换遥控器配置, 换了夜灯之后原来的影子就没有意义了
+ */
+static void ir_use_profile(const ir_profile_t *p)
+{
+    for (uint8_t i = 0; i < ir_profile_count(); i++)
+    {
+        if (ir_profile_get(i) == p)
+        {
+            profile_index = i;
+        }
+    }
+    profile = p;
+    ir_shadow_reset();
+    nv_store_write(NVDATA_ID_IR_PROFILE, &profile_index, sizeof(profile_index));
+    nv_store_write(NVDATA_ID_LIGHT, &shadow, sizeof(shadow));
+    ci_loginfo(LOG_USER, "ir: use profile %d %s\n", profile_index, profile->name);
+}
+
+/**
+ * @brief 发送学习到的按键
+ */
+static int ir_send_learned(LightCommand cmd)
+{
+    IrLearned rec;
+
+    // 刚学到的按键可能还没写入flash
+    if (nv_store_read(NVDATA_ID_IR_LEARN_BASE + cmd, &rec, sizeof(rec)) != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    if (rec.type == LEARN_PROTOCOL)
+    {
+        return ir_protocol_send(rec.data.code.protocol, rec.data.code.address, rec.data.code.command, 0);
+    }
+    // 发送时在中断里逐个读符号, 不再检查下标, 损坏的记录在这里拦下
+    if (rec.type != LEARN_RAW || rec.length > sizeof(rec.data.raw) || !ir_code_check(rec.data.raw, rec.length))
+    {
+        ci_logerr(LOG_USER, "ir: learned key %d is corrupted\n", cmd);
+        return RETURN_ERR;
+    }
+    return ir_code_send(rec.data.raw);
+}
+
+/**
+ * @brief 收一次遥控器按键, 能解码就只保存按键码, 否则压缩保存波形
+ *      - 先用驱动的流式NEC接收, 收完最后一位就有结果, 不用等接收结束的间隔
+ *      - 收到的不是NEC时这次按键已经过去一半, 改为接收下一次按键的波形, 之后也不再用流式接收
+ *
+ * @param nec 输入输出是否还用流式NEC接收
+ */
+static int ir_learn_capture(IrLearned *rec, bool *nec)
+{
+    const uint16_t *levels;
+    uint32_t count;
+    bool other;
+
+    memset(rec, 0, sizeof(IrLearned));
+    if (*nec)
+    {
+        if (ir_protocol_receive_nec(&rec->data.code, &other, LEARN_TIMEOUT_MS) == RETURN_OK)
+        {
+            rec->type = LEARN_PROTOCOL;
+            ci_logdebug(LOG_USER, "ir: learned %s %x %x\n", ir_protocol_get(rec->data.code.protocol)->name,
+                rec->data.code.address, rec->data.code.command);
+            return RETURN_OK;
+        }
+        if (!other)
         {
             return RETURN_ERR;
         }
+        *nec = false;
+        ci_loginfo(LOG_USER, "ir: not NEC, press the key again\n");
+        // 等这次按键剩下的部分过去
+        vTaskDelay(pdMS_TO_TICKS(200));
+    }
+    count = ir_protocol_receive(&levels, LEARN_END_GAP_US, LEARN_TIMEOUT_MS);
+    if (count == 0)
+    {
+        return RETURN_ERR;
+    }
+    if (ir_protocol_decode_any(&rec->data.code, levels, count) == RETURN_OK && !rec->data.code.repeat)
+    {
+        rec->type = LEARN_PROTOCOL;
+        ci_logdebug(LOG_USER, "ir: learned %s %x %x\n", ir_protocol_get(rec->data.code.protocol)->name,
+            rec->data.code.address, rec->data.code.command);
+        return RETURN_OK;
+    }
+    rec->type = LEARN_RAW;
+    rec->length = ir_code_compress(levels, count, rec->data.raw, sizeof(rec->data.raw));
+    return rec->length > 0 ? RETURN_OK : RETURN_ERR;
+}
+
+/**
+ * @brief 两次收到的按键是否一样
+ */
+static bool ir_learn_same(const IrLearned *a, const IrLearned *b)
+{
+    ir_code_iter_t ia, ib;
+    uint16_t la, lb;
+
+    if (a->type != b->type)
+    {
+        return false;
+    }
+    if (a->type == LEARN_PROTOCOL)
+    {
+        // 翻转位每次按键都会变
+        return a->data.code.protocol == b->data.code.protocol && a->data.code.address == b->data.code.address
+            && a->data.code.command == b->data.code.command;
+    }
+    ir_code_iter_init(&ia, a->data.raw);
+    ir_code_iter_init(&ib, b->data.raw);
+    if (ia.count != ib.count)
+    {
+        return false;
+    }
+    // 最后一个电平是接收结束时补上的, 不比较
+    for (uint16_t i = 0; i + 1 < ia.count; i++)
+    {
+        ir_code_iter_next(&ia, &la);
+        ir_code_iter_next(&ib, &lb);
+        if ((la > lb ? la - lb : lb - la) > (la > lb ? la : lb) / 4 + IR_CODE_SKEW)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 用语音提示学习结果
+ */
+static void ir_learn_report(bool ok)
+{
+    pause_voice_in();
+    prompt_play_by_cmd_string(ok ? "<learn_ok>" : "<learn_fail>", -1, default_play_done_callback, true);
+}
+
+/**
+ * @brief 在发送任务中学习一个命令, 同一个按键要收到两次且一致才保存
+ */
+static void ir_learn(LightCommand cmd)
+{
+    IrLearned first, second;
+    bool nec = true;
+    bool ok = false;
+
+    ci_loginfo(LOG_USER, "ir: learning command %d, press the key twice\n", cmd);
+    if (ir_learn_capture(&first, &nec) == RETURN_OK)
+    {
+        // 等第一次按下的重复码都过去
         vTaskDelay(pdMS_TO_TICKS(200));
+        ok = ir_learn_capture(&second, &nec) == RETURN_OK && ir_learn_same(&first, &second);
+    }
+    if (ok)
+    {
+        // 由后台任务等ASR空闲时写入, 不在这里擦写flash
+        nv_store_write(NVDATA_ID_IR_LEARN_BASE + cmd, &first, sizeof(first));
+        learned_mask |= 1u << cmd;
+        nv_store_write(NVDATA_ID_IR_LEARNED, &learned_mask, sizeof(learned_mask));
     }
+    ci_loginfo(LOG_USER, "ir: learn command %d %s\n", cmd, ok ? "ok" : "failed");
+    ir_learn_report(ok);
+}
+
+/**
+ * @brief 红外发送任务
+ *      - 每次发送在驱动回调通知发送结束后立即返回, 队列中的下一条命令紧接着发送
+ */
+static void ir_tx_task(void *p_arg)
+{
+    while (1)
+    {
+        xSemaphoreTake(tx_lock, portMAX_DELAY);
+        if (profile_request != NULL)
+        {
+            const ir_profile_t *p = profile_request;
+            profile_request = NULL;
+            xSemaphoreGive(tx_lock);
+            ir_use_profile(p);
+            continue;
+        }
+        if (learn_request != LIGHT_CMD_COUNT)
+        {
+            LightCommand cmd = learn_request;
+            learn_request = LIGHT_CMD_COUNT;
+            xSemaphoreGive(tx_lock);
+            ir_learn(cmd);
+            continue;
+        }
+        if (tx_count == 0)
+        {
+            xSemaphoreGive(tx_lock);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        LightCommand cmd = tx_queue[0];
+        tx_count--;
+        for (uint8_t i = 0; i < tx_count; i++)
+        {
+            tx_queue[i] = tx_queue[i + 1];
+        }
+        xSemaphoreGive(tx_lock);
+
+        if (ir_send_command(cmd) != RETURN_OK)
+        {
+            ci_logerr(LOG_USER, "ir: send %d failed\n", cmd);
+        }
+    }
+}
+
+int light_ir_select_profile(int index)
+{
+    const ir_profile_t *p;
+
+    if (tx_lock == NULL)
+    {
+        return RETURN_ERR;
+    }
+    xSemaphoreTake(tx_lock, portMAX_DELAY);
+    if (index < 0)
+    {
+        // 在切换还没生效时连续切换, 从等待切换的配置往后数
+        index = profile_request != NULL ? profile_request - ir_profile_get(0) : profile_index;
+        index = (index + 1) % ir_profile_count();
+    }
+    p = ir_profile_get(index);
+    if (p != NULL)
+    {
+        // 还没发送的命令是发给旧夜灯的, 一起丢掉
+        profile_request = p;
+        tx_count = 0;
+    }
+    xSemaphoreGive(tx_lock);
+    if (p == NULL)
+    {
+        return RETURN_ERR;
+    }
+    xTaskNotifyGive(tx_task);
     return RETURN_OK;
 }
 
-int light_init(void)
+#if CONFIG_CLI_EN
+/**
+ * @brief 命令行: ir_profile 列出遥控器配置, ir_profile <序号> 切换配置
+ */
+static BaseType_t profile_command_handler(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    BaseType_t len = 0;
+    const char *param = FreeRTOS_CLIGetParameter(pcCommandString, 1, &len);
+
+    if (param == NULL)
+    {
+        // 每次调用输出一行, 返回pdTRUE时会再次调用
+        static uint8_t i = 0;
+        const ir_profile_t *p = ir_profile_get(i);
+        snprintf(pcWriteBuffer, xWriteBufferLen, "%c%d %s\r\n", i == profile_index ? '*' : ' ', i, p->name);
+        if (++i < ir_profile_count())
+        {
+            return pdTRUE;
+        }
+        i = 0;
+        return pdFALSE;
+    }
+    if (light_ir_select_profile(atoi(param)) == RETURN_OK)
+    {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "OK\r\n");
+    }
+    else
+    {
+        snprintf(pcWriteBuffer, xWriteBufferLen, "No such profile\r\n");
+    }
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t profile_command =
+{
+    "ir_profile",
+    "\r\nir_profile [index]:\r\n List IR remote profiles, or switch to profile <index>\r\n",
+    profile_command_handler,
+    -1
+};
+#endif
+
+int light_ir_init(void)
 {
     int ret = RETURN_ERR;
 
-    stIrPinInfo irPinInfo = {0};
-    // config outpin
-    irPinInfo.outPin.PinName  = PWM3_PAD;
-    irPinInfo.outPin.GpioBase = GPIO1;
-    irPinInfo.outPin.PinNum   = gpio_pin_4;
-    irPinInfo.outPin.PwmFun   = SECOND_FUNCTION;
-    irPinInfo.outPin.IoFun    = FIRST_FUNCTION;
-    irPinInfo.outPin.PwmBase  = PWM3;
-    // config revpin
-    irPinInfo.revPin.PinName  = PWM4_PAD;
-    irPinInfo.revPin.GpioBase = GPIO1;
-    irPinInfo.revPin.PinNum   = gpio_pin_5;
-    irPinInfo.revPin.IoFun    = FIRST_FUNCTION;
-    irPinInfo.revPin.GpioIRQ  = GPIO1_IRQn;
-    // config timer
-    irPinInfo.irTimer.ir_use_timer     = TIMER0;
-    irPinInfo.irTimer.ir_use_timer_IRQ = TIMER0_IRQn;
+    stIrPinInfo irPinInfo;
+    ret = ir_protocol_pin_info(&irPinInfo);
     // set io info
-    ret = ir_init(&irPinInfo);
+    if (ret == RETURN_OK)
+    {
+        ret = ir_setPinInfo(&irPinInfo);
+    }
+    if (ret == RETURN_OK)
+    {
+        ret = ir_protocol_init();
+    }
     if (ret != RETURN_OK)
     {
         ci_logerr(LOG_USER, "ir init failed!\n");
@@ -99,67 +508,237 @@ int light_init(void)
     }
     ir_hw_init();
 
+    nv_store_load(NVDATA_ID_IR_PROFILE, &profile_index, sizeof(profile_index));
+    profile = ir_profile_get(profile_index);
+    if (profile == NULL)
+    {
+        // 保存的配置已经从配置库中删掉了
+        profile_index = 0;
+        profile = ir_profile_get(0);
+    }
+    ir_shadow_reset();
+    nv_store_load(NVDATA_ID_LIGHT, &shadow, sizeof(shadow));
+    nv_store_load(NVDATA_ID_IR_LEARNED, &learned_mask, sizeof(learned_mask));
+#if CONFIG_CLI_EN
+    FreeRTOS_CLIRegisterCommand(&profile_command);
+#endif
+
+    tx_lock = xSemaphoreCreateMutex();
+    if (tx_lock == NULL || xTaskCreate(ir_tx_task, "ir_tx", 256, NULL, 3, &tx_task) != pdPASS)
+    {
+        ci_logerr(LOG_USER, "ir task create failed!\n");
+        return RETURN_ERR;
+    }
+
     return RETURN_OK;
 }
 
-int light_deinit(void)
+int light_ir_early_restore(void)
+{
+    // 红外夜灯自己保存着灯光状态, 本机复位不影响夜灯
+    return RETURN_ERR;
+}
+
+void light_ir_snapshot(void)
+{
+    // Nothing to do
+}
+
+int light_ir_deinit(void)
 {
     // Nothing to do
     return RETURN_OK;
 }
 
-int light_control(LightCommand cmd)
+/**
+ * @brief 把亮度调到level档
+ *      - 影子中的亮度已知时只按差值次数的键
+ *      - 亮度未知或已经等于目标(用户重复了命令, 说明影子和夜灯不一致)时先调到头再调回来
+ */
+static int ir_set_brightness(uint8_t level)
 {
-    int ret = RETURN_ERR;
+    int ret = RETURN_OK;
+    int8_t delta;
+
+    if (!shadow.synced || shadow.brightness == level)
+    {
+        ci_logdebug(LOG_USER, "ir: resync brightness to %d\n", level);
+        // 从离目标近的一头开始调
+        if (level > profile->max_brightness / 2)
+        {
+            ret = send_key_repeat(profile->keys[IR_KEY_BRIGHT_INC], profile->max_brightness);
+            shadow.brightness = profile->max_brightness;
+        }
+        else
+        {
+            ret = send_key_repeat(profile->keys[IR_KEY_BRIGHT_DEC], profile->max_brightness);
+            shadow.brightness = 0;
+        }
+        if (ret != RETURN_OK)
+        {
+            return ret;
+        }
+        shadow.synced = true;
+    }
+    delta = (int8_t) level - (int8_t) shadow.brightness;
+    if (delta > 0)
+    {
+        ret = send_key_repeat(profile->keys[IR_KEY_BRIGHT_INC], delta);
+    }
+    else if (delta < 0)
+    {
+        ret = send_key_repeat(profile->keys[IR_KEY_BRIGHT_DEC], -delta);
+    }
+    if (ret == RETURN_OK)
+    {
+        shadow.brightness = level;
+    }
+    else
+    {
+        // 不知道夜灯收到了几次
+        shadow.synced = false;
+    }
+    return ret;
+}
+
+/**
+ * @brief 发送一个设置颜色或模式的按键, 这些按键都是绝对的, 影子不一致也只需要一帧
+ */
+static int ir_set_color(uint8_t color, IrMode mode)
+{
+    int ret = send_key(mode == MODE_FLASH ? profile->keys[IR_KEY_MODE_FLASH]
+        : mode == MODE_BREATH ? profile->keys[IR_KEY_MODE_BREATH]
+        : mode == MODE_RAINBOW ? profile->keys[IR_KEY_MODE_RAINBOW]
+        : profile->colors[color]);
+    if (ret == RETURN_OK)
+    {
+        shadow.color = color;
+        shadow.mode = mode;
+    }
+    return ret;
+}
+
+static int ir_send_command(LightCommand cmd)
+{
+    int ret = RETURN_OK;
+
+    // 夜灯关着时不响应其他按键, 先开灯
+    if (!shadow.power && cmd != LIGHT_POWER_ON && cmd != LIGHT_POWER_OFF)
+    {
+        ret = ir_send_command(LIGHT_POWER_ON);
+        if (ret != RETURN_OK)
+        {
+            return ret;
+        }
+    }
+    if (learned_mask & (1u << cmd))
+    {
+        ret = ir_send_learned(cmd);
+        // 学到的按键只知道开关灯的效果, 调过亮度之后就不知道亮度了
+        if (cmd == LIGHT_POWER_ON || cmd == LIGHT_POWER_OFF)
+            shadow.power = cmd == LIGHT_POWER_ON;
+        else if (is_bright_command(cmd))
+            shadow.synced = false;
+        nv_store_write(NVDATA_ID_LIGHT, &shadow, sizeof(shadow));
+        return ret;
+    }
     switch (cmd)
     {
         case LIGHT_POWER_ON:
-            ret = send_nec_key(KEY_POWER_ON);
+            ret = send_key(profile->keys[IR_KEY_POWER_ON]);
+            shadow.power = true;
             break;
         case LIGHT_POWER_OFF:
-            ret = send_nec_key(KEY_POWER_OFF);
+            ret = send_key(profile->keys[IR_KEY_POWER_OFF]);
+            shadow.power = false;
             break;
         case LIGHT_BRIGHT_INC:
-            ret = send_nec_key(KEY_BRIGHT_INC);
+            // 已经最亮时照样发送, 顺便纠正影子比夜灯亮的偏差
+            ret = send_key(profile->keys[IR_KEY_BRIGHT_INC]);
+            if (shadow.brightness < profile->max_brightness)
+                shadow.brightness++;
             break;
         case LIGHT_BRIGHT_DEC:
-            ret = send_nec_key(KEY_BRIGHT_DEC);
+            ret = send_key(profile->keys[IR_KEY_BRIGHT_DEC]);
+            if (shadow.brightness > 0)
+                shadow.brightness--;
             break;
         case LIGHT_BRIGHT_MAX:
-            ret = send_nec_key_repeat(KEY_BRIGHT_INC, MAX_BRIGHTNESS);
+            ret = ir_set_brightness(profile->max_brightness);
             break;
         case LIGHT_BRIGHT_MID:
-            ret = send_nec_key_repeat(KEY_BRIGHT_DEC, MAX_BRIGHTNESS)
-                | send_nec_key_repeat(KEY_BRIGHT_INC, MID_BRIGHTNESS);
+            ret = ir_set_brightness(profile->mid_brightness);
             break;
         case LIGHT_BRIGHT_MIN:
-            ret = send_nec_key_repeat(KEY_BRIGHT_DEC, MAX_BRIGHTNESS);
+            ret = ir_set_brightness(0);
             break;
         case LIGHT_SWITCH_COLOR:
-            ret = send_nec_key(KEY_COLORS[current_color]);
-            if (++current_color >= ARRAY_LENGTH(KEY_COLORS))
-                current_color = 0;
+            ret = ir_set_color(shadow.mode == MODE_NORMAL ? (shadow.color + 1) % profile->color_count : shadow.color,
+                MODE_NORMAL);
             break;
         case LIGHT_COLOR_WHITE:
-            ret = send_nec_key(KEY_COLORS[0]);
+            ret = ir_set_color(profile->white, MODE_NORMAL);
             break;
         case LIGHT_COLOR_COOL:
-            ret = send_nec_key(KEY_COLORS[8]);
+            ret = ir_set_color(profile->cool, MODE_NORMAL);
             break;
         case LIGHT_COLOR_WARM:
-            ret = send_nec_key(KEY_COLORS[4]);
+            ret = ir_set_color(profile->warm, MODE_NORMAL);
             break;
         case LIGHT_MODE_FLASH:
-            ret = send_nec_key(KEY_MODE_FLASH);
+            ret = ir_set_color(shadow.color, MODE_FLASH);
             break;
         case LIGHT_MODE_BREATH:
-            ret = send_nec_key(KEY_MODE_BREATH);
+            ret = ir_set_color(shadow.color, MODE_BREATH);
             break;
         case LIGHT_MODE_RAINBOW:
-            ret = send_nec_key(KEY_MODE_RAINBOW);
+            ret = ir_set_color(shadow.color, MODE_RAINBOW);
+            break;
+        default:
+            ret = RETURN_ERR;
             break;
     }
+    nv_store_write(NVDATA_ID_LIGHT, &shadow, sizeof(shadow));
     return ret;
 }
 
+int light_ir_control(LightCommand cmd)
+{
+    if (learn_armed != 0)
+    {
+        bool learn = xTaskGetTickCount() - learn_armed < pdMS_TO_TICKS(LEARN_ARM_MS);
+        learn_armed = 0;
+        if (learn)
+        {
+            // 学习时接收和发送共用驱动, 交给发送任务
+            xSemaphoreTake(tx_lock, portMAX_DELAY);
+            learn_request = cmd;
+            xSemaphoreGive(tx_lock);
+            xTaskNotifyGive(tx_task);
+            return RETURN_OK;
+        }
+    }
+    // 发送一串红外码要几百毫秒, 交给发送任务, 不阻塞消息处理
+    return ir_queue_command(cmd);
+}
+
+int light_ir_learn(void)
+{
+    if (tx_task == NULL)
+    {
+        return RETURN_ERR;
+    }
+    // 避免tick计数正好为0
+    learn_armed = xTaskGetTickCount() | 1;
+    return RETURN_OK;
+}
+
+int light_ir_cue(bool wakeup)
+{
+    // 红外夜灯每次提示都要发送整帧遥控码, 代价太高, 不做处理
+    return RETURN_OK;
+}
+
+LIGHT_BACKEND_DEFINE(ir);
+
 #endif
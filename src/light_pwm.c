@@ -1,42 +1,860 @@
-#include "light.h"
+#include "light_backend.h"
 
-#if LIGHT_TYPE == LIGHT_PWM
+#if LIGHT_PWM_ENABLE
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include "ci112x_scu.h"
 #include "ci112x_gpio.h"
 #include "ci112x_pwm.h"
+#include "ci112x_system.h"
+#include "ci112x_core_eclic.h"
+#include "ci112x_core_misc.h"
+#include "ci_nvdata_manage.h"
+#include "ci_log.h"
+#include "user_config.h"
+#include "nv_store.h"
+#include "crc16.h"
+#include "hw_timer.h"
+#include "pwm_phase.h"
+#if CONFIG_CLI_EN
+#include <stdio.h>
+#include "FreeRTOS_CLI.h"
+#endif
 //#include "color_light_control.h" // 启英泰伦自带的RGB彩灯驱动
 //#include "led_light_control.h" // 启英泰伦自带的PWM夜灯及眨眼灯驱动
 
-int light_init(void)
+#define NVDATA_ID_LIGHT NVDATA_ID_USER_START
+// 为1时用两路PWM分别驱动暖白和冷白两串灯珠, 可以调色温, 为0时只用暖白一路驱动单色灯
+#define PWM_LAMP_CCT 0
+#define PWM_LAMP_WARM HAL_PWM5_BASE
+#define PWM_LAMP_WARM_PAD PWM5_PAD
+#define PWM_LAMP_COOL HAL_PWM4_BASE
+#define PWM_LAMP_COOL_PAD PWM4_PAD
+#if PWM_LAMP_CCT && (LIGHT_IR_ENABLE || AIRCON_ENABLE)
+#error "PWM_LAMP_CCT cool white uses PWM4 pad, which is the IR receive pin!"
+#endif
+#if PWM_LAMP_CCT
+#define PWM_CHANNELS 2
+#else
+#define PWM_CHANNELS 1
+#endif
+#define PWM_FREQ 25000
+#define PWM_DUTY_MAX 100
+// 占空比只有PWM_DUTY_MAX级, 低亮度时gamma校正后能用的没几级
+// 抖动中断用一阶sigma-delta在相邻两级占空比之间交替, 平均出小数位, 为0时不抖动
+#define PWM_DITHER_BITS 8
+// 抖动中断的频率, 每次中断选出的占空比持续PWM_FREQ / PWM_DITHER_HZ个PWM周期
+#define PWM_DITHER_HZ 5000
+// 小数越接近0或1, 进位(或不进位)的间隔越长, 1/256时要256次中断才进位一次, 只有19.5Hz, 看得出闪烁
+// 这样的小数取整到0、1或者进位频率不低于这个值的最小小数
+#define PWM_DITHER_MIN_HZ 100
+#if (PWM_DUTY_MAX << PWM_DITHER_BITS) > 65536
+#error "PWM dither resolution exceeds the 16-bit linear intensity"
+#endif
+#define DITHER_ONE (1 << PWM_DITHER_BITS)
+#define DITHER_MASK (DITHER_ONE - 1)
+#define DITHER_FRAC_MIN ((DITHER_ONE * PWM_DITHER_MIN_HZ + PWM_DITHER_HZ - 1) / PWM_DITHER_HZ)
+#if PWM_DITHER_BITS > 0 && DITHER_FRAC_MIN * 2 > DITHER_ONE
+#error "PWM_DITHER_MIN_HZ is too high for PWM_DITHER_HZ"
+#endif
+#define MAX_BRIGHTNESS 8
+// 渐变引擎在复用定时器中断里更新占空比的间隔
+#define FADE_TICK_US 5000
+#define FADE_TICK_MS (FADE_TICK_US / 1000)
+// 开关灯和调亮度的渐变时间
+#define FADE_MS 300
+// 呼吸一个来回的时间, 最暗到最亮的1/8
+#define BREATH_MS 3000
+#define BREATH_LOW_DIV 8
+// 单色灯没有彩虹, 用更慢更深的呼吸代替
+#define SLOW_BREATH_MS 8000
+#define SLOW_BREATH_LOW_DIV 32
+// 闪光时亮灭各持续这么久
+#define FLASH_MS 500
+#define CUE_TIME_MS 150
+
+// 色温档数, 从最暖到最冷, 改档数时同时修改cct_table
+#define CCT_STEPS 5
+// 暖白和冷白两串灯珠在100%占空比时的光通量, 按实测标定, 只有比例有意义
+#define CCT_WARM_FLUX 85.0
+#define CCT_COOL_FLUX 100.0
+// 两路占空比之和的上限(%), 限制总电流和发热
+#define CCT_DUTY_CAP 100.0
+// 换色温时相邻两档之间的渐变时间
+#define CCT_FADE_MS FADE_MS
+
+// 亮度都是感知亮度(CIE明度)的8.8定点数, 输出时才按gamma_table换算成占空比
+#define LEVEL_MAX 0xFFFF
+#define LEVEL(brightness) ((uint32_t) (brightness) * LEVEL_MAX / MAX_BRIGHTNESS)
+
+typedef enum {
+    MODE_OFF,     // 关闭
+    MODE_NORMAL,  // 常亮
+    MODE_FLASH,   // 闪光模式
+    MODE_BREATH,  // 呼吸模式
+    MODE_RAINBOW, // 彩虹模式
+    MODE_COUNT    // 模式数量
+} LightMode;
+
+typedef enum {
+    FADE_TO,     // 渐变到target后停下
+    FADE_BREATH, // 在low和target之间来回渐变
+    FADE_FLASH,  // 在0和target之间跳变
+} FadeEffect;
+
+typedef struct
+{
+    bool power;
+    LightMode mode;
+    uint8_t brightness;
+    uint8_t cct; // 色温档, 0最暖
+} LightConfig;
+
+/**
+ * 渐变引擎的状态, 由定时器中断逐步更新
+ * 任务中修改前先取消定时, 单核上取消后中断不会再访问, 改完再启动
+ */
+typedef struct
+{
+    uint16_t level;  // 当前亮度
+    uint16_t target; // 目标亮度, 呼吸和闪光时为最亮
+    uint16_t low;    // 呼吸时的最暗
+    uint16_t step;   // 每个tick的变化量
+    uint16_t hold;   // 保持当前亮度不变的tick数, 用于闪光和唤醒提示
+    uint8_t effect;  // FadeEffect
+    bool rising;     // 呼吸时是否在变亮
+    uint16_t mix;        // 当前色温, cct_table下标的8.8定点数, 换色温时在相邻两档之间插值
+    uint16_t mix_target; // 目标色温
+} PwmFade;
+
+// CIE 1931明度L*(0~100)对应的相对亮度Y(0~1)
+#define CIE_Y(l) ((l) <= 8.0 ? (l) / 903.3 : ((l) + 16.0) / 116.0 * (((l) + 16.0) / 116.0) * (((l) + 16.0) / 116.0))
+#define GAMMA(i) (uint16_t) (CIE_Y((i) * 100.0 / 256) * 65535 + 0.5)
+#define GAMMA4(i) GAMMA(i), GAMMA((i) + 1), GAMMA((i) + 2), GAMMA((i) + 3)
+#define GAMMA16(i) GAMMA4(i), GAMMA4((i) + 4), GAMMA4((i) + 8), GAMMA4((i) + 12)
+#define GAMMA64(i) GAMMA16(i), GAMMA16((i) + 16), GAMMA16((i) + 32), GAMMA16((i) + 48)
+
+// 感知亮度的高8位到16位线性亮度, 编译时算好, 多一项用于插值到最亮
+static const uint16_t gamma_table[257] =
 {
-    // 以下给出PWM5的初始化示例, 请自行按照需求实现PWM初始化
+    GAMMA64(0), GAMMA64(64), GAMMA64(128), GAMMA64(192), 65535
+};
+
+#if PWM_LAMP_CCT
+#define CCT_MIN(a, b) ((a) < (b) ? (a) : (b))
+// 所有色温都以这个光通量为最亮, 换色温时亮度不变
+// 光通量对两路占空比是线性的, 单路不超过100%和两路之和不超过上限的约束都在两端最紧, 两端满足中间也满足
+#define CCT_FLUX_MAX (CCT_MIN(CCT_WARM_FLUX, CCT_COOL_FLUX) * CCT_MIN(1.0, CCT_DUTY_CAP / 100.0))
+// 第i档色温中冷白提供的光通量比例
+#define CCT_SHARE(i) ((double) (i) / (CCT_STEPS - 1))
+#define CCT_GAIN(flux, share) (uint16_t) (CCT_FLUX_MAX * (share) / (flux) * 65535 + 0.5)
+#define CCT_ROW(i) { CCT_GAIN(CCT_WARM_FLUX, 1 - CCT_SHARE(i)), CCT_GAIN(CCT_COOL_FLUX, CCT_SHARE(i)) }
+
+// 每档色温下暖白和冷白的增益, 编译时算好, 线性亮度乘以增益就是这一路的占空比
+static const uint16_t cct_table[CCT_STEPS][PWM_CHANNELS] =
+{
+    CCT_ROW(0), CCT_ROW(1), CCT_ROW(2), CCT_ROW(3), CCT_ROW(4)
+};
+#endif
+
+static const struct
+{
+    pwm_base_t base;
+    PinPad_Name pad;
+} channels[PWM_CHANNELS] =
+{
+    { PWM_LAMP_WARM, PWM_LAMP_WARM_PAD },
+#if PWM_LAMP_CCT
+    { PWM_LAMP_COOL, PWM_LAMP_COOL_PAD },
+#endif
+};
+
+static LightConfig config;
+// 放在不初始化的RAM里, 异常复位后内容还在, 用于在读取nvdata之前恢复灯光
+static struct
+{
+    LightConfig config;
+    uint16_t crc;
+} rescue __attribute__((section(".no_init")));
+static bool rescued = false;
+static uint32_t rescue_cycle = 0; // 提前恢复输出灯光时的mcycle
+static bool ready = false;
+
+static PwmFade fade;
+static hw_timer_event_t fade_event;
+static uint32_t duty_now[PWM_CHANNELS];
+
+// 带小数位的占空比, 高位是整数级, 低PWM_DITHER_BITS位是小数, 一个字保证两个中断之间读写完整
+static volatile uint32_t dither_duty[PWM_CHANNELS];
+static uint32_t dither_acc[PWM_CHANNELS];
+// 占空比有小数, 需要抖动的通道, 为0时停掉抖动中断
+static uint32_t dither_mask = 0;
+static timer_base_t dither_timer;
+static bool dither_ready = false;
+static bool dither_running = false;
+static light_pwm_dither_stats_t dither_stats;
+#if PWM_CHANNELS > 1
+// 当前相位是按哪几档色温排的, 色温渐变期间是渐变经过的范围, 渐变结束后是目标那一档
+static uint8_t phased_from = 0xFF;
+static uint8_t phased_to = 0xFF;
+
+static void pwm_rephase(void);
+#endif
+
+static void pwm_write_duty(int ch, uint32_t duty)
+{
+    if (duty != duty_now[ch])
+    {
+        duty_now[ch] = duty;
+        pwm_set_duty(channels[ch].base, duty, PWM_DUTY_MAX);
+    }
+}
+
+/**
+ * @brief 抖动中断, 累加小数位, 进位时这一段输出高一级的占空比
+ */
+static void dither_timer_handler(void)
+{
+    uint32_t start = read_csr(mcycle);
+    uint32_t cycles;
+
+    timer_clear_irq(dither_timer);
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        uint32_t duty = dither_duty[ch];
+        dither_acc[ch] += duty & DITHER_MASK;
+        pwm_write_duty(ch, (duty >> PWM_DITHER_BITS) + (dither_acc[ch] >> PWM_DITHER_BITS));
+        dither_acc[ch] &= DITHER_MASK;
+    }
+
+    cycles = read_csr(mcycle) - start;
+    dither_stats.isr_count++;
+    dither_stats.isr_cycles_total += cycles;
+    if (cycles > dither_stats.isr_cycles_max)
+    {
+        dither_stats.isr_cycles_max = cycles;
+    }
+}
+
+/**
+ * @brief 分配抖动用的定时器, 分配不到时只是不抖动
+ */
+static void dither_init(void)
+{
+    timer_init_t init;
+
+    dither_stats.resolution_bits = 31 - __builtin_clz(PWM_DUTY_MAX);
+    if (PWM_DITHER_BITS == 0 || dither_ready || hw_timer_alloc("pwm_dither", &dither_timer) != RETURN_OK)
+    {
+        return;
+    }
+    __eclic_irq_set_vector(hw_timer_irq(dither_timer), (int) dither_timer_handler);
+    eclic_irq_enable(hw_timer_irq(dither_timer));
+    Scu_SetDeviceGate(dither_timer, ENABLE);
+    init.mode = timer_count_mode_auto;
+    init.div = timer_clk_div_0;
+    init.width = timer_iqr_width_f;
+    init.count = get_apb_clk() / PWM_DITHER_HZ;
+    timer_init(dither_timer, init);
+    timer_stop(dither_timer);
+    dither_stats.resolution_bits = 31 - __builtin_clz(PWM_DUTY_MAX << PWM_DITHER_BITS);
+    dither_ready = true;
+}
+
+/**
+ * @brief 把太接近0或1的小数取整到最近的0、1或DITHER_FRAC_MIN, 保证进位频率不低于PWM_DITHER_MIN_HZ
+ */
+static uint32_t dither_round(uint32_t duty)
+{
+    uint32_t frac = duty & DITHER_MASK;
+    uint32_t whole = duty - frac;
+
+    if (frac < DITHER_FRAC_MIN)
+    {
+        return frac * 2 < DITHER_FRAC_MIN ? whole : whole + DITHER_FRAC_MIN;
+    }
+    if (DITHER_ONE - frac < DITHER_FRAC_MIN)
+    {
+        return (DITHER_ONE - frac) * 2 < DITHER_FRAC_MIN ? whole + DITHER_ONE : whole + DITHER_ONE - DITHER_FRAC_MIN;
+    }
+    return duty;
+}
+
+/**
+ * @brief 把一路的线性亮度换算成占空比并输出
+ *      - 占空比没有小数时直接输出, 不需要抖动
+ */
+static void pwm_output_channel(int ch, uint32_t linear)
+{
+    uint32_t scale = dither_ready ? PWM_DUTY_MAX << PWM_DITHER_BITS : PWM_DUTY_MAX;
+    uint32_t duty = (linear * scale + 0x7FFF) / 0xFFFF;
+
+    if (!dither_ready)
+    {
+        pwm_write_duty(ch, duty);
+        return;
+    }
+    duty = dither_round(duty);
+    dither_duty[ch] = duty;
+    if ((duty & DITHER_MASK) == 0)
+    {
+        dither_mask &= ~(1 << ch);
+        pwm_write_duty(ch, duty >> PWM_DITHER_BITS);
+    }
+    else
+    {
+        dither_mask |= 1 << ch;
+    }
+}
+
+/**
+ * @brief 感知亮度按当前色温换算成各路占空比并输出
+ *      - 所有通道的占空比都没有小数时停掉抖动中断, 常亮在整数级上时没有中断开销
+ */
+static void pwm_output(uint16_t level)
+{
+    uint32_t index = level >> 8;
+    uint32_t frac = level & 0xFF;
+    // 除以255而不是移位, 保证LEVEL_MAX正好是最亮
+    uint32_t linear = gamma_table[index] + (uint32_t) (gamma_table[index + 1] - gamma_table[index]) * frac / 0xFF;
+
+#if PWM_LAMP_CCT
+    // 在相邻两档色温之间线性插值, 光通量和占空比之和仍然满足两档各自的约束
+    index = fade.mix >> 8;
+    frac = fade.mix & 0xFF;
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        uint32_t gain = cct_table[index][ch];
+        if (frac != 0)
+        {
+            gain = (gain * (0x100 - frac) + cct_table[index + 1][ch] * frac) >> 8;
+        }
+        pwm_output_channel(ch, linear * gain / 0xFFFF);
+    }
+#else
+    pwm_output_channel(0, linear);
+#endif
+    if (!dither_ready)
+    {
+        return;
+    }
+    if (dither_mask == 0)
+    {
+        if (dither_running)
+        {
+            timer_stop(dither_timer);
+            dither_running = false;
+        }
+    }
+    else if (!dither_running)
+    {
+        // APB时钟可能在功耗模式切换后变了, 每次启动重新装载
+        timer_set_count(dither_timer, get_apb_clk() / PWM_DITHER_HZ);
+        timer_start(dither_timer);
+        dither_running = true;
+    }
+}
+
+/**
+ * @brief 把level向to移动一个step
+ *
+ * @return true 已经到达to
+ */
+static bool fade_approach(uint16_t to)
+{
+    if (fade.level < to)
+    {
+        fade.level = to - fade.level > fade.step ? fade.level + fade.step : to;
+    }
+    else if (fade.level > to)
+    {
+        fade.level = fade.level - to > fade.step ? fade.level - fade.step : to;
+    }
+    return fade.level == to;
+}
+
+/**
+ * @brief 渐变引擎的一步, 在复用定时器中断中执行, 没有要做的事时不再启动定时
+ */
+static void fade_tick(void *arg)
+{
+    bool running = true;
+    bool mixing = false;
+
+#if PWM_LAMP_CCT
+    if (fade.mix != fade.mix_target)
+    {
+        uint16_t step = (0x100 + CCT_FADE_MS / FADE_TICK_MS - 1) / (CCT_FADE_MS / FADE_TICK_MS);
+        if (fade.mix < fade.mix_target)
+        {
+            fade.mix = fade.mix_target - fade.mix > step ? fade.mix + step : fade.mix_target;
+        }
+        else
+        {
+            fade.mix = fade.mix - fade.mix_target > step ? fade.mix - step : fade.mix_target;
+        }
+        mixing = true;
+        if (fade.mix == fade.mix_target)
+        {
+            // 渐变途中是按经过的各档排的, 到达后按目标这一档重排, 否则两路可能一直重叠
+            pwm_rephase();
+        }
+    }
+#endif
+    if (fade.hold > 0)
+    {
+        fade.hold--;
+    }
+    else
+    {
+        switch (fade.effect)
+        {
+            case FADE_TO:
+                running = !fade_approach(fade.target);
+                break;
+            case FADE_BREATH:
+                if (fade_approach(fade.rising ? fade.target : fade.low))
+                {
+                    fade.rising = !fade.rising;
+                }
+                break;
+            case FADE_FLASH:
+                fade.level = fade.level == fade.target ? 0 : fade.target;
+                fade.hold = FLASH_MS / FADE_TICK_MS - 1;
+                break;
+        }
+    }
+    pwm_output(fade.level);
+    if (running || mixing)
+    {
+        hw_timer_mux_start(&fade_event, FADE_TICK_US, fade_tick, NULL);
+    }
+}
+
+/**
+ * @brief 计算在ms内走完distance的步长
+ */
+static uint16_t fade_step(uint32_t distance, uint32_t ms)
+{
+    uint32_t ticks = ms / FADE_TICK_MS;
+    uint32_t step = (distance + ticks - 1) / ticks;
+    return step > 0 ? step : 1;
+}
+
+/**
+ * @brief 按当前灯光设置重新开始渐变, 当前亮度作为起点
+ */
+static void fade_start(void)
+{
+    uint16_t target = LEVEL(config.brightness);
+
+    hw_timer_mux_cancel(&fade_event);
+    fade.hold = 0;
+    fade.mix_target = config.cct << 8;
+    if (!config.power || config.mode == MODE_NORMAL)
+    {
+        fade.effect = FADE_TO;
+        fade.target = config.power ? target : 0;
+        fade.step = fade_step(fade.level > fade.target ? fade.level - fade.target : fade.target - fade.level, FADE_MS);
+    }
+    else if (config.mode == MODE_FLASH)
+    {
+        fade.effect = FADE_FLASH;
+        fade.target = target;
+    }
+    else
+    {
+        uint32_t ms = config.mode == MODE_BREATH ? BREATH_MS : SLOW_BREATH_MS;
+        fade.effect = FADE_BREATH;
+        fade.target = target;
+        fade.low = target / (config.mode == MODE_BREATH ? BREATH_LOW_DIV : SLOW_BREATH_LOW_DIV);
+        fade.step = fade_step(fade.target - fade.low, ms / 2);
+        fade.rising = fade.level < fade.target;
+    }
+    hw_timer_mux_start(&fade_event, FADE_TICK_US, fade_tick, NULL);
+}
+
+static void pwm_hw_init(void)
+{
+    // 暖白在PWM5, 冷白在PWM4, 请按照电路修改
     Scu_SetDeviceGate(HAL_GPIO1_BASE, ENABLE);
-    Scu_SetIOReuse(PWM5_PAD, SECOND_FUNCTION);
-    Scu_SetDeviceGate(HAL_PWM5_BASE, ENABLE);
-    pwm_init_t pwm_config;
-    pwm_config.clk_sel = 0;
-    pwm_config.freq = 25000;
-    pwm_config.duty = 0;
-    pwm_config.duty_max = 100;
-    pwm_init((pwm_base_t) HAL_PWM5_BASE, pwm_config);
-    pwm_start((pwm_base_t) HAL_PWM5_BASE);
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        Scu_SetIOReuse(channels[ch].pad, SECOND_FUNCTION);
+        Scu_SetDeviceGate(channels[ch].base, ENABLE);
+        pwm_init_t pwm_config;
+        pwm_config.clk_sel = 0;
+        pwm_config.freq = PWM_FREQ;
+        pwm_config.duty = 0;
+        pwm_config.duty_max = PWM_DUTY_MAX;
+        pwm_init(channels[ch].base, pwm_config);
+        pwm_start(channels[ch].base);
+        duty_now[ch] = 0;
+    }
+}
+
+#if PWM_CHANNELS > 1
+/**
+ * @brief 按色温错开各路的导通时间
+ *      - 所有通道同时在周期起点导通时, 电源电流在每个周期开头同步跳变, 会从供电串进麦克风的录音通路
+ *      - 各路的计数器在pwm_start时从周期起点开始, 按pwm_phase_plan排出的时刻依次启动就错开了相位
+ *      - 色温不变时按这一档各路的最大占空比排, 同一档两路占空比之和有CCT_DUTY_CAP限制, 任何亮度下都不会同时导通
+ *      - 色温渐变途中在经过的各档之间插值, 每路取这些档中最大的占空比来排, 各档的最大值之和可能超过周期,
+ *        这时渐变期间两路会有短暂的重叠, 渐变结束后fade_tick再按目标这一档重排
+ *      - 重启时各路会少亮不到一个周期, 所以只在要排的色温范围改变时重排
+ *      - 会在渐变引擎的中断中调用, 关中断期间读渐变状态, 和任务中的调用互斥
+ */
+static void pwm_rephase(void)
+{
+    uint32_t duty[PWM_CHANNELS], offset[PWM_CHANNELS];
+    uint32_t period = get_ipcore_clk() / PWM_FREQ;
+    uint32_t started = 0;
+    uint32_t mstatus, start;
+    uint32_t from, to;
+
+    mstatus = read_csr(mstatus);
+    clear_csr(mstatus, MSTATUS_MIE);
+    from = fade.mix >> 8;
+    to = (fade.mix + 0xFF) >> 8;
+    from = from < (fade.mix_target >> 8) ? from : (fade.mix_target >> 8);
+    to = to > (fade.mix_target >> 8) ? to : (fade.mix_target >> 8);
+    if (from == phased_from && to == phased_to)
+    {
+        if (mstatus & MSTATUS_MIE)
+        {
+            set_csr(mstatus, MSTATUS_MIE);
+        }
+        return;
+    }
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        duty[ch] = 0;
+        for (uint32_t i = from; i <= to; i++)
+        {
+            duty[ch] = cct_table[i][ch] > duty[ch] ? cct_table[i][ch] : duty[ch];
+        }
+    }
+    pwm_phase_plan(duty, PWM_CHANNELS, 0x10000, offset);
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        // 换算成CPU周期, 用mcycle计时
+        offset[ch] = (uint64_t) offset[ch] * period >> 16;
+    }
+
+    // 仍然关着中断, 保证各路的启动间隔准确
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        pwm_stop(channels[ch].base);
+    }
+    start = read_csr(mcycle);
+    for (int n = 0; n < PWM_CHANNELS; n++)
+    {
+        int next = -1;
+        for (int ch = 0; ch < PWM_CHANNELS; ch++)
+        {
+            if (!(started & (1 << ch)) && (next < 0 || offset[ch] < offset[next]))
+            {
+                next = ch;
+            }
+        }
+        while (read_csr(mcycle) - start < offset[next])
+        {
+        }
+        pwm_start(channels[next].base);
+        started |= 1 << next;
+    }
+    if (mstatus & MSTATUS_MIE)
+    {
+        set_csr(mstatus, MSTATUS_MIE);
+    }
+    phased_from = from;
+    phased_to = to;
+}
+#endif
+
+static int pwm_update(LightMode new_mode)
+{
+    if (new_mode == MODE_OFF)
+    {
+        config.power = false;
+    }
+    else
+    {
+        config.power = true;
+        config.mode = new_mode;
+    }
+    fade_start();
+#if PWM_CHANNELS > 1
+    pwm_rephase();
+#endif
+    light_pwm_snapshot();
+    nv_store_write(NVDATA_ID_LIGHT, &config, sizeof(config));
+    return RETURN_OK;
+}
+
+void light_pwm_clock_update(void)
+{
+    // 自动重装的定时器按旧时钟的计数值走, 正在抖动时按新时钟重新装载
+    if (dither_running)
+    {
+        timer_stop(dither_timer);
+        timer_set_count(dither_timer, get_apb_clk() / PWM_DITHER_HZ);
+        timer_start(dither_timer);
+    }
+}
+
+void light_pwm_get_dither_stats(light_pwm_dither_stats_t *stats)
+{
+    uint32_t mhz = get_ipcore_clk() / 1000000;
+
+    *stats = dither_stats;
+    // 平均每次中断的周期数乘以中断频率, 是抖动运行时每秒占用的CPU周期
+    if (stats->isr_count > 0 && mhz > 0)
+    {
+        stats->load_ppm = stats->isr_cycles_total / stats->isr_count * PWM_DITHER_HZ / mhz;
+    }
+}
+
+#if CONFIG_CLI_EN
+/**
+ * @brief 命令行: pwm_dither 打印抖动的有效分辨率和中断开销
+ */
+static BaseType_t dither_command_handler(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    light_pwm_dither_stats_t stats;
+
+    light_pwm_get_dither_stats(&stats);
+    snprintf(pcWriteBuffer, xWriteBufferLen, "%d bits, %s, isr %u times, max %u cycles, load %u ppm\r\n",
+            stats.resolution_bits, dither_running ? "dithering" : "idle",
+            (unsigned int) stats.isr_count, (unsigned int) stats.isr_cycles_max, (unsigned int) stats.load_ppm);
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t dither_command =
+{
+    "pwm_dither",
+    "\r\npwm_dither:\r\n Show PWM light dither resolution and ISR load\r\n",
+    dither_command_handler,
+    0
+};
+#endif
+
+int light_pwm_init(void)
+{
+    // 从nvdata里读取灯效设置, 没有保存过则使用默认设置
+    config.power = true;
+    config.mode = MODE_NORMAL;
+    config.brightness = MAX_BRIGHTNESS / 2;
+    config.cct = CCT_STEPS / 2;
+    nv_store_load(NVDATA_ID_LIGHT, &config, sizeof(config));
+    if (config.cct >= CCT_STEPS)
+    {
+        config.cct = CCT_STEPS / 2;
+    }
+    if (rescued)
+    {
+        // nvdata是延迟写入的, 可能比复位前的状态旧, 以复位前的状态为准
+        config = rescue.config;
+        // 从提前恢复到这里的时间就是少黑的时间, 启动过程远短于mcycle回绕的时间
+        ci_loginfo(LOG_USER, "light restored %d ms before light_init\n",
+                (read_csr(mcycle) - rescue_cycle) / (get_ipcore_clk() / 1000));
+    }
+    else
+    {
+        pwm_hw_init();
+        fade.level = 0;
+        fade.mix = config.cct << 8;
+    }
+    if (hw_timer_mux_init() != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    dither_init();
+    ci_loginfo(LOG_USER, "pwm light: %d bits resolution\n", dither_stats.resolution_bits);
+#if CONFIG_CLI_EN
+    FreeRTOS_CLIRegisterCommand(&dither_command);
+#endif
+    ready = true;
+    // 正常上电时从黑渐亮, 提前恢复过的从恢复的亮度继续
+    return pwm_update(config.power ? config.mode : MODE_OFF);
+}
+
+void light_pwm_snapshot(void)
+{
+    // 还没有读取灯光设置, 不能覆盖复位前保存的状态
+    if (!ready && !rescued)
+    {
+        return;
+    }
+    rescue.config = config;
+    rescue.crc = crc16_ccitt(CRC16_INIT, &rescue.config, sizeof(rescue.config));
+}
+
+int light_pwm_early_restore(void)
+{
+    // 正常上电时RAM里是随机数据, 只在异常复位后恢复
+    if (Scu_GetSysResetState() == RETURN_OK
+        || rescue.crc != crc16_ccitt(CRC16_INIT, &rescue.config, sizeof(rescue.config))
+        || rescue.config.brightness > MAX_BRIGHTNESS
+        || rescue.config.cct >= CCT_STEPS)
+    {
+        return RETURN_ERR;
+    }
+    config = rescue.config;
+    pwm_hw_init();
+    // 动画模式先以目标亮度常亮, 等light_init启动渐变引擎后再继续动画
+    fade.level = config.power ? LEVEL(config.brightness) : 0;
+    fade.mix = fade.mix_target = config.cct << 8;
+#if PWM_CHANNELS > 1
+    pwm_rephase();
+#endif
+    pwm_output(fade.level);
+    rescue_cycle = read_csr(mcycle);
+    rescued = true;
     return RETURN_OK;
 }
 
-int light_deinit(void)
+int light_pwm_deinit(void)
 {
-    // Nothing to do
+    hw_timer_mux_cancel(&fade_event);
+    if (dither_running)
+    {
+        timer_stop(dither_timer);
+        dither_running = false;
+    }
+    for (int ch = 0; ch < PWM_CHANNELS; ch++)
+    {
+        pwm_stop(channels[ch].base);
+    }
+    ready = false;
     return RETURN_OK;
 }
 
-int light_control(LightCommand cmd)
+int light_pwm_control(LightCommand cmd)
 {
-    // 请自行实现灯光命令回调
-    return RETURN_ERR;
+    int ret = RETURN_ERR;
+    if (!ready)
+    {
+        return RETURN_ERR;
+    }
+    switch (cmd)
+    {
+        case LIGHT_POWER_ON:
+            ret = pwm_update(config.mode);
+            break;
+        case LIGHT_POWER_OFF:
+            ret = pwm_update(MODE_OFF);
+            break;
+        case LIGHT_BRIGHT_INC:
+            if (config.brightness < MAX_BRIGHTNESS)
+                config.brightness++;
+            ret = pwm_update(config.mode);
+            break;
+        case LIGHT_BRIGHT_DEC:
+            if (config.brightness > 1)
+                config.brightness--;
+            ret = pwm_update(config.mode);
+            break;
+        case LIGHT_BRIGHT_MAX:
+            config.brightness = MAX_BRIGHTNESS;
+            ret = pwm_update(config.mode);
+            break;
+        case LIGHT_BRIGHT_MID:
+            config.brightness = MAX_BRIGHTNESS / 2;
+            ret = pwm_update(config.mode);
+            break;
+        case LIGHT_BRIGHT_MIN:
+            config.brightness = 1;
+            ret = pwm_update(config.mode);
+            break;
+#if PWM_LAMP_CCT
+        case LIGHT_SWITCH_COLOR:
+            config.cct = (config.cct + 1) % CCT_STEPS;
+            ret = pwm_update(MODE_NORMAL);
+            break;
+        case LIGHT_COLOR_WHITE:
+            config.cct = CCT_STEPS / 2;
+            ret = pwm_update(MODE_NORMAL);
+            break;
+        case LIGHT_COLOR_COOL:
+            config.cct = CCT_STEPS - 1;
+            ret = pwm_update(MODE_NORMAL);
+            break;
+        case LIGHT_COLOR_WARM:
+            config.cct = 0;
+            ret = pwm_update(MODE_NORMAL);
+            break;
+#else
+        case LIGHT_SWITCH_COLOR:
+        case LIGHT_COLOR_WHITE:
+        case LIGHT_COLOR_COOL:
+        case LIGHT_COLOR_WARM:
+            // 单色灯不能换颜色, 和彩灯一样回到常亮
+            ret = pwm_update(MODE_NORMAL);
+            break;
+#endif
+        case LIGHT_MODE_FLASH:
+            ret = pwm_update(MODE_FLASH);
+            break;
+        case LIGHT_MODE_BREATH:
+            ret = pwm_update(MODE_BREATH);
+            break;
+        case LIGHT_MODE_RAINBOW:
+            ret = pwm_update(MODE_RAINBOW);
+            break;
+        default:
+            break;
+    }
+    return ret;
 }
 
+int light_pwm_cue(bool wakeup)
+{
+    uint8_t level;
+    if (!ready)
+    {
+        return RETURN_ERR;
+    }
+    if (!config.power)
+    {
+        // 关灯时唤醒只微微闪一下, 退出唤醒不打扰
+        if (!wakeup)
+        {
+            return RETURN_OK;
+        }
+        level = 1;
+    }
+    else if (wakeup)
+    {
+        // 在当前亮度上提亮, 已经最亮时改为变暗, 保证能看出变化
+        level = config.brightness + MAX_BRIGHTNESS / 2;
+        if (level > MAX_BRIGHTNESS)
+            level = MAX_BRIGHTNESS;
+        if (level == config.brightness)
+            level = config.brightness / 2;
+    }
+    else
+    {
+        level = config.brightness / 2;
+    }
+    if (level < 1)
+        level = 1;
+    // 直接跳到提示亮度并保持, 之后由渐变引擎从这里继续原来的灯效
+    hw_timer_mux_cancel(&fade_event);
+    fade.level = LEVEL(level);
+    fade.hold = CUE_TIME_MS / FADE_TICK_MS;
+    if (fade.effect == FADE_TO)
+    {
+        fade.step = fade_step(fade.level > fade.target ? fade.level - fade.target : fade.target - fade.level, FADE_MS);
+    }
+    pwm_output(fade.level);
+    hw_timer_mux_start(&fade_event, FADE_TICK_US, fade_tick, NULL);
+    return RETURN_OK;
+}
+
+LIGHT_BACKEND_DEFINE(pwm);
+
 #endif
@@ -1,25 +1,27 @@
-#include "light.h"
+#include "light_backend.h"
 
-#if LIGHT_TYPE == LIGHT_RGB
+#if LIGHT_RGB_ENABLE
 
 #include <stdbool.h>
 #include <stdint.h>
 #include "FreeRTOS.h"
 #include "task.h"
-//#include "semphr.h"
+#include "semphr.h"
 #include "timers.h"
 #include "ci112x_scu.h"
 #include "ci112x_core_eclic.h"
 #include "ci112x_core_misc.h"
-#include "ci112x_timer.h"
 #include "ci112x_gpio.h"
 #include "ci_nvdata_manage.h"
+#include "ci_log.h"
+#include "nv_store.h"
+#include "crc16.h"
 
 #define ARRAY_LENGTH(arr) (sizeof(arr) / sizeof(arr[0]))
-#define TIMER_US (get_apb_clk() / 1000000) // 94
 #define NVDATA_ID_LIGHT NVDATA_ID_USER_START
 #define LIGHT_COUNT 2
 #define MAX_BRIGHTNESS 8
+#define CUE_TIME_MS 150
 
 typedef enum {
     MODE_OFF,     // 关闭
@@ -30,7 +32,7 @@ typedef enum {
     MODE_COUNT    // 模式数量
 } LightMode;
 
-const uint32_t COLORS[] =
+static const uint32_t COLORS[] =
 {
         0xFF0000,
         0x00FF00,
@@ -41,18 +43,32 @@ const uint32_t COLORS[] =
         0xFFFFFF
 };
 
-//SemaphoreHandle_t timer_lock;
-TimerHandle_t rgb_timer;
-struct
+static TimerHandle_t rgb_timer;
+static TimerHandle_t cue_timer;
+typedef struct
 {
     bool power;
     LightMode mode;
     uint32_t color;
     uint8_t brightness;
-} config;
-int8_t color_index = 0;
-uint8_t tick = 0;
-uint16_t hue = 0;
+} LightConfig;
+
+static LightConfig config;
+// 放在不初始化的RAM里, 异常复位后内容还在, 用于在读取nvdata之前恢复灯光
+static struct
+{
+    LightConfig config;
+    uint16_t crc;
+} rescue __attribute__((section(".no_init")));
+static bool rescued = false;
+static uint32_t rescue_cycle = 0; // 提前恢复输出灯光时的mcycle
+static int8_t color_index = 0;
+static uint8_t tick = 0;
+static uint16_t hue = 0;
+static bool cue_active = false;
+// 保护config, 动画状态和cue_active, 同一时间只有一个任务往灯珠发数据
+// 命令在用户任务里执行, 动画和提示结束在定时器任务里执行, 唤醒提示在系统任务里执行
+static SemaphoreHandle_t rgb_lock = NULL;
 
 static void hex2rgb(uint32_t hex, uint8_t *r, uint8_t *g, uint8_t *b)
 {
@@ -132,25 +148,6 @@ static void _delay(uint16_t count)
     }
 }
 
-// 定时器用不明白
-//static void delay_ns(uint16_t ns)
-//{
-//    timer_set_count(TIMER0, ns * TIMER_US / 1000);
-//    timer_start(TIMER0);
-////    xSemaphoreTake(timer_lock, portMAX_DELAY);
-//    unsigned int count;
-//    do
-//    {
-//        timer_get_count(TIMER0, &count);
-//    }
-//    while (count > 0);
-//}
-
-//static void timer_handler(void)
-//{
-//    xSemaphoreGiveFromISR(timer_lock, NULL);
-//}
-
 static void rgb_send_byte(uint8_t byte)
 {
     for (int8_t i = 7; i >= 0; i--)
@@ -179,14 +176,16 @@ static void rgb_send(uint8_t r, uint8_t g, uint8_t b)
 // 灯太亮了刺眼睛, 限制最大亮度
 #define _MAX_BRIGHTNESS (MAX_BRIGHTNESS * 2)
 
-static void rgb_send_hex(uint32_t color)
+static void rgb_send_hex_level(uint32_t color, uint8_t brightness)
 {
-    uint8_t r = ((color & 0xFF0000) >> 16) * config.brightness / _MAX_BRIGHTNESS;
-    uint8_t g = ((color & 0x00FF00) >> 8) * config.brightness / _MAX_BRIGHTNESS;
-    uint8_t b = (color & 0x0000FF) * config.brightness / _MAX_BRIGHTNESS;
+    uint8_t r = ((color & 0xFF0000) >> 16) * brightness / _MAX_BRIGHTNESS;
+    uint8_t g = ((color & 0x00FF00) >> 8) * brightness / _MAX_BRIGHTNESS;
+    uint8_t b = (color & 0x0000FF) * brightness / _MAX_BRIGHTNESS;
     rgb_send(r, g, b);
 }
 
+#define rgb_send_hex(color) rgb_send_hex_level(color, config.brightness)
+
 static void rgb_send_hsv(uint32_t h, uint32_t s, uint32_t v)
 {
     uint8_t r, g, b;
@@ -197,6 +196,15 @@ static void rgb_send_hsv(uint32_t h, uint32_t s, uint32_t v)
 
 #define rgb_clear() rgb_send(0, 0, 0)
 
+static void rgb_gpio_init(void)
+{
+    // 初始化 GPIO1[6]
+    Scu_SetDeviceGate(HAL_GPIO1_BASE, ENABLE);
+    Scu_SetIOReuse(PWM5_PAD, FIRST_FUNCTION);
+    gpio_set_output_mode(GPIO1, gpio_pin_6);
+    gpio_set_output_level_single(GPIO1, gpio_pin_6, 0);
+}
+
 static int rgb_update(LightMode new_mode)
 {
     if (new_mode == MODE_OFF)
@@ -228,12 +236,20 @@ static int rgb_update(LightMode new_mode)
         config.power = true;
         config.mode = new_mode;
     }
-    cinv_item_write(NVDATA_ID_LIGHT, sizeof(config), &config);
+    light_rgb_snapshot();
+    nv_store_write(NVDATA_ID_LIGHT, &config, sizeof(config));
     return RETURN_OK;
 }
 
 static void rgb_timer_handler(TimerHandle_t timer)
 {
+    xSemaphoreTake(rgb_lock, portMAX_DELAY);
+    // 提示脉冲期间暂停动画, 结束后从下一帧继续
+    if (cue_active)
+    {
+        xSemaphoreGive(rgb_lock);
+        return;
+    }
     if (config.mode == MODE_FLASH)
     {
         if (++tick >= 10)
@@ -274,64 +290,127 @@ static void rgb_timer_handler(TimerHandle_t timer)
         if (hue >= 360)
             hue = 0;
     }
+    xSemaphoreGive(rgb_lock);
 }
 
-int light_init(void)
+static void cue_timer_handler(TimerHandle_t timer)
 {
-    // 从nvdata里读取灯效设置
-    uint16_t real_len;
-    if (cinv_item_read(NVDATA_ID_LIGHT, sizeof(config), &config, &real_len) != CINV_OPER_SUCCESS)
+    xSemaphoreTake(rgb_lock, portMAX_DELAY);
+    cue_active = false;
+    // 恢复提示前的灯效, 动画模式由rgb_timer在下一帧重绘
+    if (!config.power)
     {
-        config.power = true;
-        config.mode = MODE_NORMAL;
-        config.color = 0xFFFFFF;
-        config.brightness = MAX_BRIGHTNESS / 2;
-        cinv_item_init(NVDATA_ID_LIGHT, sizeof(config), &config);
+        rgb_clear();
     }
-    // 初始化 GPIO1[6]
-    Scu_SetDeviceGate(HAL_GPIO1_BASE, ENABLE);
-    Scu_SetIOReuse(PWM5_PAD, FIRST_FUNCTION);
-    gpio_set_output_mode(GPIO1, gpio_pin_6);
-    gpio_set_output_level_single(GPIO1, gpio_pin_6, 0);
-    // 初始化 TIMER0
-    Scu_SetDeviceGate(TIMER0, ENABLE);
-    Scu_Setdevice_Reset(TIMER0);
-    Scu_Setdevice_ResetRelease(TIMER0);
-//    __eclic_irq_set_vector(TIMER0_IRQn, (int32_t) timer_handler);
-//    eclic_irq_enable(TIMER0_IRQn);
-//    timer_init_t init;
-//    init.mode = timer_count_mode_single;
-//    init.div = timer_clk_div_0;
-//    init.width = timer_iqr_width_2;
-//    init.count = 0xFFFFFFFF;
-//    timer_init(TIMER0, init);
-//    timer_lock = xSemaphoreCreateCounting(1, 0);
-//    if (timer_lock == NULL)
-//    {
-//        return RETURN_ERR;
-//    }
+    else if (config.mode == MODE_NORMAL)
+    {
+        rgb_send_hex(config.color);
+    }
+    xSemaphoreGive(rgb_lock);
+}
+
+int light_rgb_init(void)
+{
+    // 从nvdata里读取灯效设置, 没有保存过则使用默认设置
+    config.power = true;
+    config.mode = MODE_NORMAL;
+    config.color = 0xFFFFFF;
+    config.brightness = MAX_BRIGHTNESS / 2;
+    nv_store_load(NVDATA_ID_LIGHT, &config, sizeof(config));
+    if (rescued)
+    {
+        // nvdata是延迟写入的, 可能比复位前的状态旧, 以复位前的状态为准
+        config = rescue.config;
+        // 没有提前恢复的话, 灯要一直黑到这里, 32位mcycle在200MHz下约21秒回绕, 足够覆盖启动过程
+        ci_loginfo(LOG_USER, "light restored %d ms before light_init\n",
+                (read_csr(mcycle) - rescue_cycle) / (get_ipcore_clk() / 1000));
+    }
+    else
+    {
+        rgb_gpio_init();
+    }
+    rgb_lock = xSemaphoreCreateMutex();
+    if (rgb_lock == NULL)
+    {
+        return RETURN_ERR;
+    }
+    // ws2812的时序用软件延时, 不占用硬件定时器, 定时器由hw_timer分配给红外等模块
     // 50毫秒刷新一次
     rgb_timer = xTimerCreate("rgb_timer", pdMS_TO_TICKS(50), pdTRUE, (void*) 1, rgb_timer_handler);
     if (rgb_timer == NULL)
     {
         return RETURN_ERR;
     }
+    // 唤醒提示脉冲结束后恢复原灯效
+    cue_timer = xTimerCreate("cue_timer", pdMS_TO_TICKS(CUE_TIME_MS), pdFALSE, (void*) 2, cue_timer_handler);
+    if (cue_timer == NULL)
+    {
+        return RETURN_ERR;
+    }
     // 更新灯光效果
-    LightMode mode = config.mode;
-    config.mode = MODE_OFF;
-    rgb_update(mode);
+    if (rescued && !config.power)
+    {
+        // 复位前是关灯状态, 保持关灯
+        rgb_update(MODE_OFF);
+    }
+    else
+    {
+        LightMode mode = config.mode;
+        config.mode = MODE_OFF;
+        rgb_update(mode);
+    }
+    return RETURN_OK;
+}
+
+void light_rgb_snapshot(void)
+{
+    // 还没有读取灯光设置, 不能覆盖复位前保存的状态
+    if (rgb_timer == NULL && !rescued)
+    {
+        return;
+    }
+    rescue.config = config;
+    rescue.crc = crc16_ccitt(CRC16_INIT, &rescue.config, sizeof(rescue.config));
+}
+
+int light_rgb_early_restore(void)
+{
+    // 正常上电时RAM里是随机数据, 只在异常复位后恢复
+    if (Scu_GetSysResetState() == RETURN_OK
+        || rescue.crc != crc16_ccitt(CRC16_INIT, &rescue.config, sizeof(rescue.config)))
+    {
+        return RETURN_ERR;
+    }
+    rgb_gpio_init();
+    config = rescue.config;
+    // 动画模式先显示底色, 等light_init创建定时器后再继续动画
+    if (config.power)
+    {
+        rgb_send_hex(config.color);
+    }
+    else
+    {
+        rgb_clear();
+    }
+    rescue_cycle = read_csr(mcycle);
+    rescued = true;
     return RETURN_OK;
 }
 
-int light_deinit(void)
+int light_rgb_deinit(void)
 {
     // Nothing to do
     return RETURN_OK;
 }
 
-int light_control(LightCommand cmd)
+int light_rgb_control(LightCommand cmd)
 {
     int ret = RETURN_ERR;
+    if (rgb_lock == NULL)
+    {
+        return RETURN_ERR;
+    }
+    xSemaphoreTake(rgb_lock, portMAX_DELAY);
     switch (cmd)
     {
         case LIGHT_POWER_ON:
@@ -394,7 +473,51 @@ int light_control(LightCommand cmd)
             ret = rgb_update(MODE_RAINBOW);
             break;
     }
+    xSemaphoreGive(rgb_lock);
     return ret;
 }
 
+int light_rgb_cue(bool wakeup)
+{
+    uint8_t level;
+    if (cue_timer == NULL)
+    {
+        return RETURN_ERR;
+    }
+    xSemaphoreTake(rgb_lock, portMAX_DELAY);
+    if (!config.power)
+    {
+        // 关灯时唤醒只微微闪一下, 退出唤醒不打扰
+        if (!wakeup)
+        {
+            xSemaphoreGive(rgb_lock);
+            return RETURN_OK;
+        }
+        level = 1;
+    }
+    else if (wakeup)
+    {
+        // 在当前亮度上提亮, 已经最亮时改为变暗, 保证能看出变化
+        level = config.brightness + MAX_BRIGHTNESS / 2;
+        if (level > MAX_BRIGHTNESS)
+            level = MAX_BRIGHTNESS;
+        if (level == config.brightness)
+            level = config.brightness / 2;
+    }
+    else
+    {
+        level = config.brightness / 2;
+    }
+    if (level < 1)
+        level = 1;
+    // 直接刷新灯珠, 不等待rgb_timer的下一帧
+    cue_active = true;
+    rgb_send_hex_level(config.power ? config.color : 0xFFFFFF, level);
+    xTimerReset(cue_timer, 0);
+    xSemaphoreGive(rgb_lock);
+    return RETURN_OK;
+}
+
+LIGHT_BACKEND_DEFINE(rgb);
+
 #endif
@@ -36,6 +36,10 @@
 #include "flash_rw_process.h"
 #include "ci_flash_data_info.h"
 #include "ci_nvdata_manage.h"
+#include "nv_store.h"
+#include "hw_timer.h"
+#include "system_hook.h"
+#include "light.h"
 #include "ci_system_info.h"
 #include "ci_debug_config.h"
 #include "ci_fft.h"
@@ -50,7 +54,11 @@ TaskHandle_t audio_in_preprocess_mode_handle;
 /**
  * @brief 系统异常复位前
  */
-void sys_reset_callback(void) {}
+void sys_reset_callback(void)
+{
+    /* 保存灯光状态，复位后在main中尽早恢复 */
+    light_snapshot();
+}
 
 /**
  * @brief 硬件初始化和平台初始化相关代码
@@ -140,6 +148,11 @@ static void vTaskVariablesInit(void)
     sys_msg_task_initial();
     /* flash控制信号初始化，这个模块用于保证系统访问flash和dnn硬件访问flash不发生冲突 */
     flash_ctl_init();
+    /* nvdata写入缓存初始化，用于合并短时间内的多次写入 */
+    if (RETURN_OK != nv_store_init())
+    {
+        CI_ASSERT(0, "nv store init failed!\n");
+    }
     /* flash固件信息解析并初始化固件信息结构，DEFAULT_MODEL_GROUP_ID为默认模型分组ID，开机后第一次运行的识别环境 */
     ci_flash_data_info_init(DEFAULT_MODEL_GROUP_ID);
     /* 配置CODEC */
@@ -183,6 +196,10 @@ static void vTaskCreate(void *p_arg)
 #if CONFIG_CLI_EN
     /* 注册示例命令 */
     vRegisterCLICommands();
+    /* 注册硬件定时器统计命令 */
+    hw_timer_register_cli();
+    /* 注册唤醒提示延迟统计命令 */
+    sys_hook_register_cli();
     /* 启动CLI */
     vUARTCommandConsoleStart(768, 1);
 #endif
@@ -209,6 +226,11 @@ int main(void)
 {
     /* 硬件平台初始化 */
     hardware_init();
+    /* 异常复位后立即恢复灯光，不等待ASR模型加载完毕 */
+    if (RETURN_OK == light_early_restore())
+    {
+        ci_loginfo(LOG_USER, "Light restored after exception reset\n");
+    }
     /* 版本信息 */
     ci_loginfo(LOG_USER, "\r\n\r\n");
     ci_loginfo(LOG_USER, "ci112x_sdk_%s_%d.%d.%d Built-in\r\n",
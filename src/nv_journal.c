@@ -0,0 +1,318 @@
+#include "nv_journal.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "ci112x_system.h"
+#include "ci_log.h"
+#include "flash_rw_process.h"
+#include "crc16.h"
+
+#define SLOT_COUNT (NV_JOURNAL_PAGE_SIZE / NV_JOURNAL_RECORD_SIZE)
+#define PAGE_ADDR(page) (NV_JOURNAL_ADDR + (page) * NV_JOURNAL_PAGE_SIZE)
+#define SLOT_ADDR(page, slot) (PAGE_ADDR(page) + (slot) * NV_JOURNAL_RECORD_SIZE)
+#define SEQ_EMPTY 0xFFFFFFFF
+
+#if NV_JOURNAL_ADDR < NV_PARTITION_ADDR + NV_PARTITION_SIZE \
+    && NV_JOURNAL_ADDR + NV_JOURNAL_PAGE_COUNT * NV_JOURNAL_PAGE_SIZE > NV_PARTITION_ADDR
+#error "nv_journal overlaps the nvdata partition!"
+#endif
+#if NV_JOURNAL_ADDR < NV_USER_FILE_END
+#error "nv_journal overlaps the user_file partition!"
+#endif
+#if NV_JOURNAL_ADDR % NV_JOURNAL_PAGE_SIZE != 0
+#error "nv_journal must start on a sector boundary!"
+#endif
+
+typedef struct
+{
+    uint32_t seq;  // 序号, 越大越新
+    uint32_t id;   // 条目id
+    uint8_t len;   // 数据长度
+    uint8_t reserved;
+    uint16_t crc;  // 除crc外整条记录的CRC16
+    uint8_t data[NV_JOURNAL_DATA_SIZE];
+} nv_journal_record_t;
+
+typedef struct
+{
+    bool used;
+    uint32_t id;
+    uint32_t seq;
+    uint32_t addr; // 最新记录在flash中的地址
+} nv_journal_index_t;
+
+static nv_journal_index_t index_table[NV_JOURNAL_ID_COUNT];
+static nv_journal_stats_t stats;
+static uint8_t active_page = 0;
+static uint32_t next_slot = 0;
+static uint32_t next_seq = 1;
+
+static uint16_t record_crc(const nv_journal_record_t *record)
+{
+    uint16_t crc = crc16_ccitt(CRC16_INIT, record, offsetof(nv_journal_record_t, crc));
+    return crc16_ccitt(crc, record->data, sizeof(record->data));
+}
+
+static bool record_empty(const nv_journal_record_t *record)
+{
+    const uint8_t *p = (const uint8_t*) record;
+    for (int i = 0; i < sizeof(nv_journal_record_t); i++)
+    {
+        if (p[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+static bool record_valid(const nv_journal_record_t *record)
+{
+    return record->seq != SEQ_EMPTY && record->len <= NV_JOURNAL_DATA_SIZE
+        && record->crc == record_crc(record);
+}
+
+static nv_journal_index_t *find_index(uint32_t id, bool create)
+{
+    nv_journal_index_t *empty = NULL;
+    for (int i = 0; i < NV_JOURNAL_ID_COUNT; i++)
+    {
+        if (index_table[i].used && index_table[i].id == id)
+        {
+            return &index_table[i];
+        }
+        if (!index_table[i].used && empty == NULL)
+        {
+            empty = &index_table[i];
+        }
+    }
+    if (create && empty != NULL)
+    {
+        empty->used = true;
+        empty->id = id;
+        empty->seq = 0;
+        empty->addr = 0;
+        return empty;
+    }
+    return NULL;
+}
+
+static int write_record(nv_journal_record_t *record, uint32_t addr)
+{
+    record->seq = next_seq++;
+    record->crc = record_crc(record);
+    if (post_write_flash((char*) record, addr, sizeof(nv_journal_record_t)) != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    stats.append_count++;
+    return RETURN_OK;
+}
+
+static void update_index(const nv_journal_record_t *record, uint32_t addr)
+{
+    nv_journal_index_t *index = find_index(record->id, true);
+    index->seq = record->seq;
+    index->addr = addr;
+}
+
+static bool on_page(const nv_journal_index_t *index, uint8_t page)
+{
+    return index->addr >= PAGE_ADDR(page) && index->addr < PAGE_ADDR(page) + NV_JOURNAL_PAGE_SIZE;
+}
+
+/**
+ * @brief 把所有条目的最新记录搬到另一个扇区, 并切换到该扇区继续追加
+ *      - 全部搬完才更新索引, 中途写入失败时索引仍指向原扇区, 下次整理擦除的是写了一半的扇区
+ *      - 搬过去的记录序号更大, 中途掉电时开机会选中新扇区, 由finish_compact把没搬完的记录补过去
+ *      - 即将追加的条目也要搬, 追加失败时它在原扇区的记录会随下次整理被擦除
+ */
+static int compact(void)
+{
+    nv_journal_record_t record;
+    uint32_t seq[NV_JOURNAL_ID_COUNT] = { 0 };
+    uint8_t page = active_page ^ 1;
+    uint32_t slot = 0;
+
+    if (post_erase_flash(PAGE_ADDR(page), NV_JOURNAL_PAGE_SIZE) != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    stats.erase_count++;
+    for (int i = 0; i < NV_JOURNAL_ID_COUNT; i++)
+    {
+        if (!index_table[i].used || index_table[i].seq == 0)
+        {
+            continue;
+        }
+        post_read_flash((char*) &record, index_table[i].addr, sizeof(record));
+        if (write_record(&record, SLOT_ADDR(page, slot)) != RETURN_OK)
+        {
+            return RETURN_ERR;
+        }
+        seq[i] = record.seq;
+        slot++;
+    }
+    slot = 0;
+    for (int i = 0; i < NV_JOURNAL_ID_COUNT; i++)
+    {
+        if (seq[i] != 0)
+        {
+            index_table[i].seq = seq[i];
+            index_table[i].addr = SLOT_ADDR(page, slot++);
+        }
+    }
+    active_page = page;
+    next_slot = slot;
+    ci_logdebug(LOG_USER, "nv_journal: compact to page %d, %d records\n", page, slot);
+    return RETURN_OK;
+}
+
+/**
+ * @brief 整理中途掉电时, 还没搬过去的条目的最新记录仍在原扇区, 补写到当前扇区
+ *      - 不补的话下次整理会先擦除原扇区, 这些条目就丢了
+ *      - 整理后的扇区最多只有NV_JOURNAL_ID_COUNT条记录, 一定放得下
+ */
+static int finish_compact(void)
+{
+    nv_journal_record_t record;
+    uint32_t count = 0;
+
+    for (int i = 0; i < NV_JOURNAL_ID_COUNT; i++)
+    {
+        if (!index_table[i].used || index_table[i].seq == 0 || on_page(&index_table[i], active_page))
+        {
+            continue;
+        }
+        if (next_slot >= SLOT_COUNT)
+        {
+            return RETURN_ERR;
+        }
+        post_read_flash((char*) &record, index_table[i].addr, sizeof(record));
+        if (write_record(&record, SLOT_ADDR(active_page, next_slot)) != RETURN_OK)
+        {
+            return RETURN_ERR;
+        }
+        update_index(&record, SLOT_ADDR(active_page, next_slot));
+        next_slot++;
+        count++;
+    }
+    if (count > 0)
+    {
+        ci_logwarn(LOG_USER, "nv_journal: finish interrupted compact, %d records\n", count);
+    }
+    return RETURN_OK;
+}
+
+int nv_journal_init(void)
+{
+    nv_journal_record_t record;
+    uint32_t page_seq[NV_JOURNAL_PAGE_COUNT] = { 0 };
+    uint32_t page_used[NV_JOURNAL_PAGE_COUNT] = { 0 };
+    uint32_t max_seq = 0;
+
+    memset(index_table, 0, sizeof(index_table));
+    // 每页最多SLOT_COUNT条记录, 扫描时间是固定上限的
+    for (uint8_t page = 0; page < NV_JOURNAL_PAGE_COUNT; page++)
+    {
+        for (uint32_t slot = 0; slot < SLOT_COUNT; slot++)
+        {
+            post_read_flash((char*) &record, SLOT_ADDR(page, slot), sizeof(record));
+            stats.scan_count++;
+            if (record_empty(&record))
+            {
+                continue;
+            }
+            // 写了一半的记录也占用了位置, 后面只能追加在它之后
+            page_used[page] = slot + 1;
+            if (!record_valid(&record))
+            {
+                continue;
+            }
+            if (record.seq > page_seq[page])
+            {
+                page_seq[page] = record.seq;
+            }
+            nv_journal_index_t *index = find_index(record.id, true);
+            if (index != NULL && record.seq > index->seq)
+            {
+                index->seq = record.seq;
+                index->addr = SLOT_ADDR(page, slot);
+            }
+        }
+    }
+
+    active_page = page_seq[1] > page_seq[0] ? 1 : 0;
+    next_slot = page_used[active_page];
+    max_seq = page_seq[active_page];
+    next_seq = max_seq + 1;
+    if (max_seq == 0 && next_slot > 0)
+    {
+        // 没有任何有效记录却不是空扇区, 擦掉重新开始
+        if (post_erase_flash(PAGE_ADDR(active_page), NV_JOURNAL_PAGE_SIZE) != RETURN_OK)
+        {
+            return RETURN_ERR;
+        }
+        stats.erase_count++;
+        next_slot = 0;
+    }
+    if (finish_compact() != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    ci_loginfo(LOG_USER, "nv_journal: page %d, slot %d, seq %d\n", active_page, next_slot, max_seq);
+    return RETURN_OK;
+}
+
+int nv_journal_read(uint32_t id, void *data, uint16_t len)
+{
+    nv_journal_record_t record;
+    nv_journal_index_t *index = find_index(id, false);
+    if (index == NULL || index->seq == 0)
+    {
+        return RETURN_ERR;
+    }
+    post_read_flash((char*) &record, index->addr, sizeof(record));
+    if (!record_valid(&record) || record.len != len)
+    {
+        return RETURN_ERR;
+    }
+    memcpy(data, record.data, len);
+    return RETURN_OK;
+}
+
+int nv_journal_append(uint32_t id, const void *data, uint16_t len)
+{
+    nv_journal_record_t record;
+    if (len > NV_JOURNAL_DATA_SIZE)
+    {
+        return RETURN_ERR;
+    }
+    if (find_index(id, true) == NULL)
+    {
+        ci_logerr(LOG_USER, "nv_journal: too many items\n");
+        return RETURN_ERR;
+    }
+    if (next_slot >= SLOT_COUNT && compact() != RETURN_OK)
+    {
+        ci_logerr(LOG_USER, "nv_journal: compact failed\n");
+        return RETURN_ERR;
+    }
+    memset(&record, 0xFF, sizeof(record));
+    record.id = id;
+    record.len = len;
+    memcpy(record.data, data, len);
+    if (write_record(&record, SLOT_ADDR(active_page, next_slot)) != RETURN_OK)
+    {
+        // 写了一半的位置不能再用
+        next_slot++;
+        return RETURN_ERR;
+    }
+    update_index(&record, SLOT_ADDR(active_page, next_slot));
+    next_slot++;
+    return RETURN_OK;
+}
+
+void nv_journal_get_stats(nv_journal_stats_t *out)
+{
+    *out = stats;
+}
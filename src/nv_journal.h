@@ -0,0 +1,57 @@
+#ifndef _NV_JOURNAL_H
+#define _NV_JOURNAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 启英泰伦nvdata分区, 必须和firmware/config.ini中的NV_addr, NV_size一致
+#define NV_PARTITION_ADDR 0x3F8000
+#define NV_PARTITION_SIZE 0x8000
+// nvdata之前最后一个分区user_file的结束地址, 即config.ini中的user_file_addr + user_file_size
+#define NV_USER_FILE_END (0x381000 + 0x11000)
+// journal放在nvdata分区之前没有分配的两个扇区, 不改变已出货设备的nvdata分区, nvdata管理和打包工具都不会碰到这里
+#define NV_JOURNAL_ADDR (NV_PARTITION_ADDR - NV_JOURNAL_PAGE_COUNT * NV_JOURNAL_PAGE_SIZE)
+#define NV_JOURNAL_PAGE_SIZE 4096
+#define NV_JOURNAL_PAGE_COUNT 2
+// 单条记录的大小, 每页可以存放NV_JOURNAL_PAGE_SIZE / NV_JOURNAL_RECORD_SIZE条记录
+#define NV_JOURNAL_RECORD_SIZE 32
+#define NV_JOURNAL_DATA_SIZE (NV_JOURNAL_RECORD_SIZE - 12)
+// 最多记录的条目数
+#define NV_JOURNAL_ID_COUNT 8
+
+typedef struct
+{
+    uint32_t append_count; // 追加写入的记录数
+    uint32_t erase_count;  // 整理时擦除扇区的次数
+    uint32_t scan_count;   // 开机时扫描的记录数
+} nv_journal_stats_t;
+
+/**
+ * @brief 扫描journal, 找出每个条目最新的有效记录
+ */
+int nv_journal_init(void);
+/**
+ * @brief 读取条目最新的记录
+ *
+ * @retval RETURN_OK 读取成功
+ * @retval RETURN_ERR 没有该条目的有效记录
+ */
+int nv_journal_read(uint32_t id, void *data, uint16_t len);
+/**
+ * @brief 追加一条记录, 当前扇区写满时把所有条目的最新记录整理到另一个扇区
+ * @note 不带锁, 由调用者保证互斥
+ */
+int nv_journal_append(uint32_t id, const void *data, uint16_t len);
+/**
+ * @brief 获取journal统计
+ */
+void nv_journal_get_stats(nv_journal_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,412 @@
+#include "nv_store.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "ci_log.h"
+#include "ci_nvdata_manage.h"
+#include "nv_journal.h"
+#include "system_msg_deal.h"
+
+typedef struct
+{
+    uint32_t id;
+    uint16_t len;
+    bool used;
+    bool valid; // image是否为flash中的实际内容
+    bool dirty; // pending是否有尚未写入的修改
+    uint8_t image[NV_STORE_ITEM_SIZE];
+    uint8_t pending[NV_STORE_ITEM_SIZE];
+} nv_store_item_t;
+
+// 超过NV_STORE_ITEM_SIZE的条目直接写nvdata, 只缓存最近写入的一个
+typedef struct
+{
+    uint32_t id;
+    uint16_t len;
+    bool used;
+    bool dirty;
+    uint8_t pending[NV_STORE_LARGE_SIZE]; // 条目的最新内容, 写入flash后仍保留, 供nv_store_read读取
+} nv_store_large_t;
+
+static nv_store_item_t items[NV_STORE_ITEM_COUNT];
+static nv_store_large_t large;
+static nv_store_stats_t stats;
+static SemaphoreHandle_t store_lock = NULL;  // 保护items和stats
+static SemaphoreHandle_t commit_lock = NULL; // 保证同一时间只有一个任务在写flash
+static TaskHandle_t store_task = NULL;
+static TickType_t first_change_tick = 0;     // 第一个未写入的修改发生的时刻
+static TickType_t last_change_tick = 0;      // 最后一次修改发生的时刻
+static bool flush_requested = false;         // nv_store_flush请求后台任务不再等待NV_STORE_QUIET_MS
+
+static nv_store_item_t *find_item(uint32_t id, uint16_t len)
+{
+    nv_store_item_t *empty = NULL;
+    for (int i = 0; i < NV_STORE_ITEM_COUNT; i++)
+    {
+        if (items[i].used && items[i].id == id)
+        {
+            return &items[i];
+        }
+        if (!items[i].used && empty == NULL)
+        {
+            empty = &items[i];
+        }
+    }
+    if (empty != NULL)
+    {
+        empty->used = true;
+        empty->id = id;
+        empty->len = len;
+        empty->valid = false;
+        empty->dirty = false;
+    }
+    return empty;
+}
+
+static bool has_dirty(void)
+{
+    if (large.used && large.dirty)
+    {
+        return true;
+    }
+    for (int i = 0; i < NV_STORE_ITEM_COUNT; i++)
+    {
+        if (items[i].used && items[i].dirty)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 把未写入的修改写入flash
+ *      - 写flash时不持有store_lock, 其他任务仍可以继续修改条目
+ */
+static void commit(void)
+{
+    uint8_t data[NV_STORE_ITEM_COUNT][NV_STORE_ITEM_SIZE];
+    bool writing[NV_STORE_ITEM_COUNT] = { false };
+    uint8_t large_data[NV_STORE_LARGE_SIZE];
+    uint32_t large_id = 0;
+    uint16_t large_len = 0;
+    TickType_t start, first;
+    uint32_t writes = 0;
+    bool asr_busy;
+
+    xSemaphoreTake(commit_lock, portMAX_DELAY);
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    first = first_change_tick;
+    // 所有未写入的修改都在这次写入, 之前的flush请求已经满足
+    flush_requested = false;
+    for (int i = 0; i < NV_STORE_ITEM_COUNT; i++)
+    {
+        nv_store_item_t *item = &items[i];
+        if (item->used && item->dirty)
+        {
+            // 先当作已经写入, 写入期间相同的修改就不会再次标记为dirty
+            memcpy(data[i], item->pending, item->len);
+            memcpy(item->image, item->pending, item->len);
+            item->valid = true;
+            item->dirty = false;
+            writing[i] = true;
+        }
+    }
+    if (large.used && large.dirty)
+    {
+        large_id = large.id;
+        large_len = large.len;
+        memcpy(large_data, large.pending, large.len);
+        large.dirty = false;
+    }
+    xSemaphoreGive(store_lock);
+
+    // 在开始写入时记录ASR状态, 写完再看的话写入期间才开始的识别也会被算进去
+    asr_busy = get_asr_state() != SYS_STATE_ASR_IDLE;
+    start = xTaskGetTickCount();
+    for (int i = 0; i < NV_STORE_ITEM_COUNT; i++)
+    {
+        if (!writing[i])
+        {
+            continue;
+        }
+        if (nv_journal_append(items[i].id, data[i], items[i].len) != RETURN_OK)
+        {
+            ci_logerr(LOG_USER, "nv_store: write item %d failed\n", items[i].id);
+            xSemaphoreTake(store_lock, portMAX_DELAY);
+            items[i].valid = false;
+            if (!items[i].dirty)
+            {
+                memcpy(items[i].pending, data[i], items[i].len);
+                items[i].dirty = true;
+            }
+            xSemaphoreGive(store_lock);
+            continue;
+        }
+        writes++;
+    }
+    if (large_len > 0)
+    {
+        if (cinv_item_write(large_id, large_len, large_data) != CINV_OPER_SUCCESS)
+        {
+            // 条目还不存在
+            cinv_item_init(large_id, large_len, large_data);
+        }
+        writes++;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    stats.write_count += writes;
+    TickType_t now = xTaskGetTickCount();
+    uint32_t write_ms = (now - start) * portTICK_PERIOD_MS;
+    if (write_ms > stats.write_max_ms)
+    {
+        stats.write_max_ms = write_ms;
+    }
+    stats.latency_last_ms = (now - first) * portTICK_PERIOD_MS;
+    if (stats.latency_last_ms > stats.latency_max_ms)
+    {
+        stats.latency_max_ms = stats.latency_last_ms;
+    }
+    if (asr_busy)
+    {
+        stats.asr_stall_count++;
+    }
+    if (has_dirty())
+    {
+        // 写入失败或写入期间又有了新的修改
+        first_change_tick = now;
+    }
+    xSemaphoreGive(store_lock);
+    xSemaphoreGive(commit_lock);
+    ci_logdebug(LOG_USER, "nv_store: write %d, avoided %d, coalesced %d, latency %dms, stall %d\n",
+            stats.write_count, stats.avoided_count, stats.coalesced_count, stats.latency_last_ms, stats.asr_stall_count);
+}
+
+/**
+ * @brief 后台写入任务
+ *      - 最后一次修改后NV_STORE_QUIET_MS内没有新的修改, 且ASR空闲、没有播放时才写入
+ *      - 从第一次修改算起超过NV_STORE_MAX_DEFER_MS后不再等待ASR空闲
+ *      - nv_store_flush请求后不再等待NV_STORE_QUIET_MS, 但仍要等ASR空闲
+ */
+static void nv_store_task(void *p_arg)
+{
+    bool deferred = false;
+    while (1)
+    {
+        xSemaphoreTake(store_lock, portMAX_DELAY);
+        bool dirty = has_dirty();
+        bool flush = flush_requested;
+        TickType_t now = xTaskGetTickCount();
+        TickType_t quiet = now - last_change_tick;
+        TickType_t pending = now - first_change_tick;
+        xSemaphoreGive(store_lock);
+
+        if (!dirty)
+        {
+            deferred = false;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (!flush && quiet < pdMS_TO_TICKS(NV_STORE_QUIET_MS) && pending < pdMS_TO_TICKS(NV_STORE_MAX_DEFER_MS))
+        {
+            // 期间有新的修改会被通知唤醒, 重新计算等待时间, 一直有修改时也不能等过NV_STORE_MAX_DEFER_MS
+            TickType_t wait = pdMS_TO_TICKS(NV_STORE_QUIET_MS) - quiet;
+            if (wait > pdMS_TO_TICKS(NV_STORE_MAX_DEFER_MS) - pending)
+            {
+                wait = pdMS_TO_TICKS(NV_STORE_MAX_DEFER_MS) - pending;
+            }
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+        if (get_asr_state() != SYS_STATE_ASR_IDLE || check_current_playing())
+        {
+            if (pending < pdMS_TO_TICKS(NV_STORE_MAX_DEFER_MS))
+            {
+                if (!deferred)
+                {
+                    deferred = true;
+                    xSemaphoreTake(store_lock, portMAX_DELAY);
+                    stats.deferred_count++;
+                    xSemaphoreGive(store_lock);
+                }
+                vTaskDelay(pdMS_TO_TICKS(NV_STORE_POLL_MS));
+                continue;
+            }
+            xSemaphoreTake(store_lock, portMAX_DELAY);
+            stats.forced_count++;
+            xSemaphoreGive(store_lock);
+        }
+        deferred = false;
+        commit();
+    }
+}
+
+int nv_store_init(void)
+{
+    if (nv_journal_init() != RETURN_OK)
+    {
+        return RETURN_ERR;
+    }
+    store_lock = xSemaphoreCreateMutex();
+    if (store_lock == NULL)
+    {
+        return RETURN_ERR;
+    }
+    commit_lock = xSemaphoreCreateMutex();
+    if (commit_lock == NULL)
+    {
+        return RETURN_ERR;
+    }
+    if (xTaskCreate(nv_store_task, "nv_store", 256, NULL, 2, &store_task) != pdPASS)
+    {
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+int nv_store_load(uint32_t id, void *data, uint16_t len)
+{
+    uint16_t real_len;
+    if (len > NV_STORE_ITEM_SIZE)
+    {
+        if (cinv_item_read(id, len, data, &real_len) != CINV_OPER_SUCCESS)
+        {
+            cinv_item_init(id, len, data);
+        }
+        return RETURN_OK;
+    }
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    if (nv_journal_read(id, data, len) != RETURN_OK)
+    {
+        // journal里还没有, 可能是旧固件保存在nvdata里的, 读出来后迁移到journal
+        cinv_item_read(id, len, data, &real_len);
+        nv_journal_append(id, data, len);
+    }
+    nv_store_item_t *item = find_item(id, len);
+    if (item != NULL)
+    {
+        item->len = len;
+        item->valid = true;
+        item->dirty = false;
+        memcpy(item->image, data, len);
+    }
+    xSemaphoreGive(store_lock);
+    return RETURN_OK;
+}
+
+/**
+ * @brief 记录一次新的修改并唤醒后台任务, 调用者持有store_lock, 在把条目标记为dirty之前调用
+ *
+ * @param was_dirty 条目原来就有没写入的修改, 这次修改合并掉了上一次
+ */
+static void mark_changed(bool was_dirty)
+{
+    if (was_dirty)
+    {
+        stats.coalesced_count++;
+    }
+    else if (!has_dirty())
+    {
+        first_change_tick = xTaskGetTickCount();
+    }
+    last_change_tick = xTaskGetTickCount();
+    xTaskNotifyGive(store_task);
+}
+
+int nv_store_write(uint32_t id, const void *data, uint16_t len)
+{
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    nv_store_item_t *item = (len <= NV_STORE_ITEM_SIZE) ? find_item(id, len) : NULL;
+    if (item == NULL && len > NV_STORE_ITEM_SIZE && len <= NV_STORE_LARGE_SIZE
+        && (!large.used || !large.dirty || large.id == id))
+    {
+        // 大条目很少写, 不和flash中的内容比较
+        mark_changed(large.used && large.dirty);
+        large.used = true;
+        large.id = id;
+        large.len = len;
+        large.dirty = true;
+        memcpy(large.pending, data, len);
+        xSemaphoreGive(store_lock);
+        return RETURN_OK;
+    }
+    if (item == NULL)
+    {
+        // 放不进缓存的条目只能直接写入
+        xSemaphoreGive(store_lock);
+        ci_logwarn(LOG_USER, "nv_store: item %d not cached\n", id);
+        return cinv_item_write(id, len, (void*) data) == CINV_OPER_SUCCESS ? RETURN_OK : RETURN_ERR;
+    }
+    if (item->valid && item->len == len && memcmp(item->image, data, len) == 0)
+    {
+        // 与flash中的内容一致, 之前还没写入的修改也不用再写了
+        item->dirty = false;
+        stats.avoided_count++;
+    }
+    else
+    {
+        mark_changed(item->dirty);
+        item->len = len;
+        item->dirty = true;
+        memcpy(item->pending, data, len);
+    }
+    xSemaphoreGive(store_lock);
+    return RETURN_OK;
+}
+
+int nv_store_read(uint32_t id, void *data, uint16_t len)
+{
+    uint16_t real_len;
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    if (large.used && large.id == id && large.len == len)
+    {
+        memcpy(data, large.pending, len);
+        xSemaphoreGive(store_lock);
+        return RETURN_OK;
+    }
+    for (int i = 0; i < NV_STORE_ITEM_COUNT; i++)
+    {
+        nv_store_item_t *item = &items[i];
+        if (item->used && item->id == id && item->len == len && (item->dirty || item->valid))
+        {
+            memcpy(data, item->dirty ? item->pending : item->image, len);
+            xSemaphoreGive(store_lock);
+            return RETURN_OK;
+        }
+    }
+    xSemaphoreGive(store_lock);
+    // 缓存的小条目都在nv_store_load时读进来了, 只有大条目需要从flash读
+    if (len <= NV_STORE_ITEM_SIZE)
+    {
+        return RETURN_ERR;
+    }
+    return cinv_item_read(id, len, data, &real_len) == CINV_OPER_SUCCESS ? RETURN_OK : RETURN_ERR;
+}
+
+void nv_store_flush(void)
+{
+    // 写flash要几十毫秒, 交给后台任务, 不占用调用者的任务
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    bool dirty = has_dirty();
+    if (dirty)
+    {
+        flush_requested = true;
+    }
+    xSemaphoreGive(store_lock);
+    if (dirty)
+    {
+        xTaskNotifyGive(store_task);
+    }
+}
+
+void nv_store_get_stats(nv_store_stats_t *out)
+{
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(store_lock);
+}
@@ -0,0 +1,75 @@
+#ifndef _NV_STORE_H
+#define _NV_STORE_H
+
+#include <stdint.h>
+#include "user_config.h"
+#include "light.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 最多管理的nvdata条目数: 音量, PWM或ws2812夜灯的灯效, 红外夜灯的遥控器配置、学习掩码和灯光状态, 空调状态
+#define NV_STORE_ITEM_COUNT (1 + (LIGHT_PWM_ENABLE || LIGHT_RGB_ENABLE) + LIGHT_IR_ENABLE * 3 + AIRCON_ENABLE)
+// 单个条目的最大长度
+#define NV_STORE_ITEM_SIZE 16
+// 超过NV_STORE_ITEM_SIZE的条目直接写nvdata, 也由后台任务写入, 但同一时间只缓存一个, 如红外学到的按键
+#define NV_STORE_LARGE_SIZE 64
+// 最后一次修改后等待多久才真正写入flash
+#define NV_STORE_QUIET_MS 3000
+// ASR忙碌或正在播放时推迟写入, 但从第一次修改算起最多推迟这么久
+#define NV_STORE_MAX_DEFER_MS 30000
+// 推迟写入时检查ASR状态的间隔
+#define NV_STORE_POLL_MS 200
+
+typedef struct
+{
+    uint32_t write_count;     // 实际写入flash的次数
+    uint32_t avoided_count;   // 内容与flash中一致而省去的写入次数
+    uint32_t coalesced_count; // 在等待期间被后续修改覆盖而合并掉的写入次数
+    uint32_t deferred_count;  // 因ASR忙碌或正在播放而推迟写入的次数
+    uint32_t forced_count;    // 推迟超过NV_STORE_MAX_DEFER_MS而强制写入的次数
+    uint32_t asr_stall_count; // 开始写入flash时ASR处于忙碌状态的次数, 这些写入可能拖慢了识别
+    uint32_t latency_last_ms; // 最近一次从修改到写入flash的延迟
+    uint32_t latency_max_ms;  // 从修改到写入flash的最大延迟
+    uint32_t write_max_ms;    // 单次写入flash的最大耗时
+} nv_store_stats_t;
+
+/**
+ * @brief 初始化nvdata写入缓存并创建后台写入任务
+ *      - 缓存的条目保存在nv_journal中, 超过NV_STORE_ITEM_SIZE的条目仍直接读写nvdata
+ *      - 后台任务只在ASR空闲且没有播放时写入flash, 避免和DNN读取模型抢占flash
+ */
+int nv_store_init(void);
+/**
+ * @brief 从nvdata读取条目, 并记录为已持久化的内容
+ *      - 条目不存在时以data的当前内容作为默认值写入nvdata
+ */
+int nv_store_load(uint32_t id, void *data, uint16_t len);
+/**
+ * @brief 修改nvdata条目
+ *      - 与已持久化的内容相同时直接忽略, 否则由后台任务在NV_STORE_QUIET_MS内没有新的修改时写入flash
+ *      - 超过NV_STORE_ITEM_SIZE的条目不比较内容, 已经缓存了另一个还没写入的大条目时直接写入
+ */
+int nv_store_write(uint32_t id, const void *data, uint16_t len);
+/**
+ * @brief 读取条目的最新内容, 包括还没写入flash的修改
+ *      - 条目不存在时返回RETURN_ERR, 不写入默认值
+ */
+int nv_store_read(uint32_t id, void *data, uint16_t len);
+/**
+ * @brief 请求后台任务尽快写入所有未持久化的修改, 不再等待NV_STORE_QUIET_MS
+ *      - 仍然等ASR空闲且没有播放时才写入, 最多推迟到NV_STORE_MAX_DEFER_MS
+ *      - 只发出请求, 不等待写入完成, 调用者的任务不会被写flash阻塞
+ */
+void nv_store_flush(void);
+/**
+ * @brief 获取写入统计
+ */
+void nv_store_get_stats(nv_store_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+#include "pwm_phase.h"
+
+#include <stddef.h>
+
+void pwm_phase_plan(const uint32_t *duty, int count, uint32_t period, uint32_t *offset)
+{
+    uint32_t start = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        offset[i] = start;
+        start = (start + duty[i] % period) % period;
+    }
+}
+
+/**
+ * @brief 时刻t第i路是否导通, 导通时间可能跨过周期终点绕回起点
+ */
+static int channel_on(uint32_t duty, uint32_t offset, uint32_t period, uint32_t t)
+{
+    if (duty >= period)
+    {
+        return 1;
+    }
+    return (t >= offset ? t - offset : t + period - offset) < duty;
+}
+
+static uint32_t isqrt(uint64_t x)
+{
+    uint64_t r = 0;
+
+    for (uint64_t bit = (uint64_t) 1 << 62; bit != 0; bit >>= 2)
+    {
+        if (x >= r + bit)
+        {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+        {
+            r >>= 1;
+        }
+    }
+    return (uint32_t) r;
+}
+
+void pwm_phase_current(const uint32_t *duty, const uint32_t *offset, const uint32_t *current,
+        int count, uint32_t period, uint32_t *peak, uint32_t *rms)
+{
+    // 各路导通和关断的时刻把周期分成若干段, 每段内的电流不变
+    uint32_t edges[PWM_PHASE_MAX_CHANNELS * 2 + 1];
+    int n = 0;
+    uint64_t square = 0;
+
+    *peak = 0;
+    edges[n++] = 0;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t on = offset != NULL ? offset[i] % period : 0;
+        edges[n++] = on;
+        edges[n++] = (on + duty[i] % period) % period;
+    }
+    // 插入排序, 边沿数很少
+    for (int i = 1; i < n; i++)
+    {
+        uint32_t e = edges[i];
+        int j = i;
+        for (; j > 0 && edges[j - 1] > e; j--)
+        {
+            edges[j] = edges[j - 1];
+        }
+        edges[j] = e;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t begin = edges[i];
+        uint32_t end = i + 1 < n ? edges[i + 1] : period;
+        uint32_t sum = 0;
+        if (end == begin)
+        {
+            continue;
+        }
+        for (int k = 0; k < count; k++)
+        {
+            if (channel_on(duty[k], offset != NULL ? offset[k] % period : 0, period, begin))
+            {
+                sum += current[k];
+            }
+        }
+        if (sum > *peak)
+        {
+            *peak = sum;
+        }
+        square += (uint64_t) sum * sum * (end - begin);
+    }
+    *rms = isqrt(square / period);
+}
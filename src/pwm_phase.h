@@ -0,0 +1,43 @@
+#ifndef _PWM_PHASE_H
+#define _PWM_PHASE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 最多排相位的PWM通道数
+#define PWM_PHASE_MAX_CHANNELS 8
+
+/**
+ * @brief 排开各路PWM导通时间的相位
+ *      - 各路依次接在前一路导通结束的地方, 超过周期的部分从周期起点绕回
+ *      - 占空比之和不超过周期时导通时间互不重叠, 超过时同时导通的路数也最少
+ *      - 按各路的最大占空比排, 亮度降低时各路只是从各自的起点缩短, 仍然不会重叠
+ *
+ * @param duty 各路的占空比, 和period单位相同
+ * @param count 通道数, 不超过PWM_PHASE_MAX_CHANNELS
+ * @param period 一个PWM周期
+ * @param offset 输出各路在周期中开始导通的时刻
+ */
+void pwm_phase_plan(const uint32_t *duty, int count, uint32_t period, uint32_t *offset);
+/**
+ * @brief 估算一个PWM周期内电源提供的峰值电流和有效值电流
+ *
+ * @param duty 各路的占空比, 和period单位相同
+ * @param offset 各路开始导通的时刻, 为NULL时各路都在周期起点导通
+ * @param current 各路导通时的电流
+ * @param count 通道数, 不超过PWM_PHASE_MAX_CHANNELS
+ * @param period 一个PWM周期
+ * @param peak 输出峰值电流, 单位同current
+ * @param rms 输出有效值电流, 单位同current
+ */
+void pwm_phase_current(const uint32_t *duty, const uint32_t *offset, const uint32_t *current,
+        int count, uint32_t period, uint32_t *peak, uint32_t *rms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
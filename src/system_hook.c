@@ -4,6 +4,147 @@
 #include "voice_module_uart_protocol.h"
 #include "i2c_protocol_module.h"
 #include "ci112x_core_misc.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "ci_log.h"
+#include "user_config.h"
+#include "light.h"
+#include "nv_store.h"
+#include "system_hook.h"
+#include "hw_timer.h"
+#include "ci112x_scu.h"
+#include "ci112x_system.h"
+#if CONFIG_CLI_EN
+#include <stdio.h>
+#include "FreeRTOS_CLI.h"
+#endif
+#if LIGHT_IR_ENABLE || AIRCON_ENABLE
+#include "ir_remote_driver.h"
+#endif
+
+/* 用mcycle计时, 切换功耗模式时先按旧主频结算, 主频改变前后的时间间隔都是准确的 */
+static uint32_t time_cycle = 0; /* 上次结算时的mcycle */
+static uint32_t time_rem = 0;   /* 上次结算剩下的不足1us的周期数 */
+static uint32_t time_us = 0;    /* 上次结算时的时刻 */
+static uint32_t time_mhz = 0;   /* 当前主频 */
+
+/* 唤醒词识别结果到唤醒灯光提示和唤醒提示音的延迟统计 */
+static uint32_t wakeup_result_us = 0;
+static uint32_t wakeup_cue_us = 0;
+static sys_wakeup_latency_t wakeup_latency;
+
+/**
+ * @brief 按mcycle结算到当前时刻, 调用时要关中断
+ */
+static uint32_t time_settle(void)
+{
+    uint32_t now = read_csr(mcycle);
+    uint32_t cycles;
+
+    if (time_mhz == 0)
+    {
+        time_mhz = get_ipcore_clk() / 1000000;
+    }
+    /* 两次结算的间隔不能超过32位mcycle回绕的时间, 只用来量短的间隔 */
+    cycles = now - time_cycle + time_rem;
+    time_us += cycles / time_mhz;
+    time_rem = cycles % time_mhz;
+    time_cycle = now;
+    return time_us;
+}
+
+/**
+ * @brief 获取us时刻, 只用于计算几秒以内的间隔, 可以在中断中调用
+ */
+static uint32_t sys_time_us(void)
+{
+    uint32_t mstatus = read_csr(mstatus);
+    uint32_t us;
+
+    clear_csr(mstatus, MSTATUS_MIE);
+    us = time_settle();
+    if (mstatus & MSTATUS_MIE)
+    {
+        set_csr(mstatus, MSTATUS_MIE);
+    }
+    return us;
+}
+
+/**
+ * @brief 记录唤醒词识别结果到达的时刻，收到唤醒词识别结果时调用
+ */
+void sys_wakeup_result_mark(void)
+{
+    wakeup_result_us = sys_time_us();
+}
+
+/**
+ * @brief 给出唤醒灯光提示并记录延迟，时钟恢复正常后、播放唤醒提示音之前调用
+ */
+void sys_wakeup_cue(void)
+{
+    /* light_cue返回时灯珠已经刷新 */
+    light_cue(true);
+    wakeup_cue_us = sys_time_us();
+    wakeup_latency.count++;
+    wakeup_latency.cue_last_us = wakeup_cue_us - wakeup_result_us;
+    if (wakeup_latency.cue_last_us > wakeup_latency.cue_max_us)
+    {
+        wakeup_latency.cue_max_us = wakeup_latency.cue_last_us;
+    }
+}
+
+/**
+ * @brief 记录唤醒提示音开始播放的时刻，请求播放唤醒提示音之前调用
+ */
+void sys_wakeup_prompt_mark(void)
+{
+    uint32_t now = sys_time_us();
+
+    wakeup_latency.prompt_last_us = now - wakeup_result_us;
+    /* 这次唤醒还没给出灯光提示，或者灯光提示比提示音晚 */
+    if ((int32_t) (wakeup_cue_us - wakeup_result_us) < 0 || wakeup_latency.cue_last_us > wakeup_latency.prompt_last_us)
+    {
+        wakeup_latency.cue_late_count++;
+    }
+}
+
+void sys_get_wakeup_latency(sys_wakeup_latency_t *latency)
+{
+    *latency = wakeup_latency;
+}
+
+#if CONFIG_CLI_EN
+/**
+ * @brief 命令行: wakeup_cue 打印唤醒词识别结果到灯光提示和提示音的延迟
+ */
+static BaseType_t wakeup_cue_command_handler(char *pcWriteBuffer, size_t xWriteBufferLen, const char *pcCommandString)
+{
+    sys_wakeup_latency_t st;
+
+    sys_get_wakeup_latency(&st);
+    snprintf(pcWriteBuffer, xWriteBufferLen,
+            "wakeups %u, cue %uus (max %uus), prompt %uus, cue later than prompt %u times\r\n",
+            (unsigned int) st.count, (unsigned int) st.cue_last_us, (unsigned int) st.cue_max_us,
+            (unsigned int) st.prompt_last_us, (unsigned int) st.cue_late_count);
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t wakeup_cue_command =
+{
+    "wakeup_cue",
+    "\r\nwakeup_cue:\r\n Show wake word to light cue and prompt latency\r\n",
+    wakeup_cue_command_handler,
+    0
+};
+#endif
+
+void sys_hook_register_cli(void)
+{
+#if CONFIG_CLI_EN
+    FreeRTOS_CLIRegisterCommand(&wakeup_cue_command);
+#endif
+}
 
 /**
  * @brief 系统启动事件钩子，系统启动时会调用此函数
@@ -38,6 +179,10 @@ __WEAK void sys_weakup_hook(void)
  */
 __WEAK void sys_sleep_hook(void)
 {
+    light_cue(false);
+    /* 退出唤醒后短时间内不会再有新的修改，通知后台任务把还没写入的设置写入flash */
+    nv_store_flush();
+
 #if MSG_COM_USE_UART_EN
 #if (UART_PROTOCOL_VER == 1)
     uart_send_exit_wakeup();
@@ -51,6 +196,32 @@ __WEAK void sys_sleep_hook(void)
 #endif
 }
 
+/**
+ * @brief 功耗模式切换事件钩子，切换时钟后会调用此函数，可能在中断中调用
+ */
+__WEAK void sys_power_mode_hook(void)
+{
+    uint32_t mstatus = read_csr(mstatus);
+
+    /* 切换前的时间按旧主频结算 */
+    clear_csr(mstatus, MSTATUS_MIE);
+    time_settle();
+    time_mhz = get_ipcore_clk() / 1000000;
+    if (mstatus & MSTATUS_MIE)
+    {
+        set_csr(mstatus, MSTATUS_MIE);
+    }
+    hw_timer_clock_update();
+#if LIGHT_PWM_ENABLE
+    /* 抖动定时器的频率依赖APB时钟 */
+    light_pwm_clock_update();
+#endif
+#if LIGHT_IR_ENABLE || AIRCON_ENABLE
+    /* 红外的定时器计数和载波分频都依赖APB时钟 */
+    ir_clock_update();
+#endif
+}
+
 /**
  * @brief 语音识别事件钩子，语音模块输出识别结果时会调用此函数
  */
@@ -1,6 +1,7 @@
 #ifndef __SYSTEM_HOOK_H__
 #define __SYSTEM_HOOK_H__
 
+#include <stdint.h>
 #include "command_info.h"
 
 void sys_power_on_hook();
@@ -9,6 +10,27 @@ void sys_weakup_hook();
 
 void sys_sleep_hook();
 
+void sys_power_mode_hook(void);
+
 void sys_asr_result_hook(cmd_handle_t cmd_handle, uint8_t asr_score);
 
+typedef struct
+{
+    uint32_t count;          /* 给出唤醒灯光提示的次数 */
+    uint32_t cue_last_us;    /* 最近一次唤醒词识别结果到灯光提示的延迟 */
+    uint32_t cue_max_us;     /* 唤醒词识别结果到灯光提示的最大延迟 */
+    uint32_t prompt_last_us; /* 最近一次唤醒词识别结果到开始播放提示音的延迟 */
+    uint32_t cue_late_count; /* 提示音比灯光提示先开始的次数 */
+} sys_wakeup_latency_t;
+
+void sys_wakeup_result_mark(void);
+
+void sys_wakeup_cue(void);
+
+void sys_wakeup_prompt_mark(void);
+
+void sys_get_wakeup_latency(sys_wakeup_latency_t *latency);
+
+void sys_hook_register_cli(void);
+
 #endif
@@ -27,6 +27,7 @@
 #include "prompt_player.h"
 #include "product_semantic.h"
 #include "ci_nvdata_manage.h"
+#include "nv_store.h"
 #include "asr_api.h"
 #include "user_msg_deal.h"
 #include "system_hook.h"
@@ -223,8 +224,10 @@ void exit_down_freq_mode_cb(TimerHandle_t xTimer)
             asrtop_asr_system_pause();
 #if (USE_SINGLE_MIC_DENOISE)
             power_mode_switch(POWER_MODE_DOWN_FREQUENCY);
+            sys_power_mode_hook();
 #else
             power_mode_switch(POWER_MODE_OSC_FREQUENCY);
+            sys_power_mode_hook();
 #endif
             asrtop_asr_system_continue();
             resume_voice_in();
@@ -253,6 +256,7 @@ void vad_start_irq_cb(void)
         audio_cap_stop(AUDIO_CAP_NUM_LP);
         audio_pre_rslt_stop();
         power_mode_switch(POWER_MODE_NORMAL);
+        sys_power_mode_hook();
         audio_cap_start(AUDIO_CAP_NUM_LP);
         audio_pre_rslt_start();
         xTimerStartFromISR(exit_down_freq_mode_timer, 0);
@@ -303,8 +307,10 @@ void change_asr_wakeup_word(void)
 
 #if (USE_SINGLE_MIC_DENOISE)
     power_mode_switch(POWER_MODE_DOWN_FREQUENCY);
+    sys_power_mode_hook();
 #else
     power_mode_switch(POWER_MODE_OSC_FREQUENCY);
+    sys_power_mode_hook();
 #endif
 
     asrtop_asr_system_continue();
@@ -318,6 +324,7 @@ void change_asr_wakeup_word(void)
     pause_voice_in();
     asrtop_asr_system_pause();
     power_mode_switch(POWER_MODE_DOWN_FREQUENCY);
+    sys_power_mode_hook();
     asrtop_asr_system_continue();
     resume_voice_in();
     audio_cap_start(AUDIO_CAP_NUM_LP);
@@ -438,6 +445,7 @@ void enter_wakeup_deal(uint32_t exit_wakup_ms, cmd_handle_t cmd_handle)
         pause_voice_in();
         asrtop_asr_system_pause();
         power_mode_switch(POWER_MODE_NORMAL);
+        sys_power_mode_hook();
         asrtop_asr_system_continue();
         resume_voice_in();
         audio_cap_start(AUDIO_CAP_NUM_LP);
@@ -445,9 +453,15 @@ void enter_wakeup_deal(uint32_t exit_wakup_ms, cmd_handle_t cmd_handle)
 #endif
     }
 
+    /* 时钟已恢复正常，先给出唤醒灯光提示，再开始播放唤醒提示音 */
+    sys_wakeup_cue();
+
     //if (cmd_handle != INVALID_HANDLE)
     {
         pause_voice_in();
+#if PLAY_ENTER_WAKEUP_EN
+        sys_wakeup_prompt_mark();
+#endif
         /* if last state is unwakeup, need change asr word */
         if (SYS_STATE_UNWAKEUP == get_wakeup_state())
         {
@@ -505,7 +519,7 @@ uint8_t vol_set(char vol)
     if (vol <= VOLUME_MAX && vol >= VOLUME_MIN && sys_manage_data.volset != vol)
     {
         vol_hardware_init(vol);
-        cinv_item_write(NVDATA_ID_VOLUME, sizeof(sys_manage_data.volset), &sys_manage_data.volset);
+        nv_store_write(NVDATA_ID_VOLUME, &sys_manage_data.volset, sizeof(sys_manage_data.volset));
     }
     return sys_manage_data.volset;
 }
@@ -648,6 +662,7 @@ void sys_deal_asr_msg(sys_msg_asr_data_t *asr_msg)
 
         if (cmd_info_is_wakeup_word(cmd_handle)) /*wakeup word*/
         {
+            sys_wakeup_result_mark();
             /*updata wakeup state*/
             enter_wakeup_deal(EXIT_WAKEUP_TIME, cmd_handle);    /*updata wakeup state*/
         }
@@ -756,14 +771,9 @@ void UserTaskManageProcess(void *p_arg)
                 case SYS_MSG_TYPE_AUDIO_IN_STARTED:
                 {
                     uint8_t volume = VOLUME_DEFAULT;
-                    uint16_t real_len;
 
-                    /* 从nvdata里读取播放音量 */
-                    if (CINV_OPER_SUCCESS != cinv_item_read(NVDATA_ID_VOLUME, sizeof(volume), &volume, &real_len))
-                    {
-                        /* nvdata内无播放音量则配置为初始默认音量并写入nv */
-                        cinv_item_init(NVDATA_ID_VOLUME, sizeof(volume), &volume);
-                    }
+                    /* 从nvdata里读取播放音量，nvdata内无播放音量则配置为初始默认音量并写入nv */
+                    nv_store_load(NVDATA_ID_VOLUME, &volume, sizeof(volume));
                     /* 音量设置 */
                     vol_hardware_init(volume);
 
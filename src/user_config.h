@@ -32,4 +32,7 @@
 
 #define AUDIO_PLAYER_ENABLE                 1   //用于屏蔽播放器任务相关代码，0：屏蔽，1：开启
 
+#define AIRCON_ENABLE                       0   //红外空调控制，0：关闭，1：开启，与红外夜灯共用红外发射管
+#define AIRCON_DEFAULT_BRAND        BRAND_GREE  //默认空调品牌，见ir_data.h中的eAirBrand
+
 #endif /* _USER_CONFIG_H_ */ 
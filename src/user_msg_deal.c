@@ -9,6 +9,7 @@
 #include "ci_log.h"
 #include "ci112x_gpio.h"
 #include "light.h"
+#include "aircon.h"
 
 ///tag-insert-code-pos-1
 
@@ -40,6 +41,12 @@ void userapp_initial(void)
     Scu_SetIOReuse(I2S1_SCLK_PAD, FIRST_FUNCTION);
 #endif
     ///tag-gpio-init
+#if AIRCON_ENABLE
+    if (aircon_init() != RETURN_OK)
+    {
+        ci_logerr(LOG_USER, "init aircon failed!\n");
+    }
+#endif
     if (light_init() != RETURN_OK)
     {
         ci_logerr(LOG_USER, "init light failed!\n");
@@ -173,6 +180,72 @@ uint32_t deal_asr_msg_by_cmd_id(sys_msg_asr_data_t *asr_msg, cmd_handle_t cmd_ha
         case 22: //彩虹模式
             light_control(LIGHT_MODE_RAINBOW);
             break;
+#if LIGHT_IR_ENABLE
+        case 23: //切换遥控器
+            light_ir_select_profile(-1);
+            break;
+        case 24: //学习遥控器
+            light_ir_learn();
+            break;
+#endif
+#if AIRCON_ENABLE
+        case 30: //打开空调
+            aircon_control(AIRCON_CMD_ON);
+            break;
+        case 31: //关闭空调
+            aircon_control(AIRCON_CMD_OFF);
+            break;
+        case 32: //温度高一点
+            aircon_control(AIRCON_CMD_TEMP_UP);
+            break;
+        case 33: //温度低一点
+            aircon_control(AIRCON_CMD_TEMP_DOWN);
+            break;
+        case 34: //制冷模式
+            aircon_control(AIRCON_CMD_MODE_COOL);
+            break;
+        case 35: //制热模式
+            aircon_control(AIRCON_CMD_MODE_HEAT);
+            break;
+        case 36: //送风模式
+            aircon_control(AIRCON_CMD_MODE_FAN);
+            break;
+        case 37: //风速大一点
+            aircon_control(AIRCON_CMD_FAN_UP);
+            break;
+        case 38: //风速小一点
+            aircon_control(AIRCON_CMD_FAN_DOWN);
+            break;
+        case 39: //打开扫风
+            aircon_control(AIRCON_CMD_SWING_ON);
+            break;
+        case 40: //关闭扫风
+            aircon_control(AIRCON_CMD_SWING_OFF);
+            break;
+        case 41: //匹配空调
+            aircon_match_start();
+            break;
+        case 42: //空调响了
+            aircon_match_confirm();
+            break;
+        case 43: //十六度
+        case 44: //十七度
+        case 45: //十八度
+        case 46: //十九度
+        case 47: //二十度
+        case 48: //二十一度
+        case 49: //二十二度
+        case 50: //二十三度
+        case 51: //二十四度
+        case 52: //二十五度
+        case 53: //二十六度
+        case 54: //二十七度
+        case 55: //二十八度
+        case 56: //二十九度
+        case 57: //三十度
+            aircon_control((aircon_cmd_t) AIRCON_CMD_TEMP(cmd_id - 43 + 16));
+            break;
+#endif
         ///tag-asr-msg-deal-by-cmd-id-end
         default:
             ret = 0;
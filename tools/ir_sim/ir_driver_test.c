@@ -0,0 +1,490 @@
+/**
+ * 红外驱动仿真测试: ir_profile按键表中NEC码发送的脉宽、计数值表和逐个边沿换算两种发送方式的边沿抖动、
+ * 流式发送、缓冲接收、接收缓冲区溢出、流式NEC接收、发送中在中断里切换时钟
+ *
+ * 编译运行: make -C tools/ir_sim test
+ */
+#include <stdio.h>
+#include <string.h>
+#include "sim_hal.h"
+#include "ir_remote_driver.h"
+#include "ir_protocol.h"
+#include "ir_profile.h"
+
+// 驱动缓冲区中电平的单位是IR_DATA_DIV_COEFFICIENT us
+#define US_TO_LEVEL(us) ((uint16_t) ((us) / IR_DATA_DIV_COEFFICIENT))
+// 发送的脉宽允许的误差, 中断里的寄存器访问会让每个边沿晚一点
+#define TX_TOLERANCE_NS 2000
+// 接收头输出的电平长度会被量化到IR_DATA_DIV_COEFFICIENT us
+#define RX_TOLERANCE_US 10
+#define NEC_PERIOD_US 110000
+
+static uint16_t level_buf[1024] __attribute__((aligned(4)));
+static IrRemoteState events[64];
+static int event_count = 0;
+
+// 测试用的NEC码取自ir_profile中NEC配置的按键表, 和夜灯实际发送的码一致
+static uint32_t nec_codes[64];
+static size_t nec_code_count = 0;
+
+/**
+ * @brief 按NEC的发送顺序把地址和命令拼成32位码, 低位先发
+ */
+static uint32_t nec_code(const ir_profile_t *profile, uint16_t command)
+{
+    uint32_t address = profile->address;
+
+    if (profile->protocol == IR_PROTO_NEC)
+    {
+        address = (address & 0xFF) | (~address & 0xFF) << 8;
+    }
+    return address | (uint32_t) (command & 0xFF) << 16 | (uint32_t) (~command & 0xFF) << 24;
+}
+
+/**
+ * @brief 收集所有NEC配置的功能按键和颜色按键
+ */
+static void load_nec_codes(void)
+{
+    for (uint8_t i = 0; i < ir_profile_count(); i++)
+    {
+        const ir_profile_t *profile = ir_profile_get(i);
+
+        if (profile->protocol != IR_PROTO_NEC && profile->protocol != IR_PROTO_NEC_EXT)
+        {
+            continue;
+        }
+        for (int k = 0; k < IR_KEY_COUNT + profile->color_count; k++)
+        {
+            uint16_t command = k < IR_KEY_COUNT ? profile->keys[k] : profile->colors[k - IR_KEY_COUNT];
+
+            SIM_CHECK(nec_code_count < sizeof(nec_codes) / sizeof(nec_codes[0]), "too many profile keys");
+            if (nec_code_count < sizeof(nec_codes) / sizeof(nec_codes[0]))
+            {
+                nec_codes[nec_code_count++] = nec_code(profile, command);
+            }
+        }
+    }
+}
+
+static void callback(IrRemoteState *state)
+{
+    if (event_count < (int) (sizeof(events) / sizeof(events[0])))
+    {
+        events[event_count++] = *state;
+    }
+}
+
+static int count_events(IrRemoteEvent event)
+{
+    int n = 0;
+    for (int i = 0; i < event_count; i++)
+    {
+        n += events[i].event == event;
+    }
+    return n;
+}
+
+static uint32_t put(uint16_t *buf, uint32_t count, uint32_t us)
+{
+    buf[count] = US_TO_LEVEL(us);
+    return count + 1;
+}
+
+/**
+ * @brief 按NEC协议生成一帧和repeat个重复码, 每帧补齐到110ms
+ */
+static uint32_t nec_levels(uint16_t *buf, uint32_t code, int repeat)
+{
+    uint32_t n = 0, frame = 9000 + 4500 + 560;
+
+    n = put(buf, n, 9000);
+    n = put(buf, n, 4500);
+    for (int i = 0; i < 32; i++)
+    {
+        uint32_t space = (code >> i) & 1 ? 1690 : 560;
+        n = put(buf, n, 560);
+        n = put(buf, n, space);
+        frame += 560 + space;
+    }
+    n = put(buf, n, 560);
+    n = put(buf, n, NEC_PERIOD_US - frame);
+    for (int r = 0; r < repeat; r++)
+    {
+        n = put(buf, n, 9000);
+        n = put(buf, n, 2250);
+        n = put(buf, n, 560);
+        n = put(buf, n, NEC_PERIOD_US - 9000 - 2250 - 560);
+    }
+    // 最后的间隔不用发
+    return n - 1;
+}
+
+/**
+ * @brief 检查记录的载波边沿和发送的电平一致
+ */
+static void check_edges(const char *name, const uint16_t *levels, uint32_t count)
+{
+    SIM_CHECK(sim_edge_count == (int) count + 1, "%s: %d edges for %u levels", name, sim_edge_count, count);
+    for (uint32_t i = 0; i < count && i + 1 < (uint32_t) sim_edge_count; i++)
+    {
+        int64_t want = SIM_US(levels[i] * IR_DATA_DIV_COEFFICIENT);
+        int64_t got = sim_edges[i + 1].time - sim_edges[i].time;
+        if (sim_edges[i].on != ((i & 1) == 0) || got < want - TX_TOLERANCE_NS || got > want + TX_TOLERANCE_NS)
+        {
+            SIM_CHECK(0, "%s: level %u is %s %.1fus, want %s %dus", name, i,
+                    sim_edges[i].on ? "mark" : "space", sim_to_us(got), (i & 1) == 0 ? "mark" : "space",
+                    levels[i] * IR_DATA_DIV_COEFFICIENT);
+            return;
+        }
+    }
+}
+
+static void reset_driver(void)
+{
+    stIrPinInfo info;
+
+    // 和ir_protocol_pin_info一致
+    memset(&info, 0, sizeof(info));
+    info.outPin.PinName = PWM3_PAD;
+    info.outPin.GpioBase = GPIO1;
+    info.outPin.PinNum = gpio_pin_4;
+    info.outPin.PwmFun = SECOND_FUNCTION;
+    info.outPin.IoFun = FIRST_FUNCTION;
+    info.outPin.PwmBase = PWM3;
+    info.revPin.PinName = PWM4_PAD;
+    info.revPin.GpioBase = GPIO1;
+    info.revPin.PinNum = gpio_pin_5;
+    info.revPin.IoFun = FIRST_FUNCTION;
+    info.revPin.GpioIRQ = GPIO1_IRQn;
+    info.irTimer.ir_use_timer = TIMER0;
+    info.irTimer.ir_use_timer_IRQ = TIMER0_IRQn;
+    ir_setPinInfo(&info);
+    set_ir_level_code_addr((uint32_t) level_buf, sizeof(level_buf));
+    ir_hw_init();
+    registe_ir_remote_callback(callback);
+}
+
+/**
+ * @brief 从数据buf发送NEC码, 对比计数值表和逐个边沿换算两种方式
+ */
+static void test_nec_send(bool precompute)
+{
+    const char *name = precompute ? "table" : "legacy";
+    static uint16_t levels[1024];
+    uint32_t isrs = 0, calls = 0;
+    int32_t jitter_min = 0, jitter_max = 0;
+
+    set_ir_send_precompute(precompute);
+#if IR_ISR_STATS
+    ir_clear_isr_stats();
+#endif
+    for (int repeat = 0; repeat <= 3; repeat += 3)
+    {
+        for (size_t k = 0; k < nec_code_count; k++)
+        {
+            uint32_t count = nec_levels(levels, nec_codes[k], repeat);
+            memcpy(level_buf, levels, count * sizeof(uint16_t));
+            sim_clear();
+            event_count = 0;
+            SIM_CHECK(send_ir_code_start(count) == RETURN_OK, "%s: send refused", name);
+            sim_run_idle();
+            SIM_CHECK(count_events(IR_SEND_END) == 1, "%s: no IR_SEND_END", name);
+            SIM_CHECK(check_ir_busy_state() == RETURN_ERR, "%s: busy after send", name);
+            check_edges(name, levels, count);
+            isrs += sim_stats.timer_isrs;
+            calls += sim_stats.hal_calls;
+#if IR_SEND_JITTER_MEASURE
+            ir_send_jitter_t jitter;
+            ir_get_send_jitter(&jitter);
+            if (jitter.err_min < jitter_min || (repeat == 0 && k == 0))
+                jitter_min = jitter.err_min;
+            if (jitter.err_max > jitter_max || (repeat == 0 && k == 0))
+                jitter_max = jitter.err_max;
+#endif
+        }
+    }
+    printf("%-6s send: %.1f HAL calls per edge, jitter %d ~ %d cycles (%d)", name,
+            (double) calls / isrs, jitter_min, jitter_max, jitter_max - jitter_min);
+#if IR_ISR_STATS
+    ir_isr_stats_t stats;
+    ir_get_isr_stats(&stats);
+    printf(", ISR avg %llu max %u cycles", (unsigned long long) (stats.tx_cycles_total / stats.tx_edges), stats.tx_cycles_max);
+#endif
+    printf("\n");
+}
+
+typedef struct
+{
+    const uint16_t *levels;
+    uint32_t count;
+    uint32_t pos;
+} stream_t;
+
+static bool stream_next(void *arg, uint16_t *level)
+{
+    stream_t *s = arg;
+    if (s->pos >= s->count)
+    {
+        return false;
+    }
+    *level = s->levels[s->pos++];
+    return true;
+}
+
+static void test_stream_send(void)
+{
+    static uint16_t levels[1024];
+    uint32_t count = nec_levels(levels, nec_codes[0], 8);
+    stream_t s = { levels, count, 0 };
+
+    sim_clear();
+    event_count = 0;
+    SIM_CHECK(send_ir_code_stream(stream_next, &s) == RETURN_OK, "stream: send refused");
+    sim_run_idle();
+    SIM_CHECK(count_events(IR_SEND_END) == 1, "stream: no IR_SEND_END");
+    check_edges("stream", levels, count);
+
+    // 没有电平时按数据错误结束
+    s.pos = s.count;
+    event_count = 0;
+    SIM_CHECK(send_ir_code_stream(stream_next, &s) == RETURN_OK, "stream: empty send refused");
+    sim_run_idle();
+    SIM_CHECK(count_events(IR_SEND_DATA_ERR) == 1, "stream: empty send not reported as error");
+    SIM_CHECK(sim_stats.isr_logs == 0, "stream: %u logs printed in ISR", sim_stats.isr_logs);
+}
+
+/**
+ * @brief 发送一帧NEC码, 记录的边沿留给接收测试回放
+ */
+static uint32_t record_nec(uint16_t *levels, uint32_t code, int repeat)
+{
+    uint32_t count = nec_levels(levels, code, repeat);
+    set_ir_send_precompute(true);
+    memcpy(level_buf, levels, count * sizeof(uint16_t));
+    sim_clear();
+    send_ir_code_start(count);
+    sim_run_idle();
+    return count;
+}
+
+static void test_buffered_receive(void)
+{
+    static uint16_t levels[1024];
+    uint32_t count = record_nec(levels, nec_codes[1], 0);
+
+    event_count = 0;
+    ir_receive_start(1000);
+    sim_replay_edges(sim_now + SIM_MS(10));
+    sim_run_idle();
+    SIM_CHECK(count_events(IR_RECEIVE_END) == 1, "receive: %d end events", count_events(IR_RECEIVE_END));
+    SIM_CHECK(check_ir_receive() == RETURN_OK, "receive: check failed");
+    // 最后补上一个接收超时的长间隔
+    SIM_CHECK(get_receive_level_count() == count + 1, "receive: %u levels, want %u", get_receive_level_count(), count + 1);
+    for (uint32_t i = 0; i < count && i < get_receive_level_count(); i++)
+    {
+        int diff = (int) (level_buf[i] - levels[i]) * IR_DATA_DIV_COEFFICIENT;
+        if (diff < -RX_TOLERANCE_US || diff > RX_TOLERANCE_US)
+        {
+            SIM_CHECK(0, "receive: level %u is %dus, want %dus", i, level_buf[i] * IR_DATA_DIV_COEFFICIENT,
+                    levels[i] * IR_DATA_DIV_COEFFICIENT);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 边沿数超过缓冲区时接收到满为止, 之后驱动要能继续收发
+ */
+static void test_receive_overflow(void)
+{
+    static uint16_t levels[1024];
+    uint64_t t = sim_now + SIM_MS(10);
+    int level = 0;
+    uint32_t count;
+
+    event_count = 0;
+    ir_receive_start(1000);
+    for (int i = 0; i < 1500; i++)
+    {
+        sim_schedule_rx(t, level);
+        level ^= 1;
+        t += SIM_US(600);
+    }
+    sim_run_idle();
+    SIM_CHECK(count_events(IR_RECEIVE_END) == 1, "overflow: %d end events", count_events(IR_RECEIVE_END));
+    SIM_CHECK(count_events(IR_SEND_END) == 0, "overflow: receive timer fired as a send");
+    SIM_CHECK(check_ir_receive() == RETURN_OK, "overflow: received levels dropped");
+    SIM_CHECK(get_receive_level_count() == 1023, "overflow: %u levels", get_receive_level_count());
+    SIM_CHECK(check_ir_busy_state() == RETURN_ERR, "overflow: still busy");
+
+    count = record_nec(levels, nec_codes[2], 0);
+    SIM_CHECK(count_events(IR_SEND_END) == 1, "overflow: send after overflow failed");
+    check_edges("after overflow", levels, count);
+}
+
+static void test_nec_stream_receive(void)
+{
+    static uint16_t levels[1024];
+    int repeat = 5;
+    uint32_t frames = 0, repeats = 0, code = 0;
+
+    record_nec(levels, nec_codes[3], repeat);
+    event_count = 0;
+    SIM_CHECK(ir_receive_nec_start() == RETURN_OK, "nec stream: start refused");
+    sim_replay_edges(sim_now + SIM_MS(10));
+    sim_run_idle();
+    ir_receive_nec_stop();
+    for (int i = 0; i < event_count; i++)
+    {
+        if (events[i].event == IR_RECEIVE_NEC_FRAME)
+        {
+            frames++;
+            code = events[i].code;
+        }
+        repeats += events[i].event == IR_RECEIVE_NEC_REPEAT;
+    }
+    SIM_CHECK(frames == 1 && code == nec_codes[3], "nec stream: %u frames, code %08x", frames, code);
+    SIM_CHECK(repeats == (uint32_t) repeat, "nec stream: %u repeats, want %d", repeats, repeat);
+    SIM_CHECK(check_ir_busy_state() == RETURN_ERR, "nec stream: still busy");
+}
+
+/**
+ * @brief 在中断中切换功耗模式
+ */
+static void switch_clock_slow(void)
+{
+    sim_set_clock(25000000, 100000000);
+    ir_clock_update();
+}
+
+static void switch_clock_fast(void)
+{
+    sim_set_clock(50000000, 200000000);
+    ir_clock_update();
+}
+
+/**
+ * @brief 发送到一半在中断中切换APB时钟, 之后的电平按新时钟计时, 长度不变,
+ *      中断里不重新配置载波, 下次发送前在任务中配置
+ */
+static void test_clock_switch(bool precompute)
+{
+    const char *name = precompute ? "clock switch table" : "clock switch stream";
+    static uint16_t levels[512];
+    // 奇数个电平, 最后一个是mark, 结束时有边沿
+    uint32_t count = 199;
+    uint64_t half = 0;
+    stream_t s = { levels, count, 0 };
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        levels[i] = 200 + (i * 37) % 1500;
+    }
+    for (uint32_t i = 0; i < count / 2; i++)
+    {
+        half += SIM_US(levels[i] * IR_DATA_DIV_COEFFICIENT);
+    }
+    sim_set_clock(50000000, 200000000);
+    ir_clock_update();
+    set_ir_send_precompute(true);
+    memcpy(level_buf, levels, count * sizeof(uint16_t));
+    sim_clear();
+    event_count = 0;
+    if (precompute)
+    {
+        send_ir_code_start(count);
+    }
+    else
+    {
+        send_ir_code_stream(stream_next, &s);
+    }
+    // 在第count / 2个电平中间切换
+    sim_run_until(sim_edges[0].time + half + SIM_US(100));
+    sim_call_in_isr(switch_clock_slow);
+    sim_run_idle();
+    SIM_CHECK(count_events(IR_SEND_END) == 1, "%s: not finished", name);
+    // 切换时正在计时的电平前一部分按旧时钟走, 后一部分按新时钟走, 不检查
+    levels[count / 2] = (sim_edges[count / 2 + 1].time - sim_edges[count / 2].time) / 1000 / IR_DATA_DIV_COEFFICIENT;
+    check_edges(name, levels, count);
+    SIM_CHECK(sim_stats.pwm_inits == 0 && sim_stats.isr_pwm_inits == 0, "%s: carrier reconfigured during send (%u, %u in ISR)",
+            name, sim_stats.pwm_inits, sim_stats.isr_pwm_inits);
+
+    // 下次发送开始时在任务中按新时钟配置载波
+    sim_clear();
+    memcpy(level_buf, levels, 8 * sizeof(uint16_t));
+    send_ir_code_start(8);
+    sim_run_idle();
+    SIM_CHECK(sim_stats.pwm_inits == 1, "%s: carrier configured %u times before next send", name, sim_stats.pwm_inits);
+
+    // 空闲时在中断中切换, 也推迟到下次发送; 在任务中切换时立即配置
+    sim_clear();
+    sim_call_in_isr(switch_clock_fast);
+    SIM_CHECK(sim_stats.pwm_inits == 0 && sim_stats.isr_pwm_inits == 0, "%s: carrier configured in ISR", name);
+    memcpy(level_buf, levels, 8 * sizeof(uint16_t));
+    send_ir_code_start(8);
+    sim_run_idle();
+    SIM_CHECK(sim_stats.pwm_inits == 1, "%s: carrier not configured before send", name);
+    sim_clear();
+    switch_clock_slow();
+    switch_clock_fast();
+    SIM_CHECK(sim_stats.pwm_inits == 2 && sim_stats.isr_pwm_inits == 0, "%s: idle switch in task configured carrier %u times",
+            name, sim_stats.pwm_inits);
+}
+
+/**
+ * @brief 时钟不能准确产生载波时推迟发送, 恢复后通知
+ */
+static void test_clock_defer(void)
+{
+    static uint16_t levels[1024];
+    uint32_t deferred = get_ir_deferred_sends();
+    uint32_t count;
+
+    event_count = 0;
+    sim_set_clock(50000000, 10000000);
+    ir_clock_update();
+    SIM_CHECK(check_ir_clock_ready() == RETURN_ERR, "defer: slow core accepted");
+    SIM_CHECK(send_ir_code_start(10) == RETURN_ERR, "defer: send not deferred");
+    SIM_CHECK(count_events(IR_SEND_DEFERRED) == 1, "defer: no IR_SEND_DEFERRED");
+    SIM_CHECK(get_ir_deferred_sends() == deferred + 1, "defer: deferred count");
+    SIM_CHECK(check_ir_busy_state() == RETURN_ERR, "defer: busy after deferral");
+    sim_set_clock(50000000, 200000000);
+    ir_clock_update();
+    SIM_CHECK(count_events(IR_CLOCK_READY) == 1, "defer: no IR_CLOCK_READY");
+
+    sim_set_clock(1000000, 200000000);
+    ir_clock_update();
+    SIM_CHECK(check_ir_clock_ready() == RETURN_ERR, "defer: 1MHz APB accepted");
+    sim_set_clock(12288000, 49152000);
+    ir_clock_update();
+    SIM_CHECK(check_ir_clock_ready() == RETURN_OK, "defer: 12.288MHz APB rejected");
+
+    // 不是整数MHz的时钟, 脉宽也要准确
+    count = nec_levels(levels, nec_codes[0], 1);
+    memcpy(level_buf, levels, count * sizeof(uint16_t));
+    sim_clear();
+    SIM_CHECK(send_ir_code_start(count) == RETURN_OK, "12.288MHz: send refused");
+    sim_run_idle();
+    check_edges("12.288MHz", levels, count);
+    sim_set_clock(50000000, 200000000);
+    ir_clock_update();
+}
+
+int main(void)
+{
+    load_nec_codes();
+    SIM_CHECK(nec_code_count >= 4, "only %u NEC keys in profiles", (unsigned) nec_code_count);
+    reset_driver();
+    test_nec_send(false);
+    test_nec_send(true);
+    test_stream_send();
+    test_buffered_receive();
+    test_receive_overflow();
+    test_nec_stream_receive();
+    test_clock_switch(true);
+    test_clock_switch(false);
+    test_clock_defer();
+    printf("%s: %d failures\n", sim_failures ? "FAIL" : "PASS", sim_failures);
+    return sim_failures != 0;
+}
@@ -0,0 +1,399 @@
+/**
+ * 红外协议仿真测试: 所有协议编码后再解码的往返、加上抖动和接收头误差后的解码、
+ * 协议之间不会互相误认、ir_protocol_decode_any选出正确的协议, 经过驱动收发的完整往返, 学习时的流式NEC接收,
+ * 发送超时后停止驱动, 时钟恢复后继续推迟的发送, 以及学习波形压缩时的符号选择和保存记录的检查
+ *
+ * 编译运行: make -C tools/ir_sim test
+ */
+#include <stdio.h>
+#include <string.h>
+#include "sim_hal.h"
+#include "ir_protocol.h"
+#include "ir_code.h"
+
+// 驱动缓冲区中电平的单位是IR_DATA_DIV_COEFFICIENT us
+#define LEVEL_TO_US(level) ((int32_t) (level) * IR_DATA_DIV_COEFFICIENT)
+#define US_TO_LEVEL(us) ((uint16_t) ((us) / IR_DATA_DIV_COEFFICIENT))
+// 学习遥控器时的接收参数, 和light_ir.c一致
+#define LEARN_END_GAP_US 20000
+#define LEARN_TIMEOUT_MS 10000
+
+static uint16_t levels[IR_PROTOCOL_BUF_LEVELS];
+static uint16_t skewed[IR_PROTOCOL_BUF_LEVELS];
+
+// 各协议地址和命令的最大值
+static const uint16_t addr_max[IR_PROTO_COUNT] = { 0xFF, 0xFFFF, 0xFF, 0x1F, 0x1F, 0xFF };
+static const uint16_t cmd_max[IR_PROTO_COUNT] = { 0xFF, 0xFF, 0xFF, 0x7F, 0x7F, 0xFF };
+
+/**
+ * @brief 第一帧的电平数量, 不包括帧间隔
+ */
+static uint32_t first_frame(const uint16_t *buf, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; i += 2)
+    {
+        if (LEVEL_TO_US(buf[i]) >= IR_PROTOCOL_MIN_GAP)
+        {
+            return i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief 模拟接收头: mark变宽skew us, space变窄skew us, 再按permille千分比整体缩放
+ */
+static void distort(uint16_t *out, const uint16_t *in, uint32_t count, int32_t skew, int32_t permille)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int32_t us = LEVEL_TO_US(in[i]) + ((i & 1) == 0 ? skew : -skew);
+        out[i] = US_TO_LEVEL(us * permille / 1000);
+    }
+}
+
+static bool same_code(const ir_protocol_code_t *a, const ir_protocol_code_t *b)
+{
+    bool toggle = a->protocol == IR_PROTO_RC5 || a->protocol == IR_PROTO_RC6;
+    return a->protocol == b->protocol && a->address == b->address && a->command == b->command
+        && !b->repeat && (!toggle || a->toggle == b->toggle);
+}
+
+/**
+ * @brief NEC扩展的地址高字节刚好是低字节的反码时, 和NEC的帧完全一样
+ */
+static bool nec_alias(const ir_protocol_code_t *in, const ir_protocol_code_t *out)
+{
+    return in->protocol == IR_PROTO_NEC_EXT && out->protocol == IR_PROTO_NEC
+        && (in->address >> 8) == (uint8_t) ~in->address && out->address == (in->address & 0xFF)
+        && out->command == in->command;
+}
+
+/**
+ * @brief 检查一帧电平只能按in的协议解码, 且ir_protocol_decode_any也选出这个协议
+ */
+static void check_frame(const char *what, const ir_protocol_code_t *in, const uint16_t *buf, uint32_t count)
+{
+    const char *name = ir_protocol_get(in->protocol)->name;
+    ir_protocol_code_t out;
+
+    out.protocol = in->protocol;
+    if (ir_protocol_decode(&out, buf, count) != RETURN_OK || !same_code(in, &out))
+    {
+        SIM_CHECK(0, "%s %s a=%x c=%x t=%d: decoded a=%x c=%x t=%d repeat=%d", what, name,
+                in->address, in->command, in->toggle, out.address, out.command, out.toggle, out.repeat);
+        return;
+    }
+    if (ir_protocol_decode_any(&out, buf, count) != RETURN_OK || (!same_code(in, &out) && !nec_alias(in, &out)))
+    {
+        SIM_CHECK(0, "%s %s a=%x c=%x t=%d: decode_any gave %s a=%x c=%x", what, name,
+                in->address, in->command, in->toggle, ir_protocol_get(out.protocol)->name, out.address, out.command);
+    }
+}
+
+/**
+ * @brief 所有协议的所有命令编码后再解码, 包括理想波形、抖动和接收头的固定误差
+ */
+static void test_round_trip(void)
+{
+    int frames = 0;
+
+    for (uint8_t p = 0; p < IR_PROTO_COUNT; p++)
+    {
+        const ir_protocol_t *proto = ir_protocol_get(p);
+        uint32_t addr_step = addr_max[p] > 0xFF ? 0x1111 : 3;
+
+        for (uint32_t a = 0; a <= addr_max[p]; a += addr_step)
+        {
+            for (uint32_t c = 0; c <= cmd_max[p]; c++)
+            {
+                for (int t = 0; t < 2; t++)
+                {
+                    ir_protocol_code_t in = { p, t, false, a, c };
+                    uint32_t count = ir_protocol_encode(&in, 2, levels, IR_PROTOCOL_BUF_LEVELS);
+                    uint32_t frame;
+
+                    if (count == 0)
+                    {
+                        SIM_CHECK(0, "%s a=%x c=%x: encode failed", proto->name, a, c);
+                        continue;
+                    }
+                    frame = first_frame(levels, count);
+                    check_frame("ideal", &in, levels, frame + 1);
+                    // 接收头让mark变宽、space变窄, 遥控器的时钟也有偏差
+                    for (int skew = -40; skew <= 100; skew += 70)
+                    {
+                        for (int permille = 960; permille <= 1040; permille += 40)
+                        {
+                            distort(skewed, levels, frame + 1, skew, permille);
+                            check_frame("distorted", &in, skewed, frame + 1);
+                        }
+                    }
+                    // 有重复码的协议, 第二帧是重复码
+                    if (proto->repeat[0] != 0)
+                    {
+                        ir_protocol_code_t out = { p };
+                        uint32_t next = frame + 1;
+                        uint32_t end = next + first_frame(levels + next, count - next);
+                        SIM_CHECK(ir_protocol_decode(&out, levels + next, end - next + 1) == RETURN_OK && out.repeat,
+                                "%s: repeat code not decoded", proto->name);
+                    }
+                    // 只有NEC扩展能把NEC的帧当成地址高字节恰好是反码的帧
+                    for (uint8_t q = 0; q < IR_PROTO_COUNT; q++)
+                    {
+                        ir_protocol_code_t out = { q };
+                        if (q == p || (p == IR_PROTO_NEC && q == IR_PROTO_NEC_EXT)
+                            || (p == IR_PROTO_NEC_EXT && q == IR_PROTO_NEC))
+                        {
+                            continue;
+                        }
+                        SIM_CHECK(ir_protocol_decode(&out, levels, frame + 1) != RETURN_OK || out.repeat,
+                                "%s a=%x c=%x decoded as %s", proto->name, a, c, ir_protocol_get(q)->name);
+                    }
+                    frames++;
+                }
+            }
+        }
+    }
+    printf("round trip: %d frames\n", frames);
+}
+
+/**
+ * @brief 从start时刻开始把记录的载波边沿送给接收管脚, 接收头让mark变宽skew us
+ */
+static void replay_skewed(uint64_t start, int32_t skew)
+{
+    for (int i = 0; i < sim_edge_count; i++)
+    {
+        uint64_t t = start + (sim_edges[i].time - sim_edges[0].time);
+        sim_schedule_rx(sim_edges[i].on ? t : t + SIM_US(skew), sim_edges[i].on ? 0 : 1);
+    }
+}
+
+/**
+ * @brief 经过驱动发送, 把发射管脚的波形送回接收管脚, 学习遥控器的流程能解出同一个按键
+ */
+static void test_driver_round_trip(void)
+{
+    static const ir_protocol_code_t codes[] =
+    {
+        { IR_PROTO_NEC, false, false, 0x00, 0x45 },
+        { IR_PROTO_NEC_EXT, false, false, 0xEF00, 0x03 },
+        { IR_PROTO_SAMSUNG, false, false, 0x07, 0x02 },
+        { IR_PROTO_SONY12, false, false, 0x01, 0x15 },
+        { IR_PROTO_SONY12, false, false, 0x1F, 0x7F },
+        { IR_PROTO_RC5, false, false, 0x00, 0x0C },
+        { IR_PROTO_RC5, false, false, 0x1F, 0x7F },
+        // 按宽松的误差也能解成索尼的帧
+        { IR_PROTO_RC5, false, false, 0x00, 0x40 },
+        { IR_PROTO_RC6, false, false, 0x00, 0x0C },
+    };
+    stIrPinInfo info;
+
+    SIM_CHECK(ir_protocol_pin_info(&info) == RETURN_OK, "pin info");
+    ir_setPinInfo(&info);
+    SIM_CHECK(ir_protocol_init() == RETURN_OK, "ir_protocol_init");
+    ir_hw_init();
+
+    for (uint32_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+    {
+        const ir_protocol_code_t *in = &codes[i];
+        const char *name = ir_protocol_get(in->protocol)->name;
+
+        for (int skew = 0; skew <= 150; skew += 50)
+        {
+            const uint16_t *received = NULL;
+            ir_protocol_code_t out;
+            uint32_t count;
+
+            sim_clear();
+            if (ir_protocol_send(in->protocol, in->address, in->command, 0) != RETURN_OK)
+            {
+                SIM_CHECK(0, "%s a=%x c=%x: send failed", name, in->address, in->command);
+                continue;
+            }
+            replay_skewed(sim_now + SIM_MS(5), skew);
+            count = ir_protocol_receive(&received, LEARN_END_GAP_US, LEARN_TIMEOUT_MS);
+            sim_run_idle();
+            if (count == 0)
+            {
+                SIM_CHECK(0, "%s a=%x c=%x skew %d: nothing received", name, in->address, in->command, skew);
+                continue;
+            }
+            if (ir_protocol_decode_any(&out, received, count) != RETURN_OK || out.protocol != in->protocol
+                || out.address != in->address || out.command != in->command || out.repeat)
+            {
+                SIM_CHECK(0, "%s a=%x c=%x skew %d: received as %s a=%x c=%x", name, in->address, in->command,
+                        skew, ir_protocol_get(out.protocol)->name, out.address, out.command);
+            }
+        }
+    }
+}
+
+/**
+ * @brief 流式NEC接收收完最后一位就返回NEC的码, 其他协议在第一个对不上的载波后就返回
+ */
+static void test_receive_nec(void)
+{
+    static const ir_protocol_code_t codes[] =
+    {
+        { IR_PROTO_NEC, false, false, 0x00, 0x45 },
+        { IR_PROTO_NEC_EXT, false, false, 0xEF00, 0x03 },
+        { IR_PROTO_SAMSUNG, false, false, 0x07, 0x02 },
+        { IR_PROTO_SONY12, false, false, 0x01, 0x15 },
+        { IR_PROTO_RC5, false, false, 0x00, 0x0C },
+        { IR_PROTO_RC6, false, false, 0x00, 0x0C },
+    };
+
+    for (uint32_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+    {
+        const ir_protocol_code_t *in = &codes[i];
+        const char *name = ir_protocol_get(in->protocol)->name;
+        bool nec = in->protocol == IR_PROTO_NEC || in->protocol == IR_PROTO_NEC_EXT;
+        ir_protocol_code_t out;
+        uint64_t start, end;
+        bool other;
+        int ret;
+
+        sim_clear();
+        // 按住按键, 后面跟着重复码或重复的帧
+        if (ir_protocol_send(in->protocol, in->address, in->command, 3) != RETURN_OK)
+        {
+            SIM_CHECK(0, "receive nec %s: send failed", name);
+            continue;
+        }
+        start = sim_now + SIM_MS(5);
+        replay_skewed(start, 50);
+        // 第一帧最后一个边沿的时刻
+        end = start + (sim_edges[nec ? 67 : 1].time - sim_edges[0].time);
+        ret = ir_protocol_receive_nec(&out, &other, LEARN_TIMEOUT_MS);
+        SIM_CHECK(sim_now < end + SIM_MS(1), "receive nec %s: returned %.0fus after the frame", name,
+                sim_to_us(sim_now - end));
+        sim_run_idle();
+        if (nec)
+        {
+            SIM_CHECK(ret == RETURN_OK && !other && out.protocol == in->protocol && out.address == in->address
+                && out.command == in->command, "receive nec %s: ret %d other %d, got %s a=%x c=%x", name, ret, other,
+                ir_protocol_get(out.protocol)->name, out.address, out.command);
+        }
+        else
+        {
+            SIM_CHECK(ret == RETURN_ERR && other, "receive nec %s: ret %d other %d", name, ret, other);
+        }
+        SIM_CHECK(check_ir_busy_state() == RETURN_ERR, "receive nec %s: driver still busy", name);
+    }
+}
+
+typedef struct
+{
+    uint32_t remain; // 还要产生的电平数
+    uint32_t calls;  // 生成器被调用的次数
+} long_stream_t;
+
+static bool long_stream_next(void *arg, uint16_t *level)
+{
+    long_stream_t *stream = arg;
+
+    stream->calls++;
+    if (stream->remain == 0)
+    {
+        return false;
+    }
+    stream->remain--;
+    *level = US_TO_LEVEL(10000);
+    return true;
+}
+
+/**
+ * @brief 流式发送超时返回后, 驱动不能再调用生成器, 它的参数在调用者的栈上
+ */
+static void test_send_timeout(void)
+{
+    long_stream_t stream = { 100, 0 };
+    uint32_t calls;
+    int edges;
+
+    sim_clear();
+    // 100个10ms的电平要发1s, 50ms就超时
+    SIM_CHECK(ir_protocol_send_stream(long_stream_next, &stream, 50) == RETURN_ERR, "stream send did not time out");
+    calls = stream.calls;
+    edges = sim_edge_count;
+    SIM_CHECK(calls > 0 && calls < 100, "generator called %u times before timeout", calls);
+    sim_run_until(sim_now + SIM_MS(2000));
+    SIM_CHECK(stream.calls == calls, "generator called %u times after timeout", stream.calls - calls);
+    SIM_CHECK(sim_edge_count == edges && (edges == 0 || !sim_edges[edges - 1].on),
+            "carrier still running after timeout");
+    // 超时后驱动空闲, 还能正常发送
+    SIM_CHECK(ir_protocol_send(IR_PROTO_NEC, 0x00, 0x45, 0) == RETURN_OK, "send after timeout failed");
+}
+
+static void clock_restore(void)
+{
+    sim_set_clock(50000000, 200000000);
+    ir_clock_update();
+}
+
+/**
+ * @brief 时钟不能准确产生载波时发送推迟, 时钟恢复后的IR_CLOCK_READY在中断或任务中都能唤醒发送
+ */
+static void test_clock_ready(void)
+{
+    uint64_t start;
+
+    // 在中断中恢复时钟, 推迟的发送接着发出去
+    sim_set_clock(50000000, 10000000);
+    ir_clock_update();
+    sim_clear();
+    start = sim_now;
+    sim_schedule_isr(sim_now + SIM_MS(200), clock_restore);
+    SIM_CHECK(ir_protocol_send(IR_PROTO_NEC, 0x00, 0x45, 0) == RETURN_OK, "deferred send failed");
+    SIM_CHECK(sim_edge_count > 0 && sim_edges[0].time >= start + SIM_MS(200), "send not deferred until clock ready");
+    SIM_CHECK(sim_stats.isr_pwm_inits == 0, "carrier configured in ISR");
+
+    // 在任务中恢复时钟, 回调在任务中, 不能用FromISR的接口
+    sim_set_clock(50000000, 10000000);
+    ir_clock_update();
+    sim_clear();
+    clock_restore();
+    SIM_CHECK(sim_stats.from_isr_in_task == 0, "FromISR API called from task");
+    SIM_CHECK(ir_protocol_send(IR_PROTO_NEC, 0x00, 0x45, 0) == RETURN_OK, "send after clock ready failed");
+}
+
+/**
+ * @brief 压缩时电平归到最接近的符号, 损坏的压缩码通不过检查
+ */
+static void test_ir_code(void)
+{
+    // 640在两个符号的误差范围内, 离700更近
+    static const uint16_t in[] = { 500, 700, 640, 500, 700, 500 };
+    uint16_t out[8];
+    uint8_t code[32];
+    uint32_t size = ir_code_compress(in, 6, code, sizeof(code));
+
+    SIM_CHECK(size > 0, "ir_code: compress failed");
+    SIM_CHECK(ir_code_decompress(code, out, 8) == 6, "ir_code: decompress failed");
+    SIM_CHECK(out[2] == out[1] && out[2] != out[0], "ir_code: 640 went to %u, not %u", out[2], out[1]);
+    SIM_CHECK(ir_code_check(code, size), "ir_code: valid code rejected");
+    SIM_CHECK(!ir_code_check(code, size - 1) && !ir_code_check(code, size + 1), "ir_code: wrong size accepted");
+
+    // 3个符号用2位下标, 下标3指到符号表外面
+    static const uint16_t three[] = { 500, 1000, 2000, 500 };
+    size = ir_code_compress(three, 4, code, sizeof(code));
+    SIM_CHECK(size > 0 && code[2] == 3 && ir_code_check(code, size), "ir_code: 3 symbols");
+    code[size - 1] |= 0xC0;
+    SIM_CHECK(!ir_code_check(code, size), "ir_code: symbol index out of range accepted");
+    code[2] = 0;
+    SIM_CHECK(!ir_code_check(code, size), "ir_code: no symbols accepted");
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_driver_round_trip();
+    test_receive_nec();
+    test_send_timeout();
+    test_clock_ready();
+    test_ir_code();
+    printf("%s: %d failures\n", sim_failures ? "FAIL" : "PASS", sim_failures);
+    return sim_failures != 0;
+}
@@ -0,0 +1,561 @@
+#include "sim_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "hw_timer.h"
+
+#define TIMER_COUNT 4
+#define PAD_COUNT 6
+#define PWM_COUNT 6
+#define SEM_COUNT 8
+#define CALL_COUNT 8
+
+typedef struct
+{
+    bool running;
+    uint32_t count;
+    uint64_t expiry;
+    void (*isr)(void);
+} sim_timer_t;
+
+typedef struct
+{
+    uint64_t time;
+    int level;
+} sim_rx_t;
+
+typedef struct
+{
+    uint64_t time;
+    void (*fn)(void);
+} sim_call_t;
+
+int sim_failures = 0;
+uint64_t sim_now = 0;
+uint32_t sim_hal_cost = 100;
+sim_stats_t sim_stats;
+sim_edge_t sim_edges[SIM_MAX_EDGES];
+int sim_edge_count = 0;
+
+static uint32_t apb_hz = 50000000;
+static uint32_t core_hz = 200000000;
+static sim_timer_t timers[TIMER_COUNT];
+static int pad_function[PAD_COUNT];
+static bool pwm_running[PWM_COUNT];
+static bool carrier = false;
+static int rx_level = 1;
+static bool rx_masked = true;
+static gpio_irq_callback_list_t *gpio_callback = NULL;
+static sim_rx_t rx_queue[SIM_MAX_EDGES];
+static int rx_head = 0, rx_tail = 0;
+static int isr_depth = 0;
+static sim_call_t calls[CALL_COUNT];
+static int sems[SEM_COUNT];
+static int sem_used = 0;
+
+/**
+ * @brief 每次HAL调用都要花时间, 中断里寄存器访问越多, 边沿就越晚
+ */
+static void hal_call(void)
+{
+    sim_stats.hal_calls++;
+    sim_now += sim_hal_cost;
+}
+
+/**
+ * @brief 发射管脚是PWM3_PAD, 复用为PWM3且PWM3在运行时才有载波
+ */
+static void update_carrier(void)
+{
+    bool on = pwm_running[PWM3 - PWM0] && pad_function[PWM3_PAD] == SECOND_FUNCTION;
+    if (on != carrier && sim_edge_count < SIM_MAX_EDGES)
+    {
+        sim_edges[sim_edge_count].time = sim_now;
+        sim_edges[sim_edge_count].on = on;
+        sim_edge_count++;
+    }
+    carrier = on;
+}
+
+static sim_timer_t *timer_of(uint32_t base)
+{
+    if (base < TIMER0 || base >= TIMER0 + TIMER_COUNT)
+    {
+        fprintf(stderr, "sim: bad timer base %x\n", base);
+        exit(2);
+    }
+    return &timers[base - TIMER0];
+}
+
+void sim_set_clock(uint32_t apb, uint32_t core)
+{
+    // 正在计数的定时器剩下的计数值按新的时钟走完
+    for (int i = 0; i < TIMER_COUNT; i++)
+    {
+        if (timers[i].running && timers[i].expiry > sim_now)
+        {
+            timers[i].expiry = sim_now + (timers[i].expiry - sim_now) * apb_hz / apb;
+        }
+    }
+    apb_hz = apb;
+    core_hz = core;
+}
+
+double sim_to_us(uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+/**
+ * @brief 定时器计数值换算成纳秒, 时钟切换后按新的APB时钟计时
+ */
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return ticks * 1000000000 / apb_hz;
+}
+
+uint32_t sim_mcycle(void)
+{
+    return (uint32_t) (sim_now * core_hz / 1000000000);
+}
+
+bool sim_in_isr(void)
+{
+    return isr_depth > 0;
+}
+
+int check_curr_trap(void)
+{
+    return isr_depth;
+}
+
+void sim_call_in_isr(void (*fn)(void))
+{
+    isr_depth++;
+    fn();
+    isr_depth--;
+}
+
+void sim_log_mark(void)
+{
+    if (isr_depth > 0)
+    {
+        sim_stats.isr_logs++;
+    }
+}
+
+void sim_clear(void)
+{
+    sim_edge_count = 0;
+    memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+/**
+ * @brief 找到最早到期的定时器
+ */
+static sim_timer_t *next_timer(void)
+{
+    sim_timer_t *next = NULL;
+    for (int i = 0; i < TIMER_COUNT; i++)
+    {
+        if (timers[i].running && (next == NULL || timers[i].expiry < next->expiry))
+        {
+            next = &timers[i];
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief 找到最早的排队调用
+ */
+static sim_call_t *next_call(void)
+{
+    sim_call_t *next = NULL;
+    for (int i = 0; i < CALL_COUNT; i++)
+    {
+        if (calls[i].fn != NULL && (next == NULL || calls[i].time < next->time))
+        {
+            next = &calls[i];
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief 执行下一个不晚于t的事件
+ * @return 没有这样的事件时返回false
+ */
+static bool step(uint64_t t)
+{
+    sim_timer_t *timer = next_timer();
+    sim_call_t *call = next_call();
+    bool rx = rx_head != rx_tail && rx_queue[rx_head].time <= t;
+
+    if (call != NULL && call->time <= t && (timer == NULL || call->time <= timer->expiry)
+        && (!rx || call->time <= rx_queue[rx_head].time))
+    {
+        void (*fn)(void) = call->fn;
+        if (call->time > sim_now)
+        {
+            sim_now = call->time;
+        }
+        call->fn = NULL;
+        sim_call_in_isr(fn);
+        return true;
+    }
+
+    if (timer != NULL && timer->expiry <= t && (!rx || timer->expiry <= rx_queue[rx_head].time))
+    {
+        // 单次模式, 到期后停止, 中断里再重新装载
+        if (timer->expiry > sim_now)
+        {
+            sim_now = timer->expiry;
+        }
+        timer->running = false;
+        sim_stats.timer_isrs++;
+        isr_depth++;
+        timer->isr();
+        isr_depth--;
+        return true;
+    }
+    if (rx)
+    {
+        if (rx_queue[rx_head].time > sim_now)
+        {
+            sim_now = rx_queue[rx_head].time;
+        }
+        rx_level = rx_queue[rx_head].level;
+        rx_head = (rx_head + 1) % SIM_MAX_EDGES;
+        if (!rx_masked && gpio_callback != NULL)
+        {
+            sim_stats.gpio_isrs++;
+            isr_depth++;
+            gpio_callback->cb();
+            isr_depth--;
+        }
+        return true;
+    }
+    return false;
+}
+
+void sim_run_until(uint64_t t)
+{
+    while (step(t))
+    {
+    }
+    if (t > sim_now)
+    {
+        sim_now = t;
+    }
+}
+
+void sim_run_idle(void)
+{
+    while (step(UINT64_MAX))
+    {
+    }
+}
+
+void sim_schedule_rx(uint64_t t, int level)
+{
+    int next = (rx_tail + 1) % SIM_MAX_EDGES;
+    if (next == rx_head)
+    {
+        fprintf(stderr, "sim: rx queue full\n");
+        exit(2);
+    }
+    rx_queue[rx_tail].time = t;
+    rx_queue[rx_tail].level = level;
+    rx_tail = next;
+}
+
+void sim_schedule_isr(uint64_t t, void (*fn)(void))
+{
+    for (int i = 0; i < CALL_COUNT; i++)
+    {
+        if (calls[i].fn == NULL)
+        {
+            calls[i].time = t;
+            calls[i].fn = fn;
+            return;
+        }
+    }
+    fprintf(stderr, "sim: too many scheduled calls\n");
+    exit(2);
+}
+
+void sim_replay_edges(uint64_t start)
+{
+    for (int i = 0; i < sim_edge_count; i++)
+    {
+        // 接收头输出反相, 有载波时为低电平
+        sim_schedule_rx(start + (sim_edges[i].time - sim_edges[0].time), sim_edges[i].on ? 0 : 1);
+    }
+}
+
+/* 时钟 */
+
+uint32_t get_apb_clk(void)
+{
+    return apb_hz;
+}
+
+uint32_t get_ipcore_clk(void)
+{
+    return core_hz;
+}
+
+/* SCU */
+
+void Scu_SetDeviceGate(uint32_t base, int enable)
+{
+}
+
+void Scu_SetIOReuse(int pad, int function)
+{
+    hal_call();
+    if (pad >= 0 && pad < PAD_COUNT)
+    {
+        pad_function[pad] = function;
+    }
+    update_carrier();
+}
+
+void Scu_SetIOPull(int pad, int enable)
+{
+}
+
+/* PWM */
+
+void pwm_init(pwm_base_t base, pwm_init_t init)
+{
+    hal_call();
+    if (isr_depth > 0)
+    {
+        sim_stats.isr_pwm_inits++;
+    }
+    else
+    {
+        sim_stats.pwm_inits++;
+    }
+}
+
+void pwm_start(pwm_base_t base)
+{
+    hal_call();
+    pwm_running[base - PWM0] = true;
+    update_carrier();
+}
+
+void pwm_stop(pwm_base_t base)
+{
+    hal_call();
+    pwm_running[base - PWM0] = false;
+    update_carrier();
+}
+
+/* 定时器 */
+
+void timer_init(timer_base_t base, timer_init_t init)
+{
+    timer_of(base)->count = init.count;
+}
+
+void timer_start(timer_base_t base)
+{
+    sim_timer_t *timer = timer_of(base);
+    hal_call();
+    timer->running = true;
+    timer->expiry = sim_now + ticks_to_ns(timer->count);
+}
+
+void timer_stop(timer_base_t base)
+{
+    hal_call();
+    timer_of(base)->running = false;
+}
+
+void timer_set_count(timer_base_t base, uint32_t count)
+{
+    hal_call();
+    timer_of(base)->count = count;
+}
+
+void timer_get_count(timer_base_t base, unsigned int *count)
+{
+    sim_timer_t *timer = timer_of(base);
+    hal_call();
+    *count = timer->running && timer->expiry > sim_now
+            ? (unsigned int) ((timer->expiry - sim_now) * apb_hz / 1000000000) : 0;
+}
+
+void timer_clear_irq(timer_base_t base)
+{
+    hal_call();
+}
+
+/* GPIO, 只模拟接收管脚 */
+
+void gpio_set_output_mode(gpio_base_t base, gpio_pin_t pin)
+{
+}
+
+void gpio_set_input_mode(gpio_base_t base, gpio_pin_t pin)
+{
+}
+
+void gpio_set_output_level_single(gpio_base_t base, gpio_pin_t pin, int level)
+{
+    hal_call();
+}
+
+int gpio_get_input_level_single(gpio_base_t base, gpio_pin_t pin)
+{
+    hal_call();
+    return rx_level;
+}
+
+void registe_gpio_callback(gpio_base_t base, gpio_irq_callback_list_t *callback)
+{
+    gpio_callback = callback;
+}
+
+void gpio_irq_mask(gpio_base_t base, gpio_pin_t pin)
+{
+    rx_masked = true;
+}
+
+void gpio_irq_unmask(gpio_base_t base, gpio_pin_t pin)
+{
+    rx_masked = false;
+}
+
+int gpio_get_irq_mask_status_single(gpio_base_t base, gpio_pin_t pin)
+{
+    hal_call();
+    return !rx_masked;
+}
+
+void gpio_clear_irq_single(gpio_base_t base, gpio_pin_t pin)
+{
+}
+
+void gpio_irq_trigger_config(gpio_base_t base, gpio_pin_t pin, int trigger)
+{
+}
+
+/* 中断控制器 */
+
+void __eclic_irq_set_vector(int irq, int handler)
+{
+    void (*isr)(void) = (void (*)(void)) (intptr_t) handler;
+    if ((int) (intptr_t) isr != handler || irq < TIMER0_IRQn || irq >= TIMER0_IRQn + TIMER_COUNT)
+    {
+        fprintf(stderr, "sim: bad vector for irq %d, build with -no-pie\n", irq);
+        exit(2);
+    }
+    timers[irq - TIMER0_IRQn].isr = isr;
+}
+
+void eclic_irq_enable(int irq)
+{
+}
+
+void eclic_irq_disable(int irq)
+{
+}
+
+/* 硬件定时器分配, 红外总是用TIMER0 */
+
+int hw_timer_alloc(const char *owner, timer_base_t *timer)
+{
+    *timer = TIMER0;
+    return RETURN_OK;
+}
+
+IRQn_Type hw_timer_irq(timer_base_t timer)
+{
+    return TIMER0_IRQn + (timer - TIMER0);
+}
+
+/* FreeRTOS, 只有一个任务, 等待信号量时推进虚拟时钟 */
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t) (sim_now / 1000000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_run_until(sim_now + SIM_MS(ticks));
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    if (sem_used >= SEM_COUNT)
+    {
+        return NULL;
+    }
+    sems[sem_used] = 0;
+    return &sems[sem_used++];
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return xSemaphoreCreateBinary();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    int *count = sem;
+    uint64_t deadline = ticks == portMAX_DELAY ? UINT64_MAX : sim_now + SIM_MS(ticks);
+
+    if (isr_depth > 0)
+    {
+        fprintf(stderr, "sim: xSemaphoreTake in ISR\n");
+        exit(2);
+    }
+    while (*count == 0 && step(deadline))
+    {
+    }
+    if (*count == 0)
+    {
+        if (deadline != UINT64_MAX && deadline > sim_now)
+        {
+            sim_now = deadline;
+        }
+        return pdFALSE;
+    }
+    (*count)--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    *(int *) sem = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+    if (isr_depth == 0)
+    {
+        sim_stats.from_isr_in_task++;
+    }
+    *(int *) sem = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    return pdTRUE;
+}
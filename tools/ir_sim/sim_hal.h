@@ -0,0 +1,109 @@
+/**
+ * 红外驱动主机仿真: 用虚拟时钟代替定时器、PWM、GPIO和FreeRTOS, 记录发射管脚上载波的起止时刻,
+ * 并可以把边沿按时刻送给接收管脚, 驱动和ir_protocol不用修改就能在电脑上运行
+ */
+#ifndef _SIM_HAL_H
+#define _SIM_HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "ir_remote_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 最多记录的载波边沿数, 也是最多排队的接收边沿数
+#define SIM_MAX_EDGES 8192
+
+typedef struct
+{
+    uint64_t time; // 虚拟时钟, 单位ns
+    bool on;       // 之后有没有载波
+} sim_edge_t;
+
+typedef struct
+{
+    uint32_t hal_calls;        // HAL函数调用次数
+    uint32_t timer_isrs;       // 定时器中断次数
+    uint32_t gpio_isrs;        // 接收管脚中断次数
+    uint32_t pwm_inits;        // pwm_init次数, 不包括在中断中调用的
+    uint32_t isr_pwm_inits;    // 在中断中调用pwm_init的次数
+    uint32_t from_isr_in_task; // 在任务中调用xSemaphoreGiveFromISR的次数
+    uint32_t isr_logs;         // 在中断中打印错误和警告日志的次数
+} sim_stats_t;
+
+// 检查失败的次数
+extern int sim_failures;
+#define SIM_CHECK(cond, ...) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            sim_failures++; \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+// 虚拟时钟的单位是ns, 定时器计数值按当前APB时钟换算
+#define SIM_US(us) ((uint64_t) (us) * 1000)
+#define SIM_MS(ms) ((uint64_t) (ms) * 1000000)
+
+// 当前虚拟时钟
+extern uint64_t sim_now;
+// 每次HAL调用消耗的时间, 单位ns, 用来模拟中断里寄存器访问的耗时, 默认100, 即200MHz主频下20个周期
+extern uint32_t sim_hal_cost;
+extern sim_stats_t sim_stats;
+// 发射管脚上的载波边沿
+extern sim_edge_t sim_edges[SIM_MAX_EDGES];
+extern int sim_edge_count;
+
+/**
+ * @brief 切换APB和CPU时钟, 正在计数的定时器剩下的计数按新时钟走完, 驱动要调用ir_clock_update才知道
+ */
+void sim_set_clock(uint32_t apb_hz, uint32_t core_hz);
+/**
+ * @brief 虚拟时钟的ns换算成us
+ */
+double sim_to_us(uint64_t ns);
+/**
+ * @brief 推进虚拟时钟到t, 依次执行期间到期的定时器中断和排队的接收边沿
+ */
+void sim_run_until(uint64_t t);
+/**
+ * @brief 一直运行到定时器停止并且没有排队的接收边沿
+ */
+void sim_run_idle(void);
+/**
+ * @brief 在时刻t把接收管脚设为level, 接收头空闲为高电平, 有载波时为低电平
+ */
+void sim_schedule_rx(uint64_t t, int level);
+/**
+ * @brief 把记录的载波边沿从start时刻开始排队送给接收管脚
+ */
+void sim_replay_edges(uint64_t start);
+/**
+ * @brief 清空载波边沿记录和统计
+ */
+void sim_clear(void);
+/**
+ * @brief 是否有中断正在执行, 用于检查函数是不是在中断中被调用
+ */
+bool sim_in_isr(void);
+/**
+ * @brief 在中断上下文中调用fn, 模拟在其他中断中调用驱动函数
+ */
+void sim_call_in_isr(void (*fn)(void));
+/**
+ * @brief 在时刻t以中断上下文调用fn, 如模拟切换功耗模式的中断
+ */
+void sim_schedule_isr(uint64_t t, void (*fn)(void));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
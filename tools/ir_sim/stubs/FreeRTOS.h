@@ -0,0 +1,21 @@
+#ifndef _SIM_FREERTOS_H
+#define _SIM_FREERTOS_H
+
+#include "sim_sdk.h"
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+
+#endif
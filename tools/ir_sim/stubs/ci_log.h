@@ -0,0 +1,19 @@
+#ifndef _CI_LOG_H
+#define _CI_LOG_H
+
+#include <stdio.h>
+
+#define LOG_USER 0
+#define LOG_IR 0
+#define CI_LOG_DEBUG 3
+
+// 记下在中断里打印日志的次数, 串口日志会拖长中断
+void sim_log_mark(void);
+
+// 仿真只打印错误, 驱动每次发送都有的info日志会淹没测试结果
+#define ci_logerr(module, ...) (sim_log_mark(), printf(__VA_ARGS__))
+#define ci_logwarn(module, ...) (sim_log_mark(), printf(__VA_ARGS__))
+#define ci_loginfo(module, ...) ((void) 0)
+#define ci_logdebug(module, ...) ((void) 0)
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ * 红外驱动主机仿真用的SDK替身, 只声明驱动、ir_protocol用到的类型和函数, 实现在sim_hal.c
+ */
+#ifndef _SIM_SDK_H
+#define _SIM_SDK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ci_log.h"
+
+#define RETURN_OK 0
+#define RETURN_ERR -1
+#define ENABLE 1
+#define DISABLE 0
+
+typedef int PinPad_Name;
+typedef int IOResue_FUNCTION;
+typedef int IRQn_Type;
+typedef int gpio_pin_t;
+typedef uint32_t gpio_base_t;
+typedef uint32_t pwm_base_t;
+typedef uint32_t timer_base_t;
+
+enum { PWM0_PAD, PWM1_PAD, PWM2_PAD, PWM3_PAD, PWM4_PAD, PWM5_PAD };
+enum { FIRST_FUNCTION, SECOND_FUNCTION, THIRD_FUNCTION };
+enum { gpio_pin_0, gpio_pin_1, gpio_pin_2, gpio_pin_3, gpio_pin_4, gpio_pin_5, gpio_pin_6, gpio_pin_7 };
+enum { TIMER0_IRQn = 10, TIMER1_IRQn, TIMER2_IRQn, TIMER3_IRQn, GPIO0_IRQn, GPIO1_IRQn, GPIO2_IRQn };
+enum { both_edges_trigger };
+
+#define GPIO0 0x1000
+#define GPIO1 0x1001
+#define GPIO2 0x1002
+#define PWM0 0x2000
+#define PWM1 0x2001
+#define PWM2 0x2002
+#define PWM3 0x2003
+#define PWM4 0x2004
+#define PWM5 0x2005
+#define TIMER0 0x3000
+#define TIMER1 0x3001
+#define TIMER2 0x3002
+#define TIMER3 0x3003
+
+typedef struct
+{
+    int clk_sel;
+    uint32_t freq;
+    uint32_t duty;
+    uint32_t duty_max;
+} pwm_init_t;
+
+typedef enum { timer_count_mode_single, timer_count_mode_auto } timer_count_mode_t;
+typedef enum { timer_clk_div_0 } timer_clk_div_t;
+typedef enum { timer_iqr_width_2, timer_iqr_width_f } timer_iqr_width_t;
+
+typedef struct
+{
+    timer_count_mode_t mode;
+    timer_clk_div_t div;
+    timer_iqr_width_t width;
+    uint32_t count;
+} timer_init_t;
+
+typedef struct gpio_irq_callback_list
+{
+    void (*cb)(void);
+    struct gpio_irq_callback_list *next;
+} gpio_irq_callback_list_t;
+
+uint32_t get_apb_clk(void);
+uint32_t get_ipcore_clk(void);
+
+void Scu_SetDeviceGate(uint32_t base, int enable);
+void Scu_SetIOReuse(int pad, int function);
+void Scu_SetIOPull(int pad, int enable);
+
+void pwm_init(pwm_base_t base, pwm_init_t init);
+void pwm_start(pwm_base_t base);
+void pwm_stop(pwm_base_t base);
+
+void timer_init(timer_base_t base, timer_init_t init);
+void timer_start(timer_base_t base);
+void timer_stop(timer_base_t base);
+void timer_set_count(timer_base_t base, uint32_t count);
+void timer_get_count(timer_base_t base, unsigned int *count);
+void timer_clear_irq(timer_base_t base);
+
+void gpio_set_output_mode(gpio_base_t base, gpio_pin_t pin);
+void gpio_set_input_mode(gpio_base_t base, gpio_pin_t pin);
+void gpio_set_output_level_single(gpio_base_t base, gpio_pin_t pin, int level);
+int gpio_get_input_level_single(gpio_base_t base, gpio_pin_t pin);
+void registe_gpio_callback(gpio_base_t base, gpio_irq_callback_list_t *callback);
+void gpio_irq_mask(gpio_base_t base, gpio_pin_t pin);
+void gpio_irq_unmask(gpio_base_t base, gpio_pin_t pin);
+int gpio_get_irq_mask_status_single(gpio_base_t base, gpio_pin_t pin);
+void gpio_clear_irq_single(gpio_base_t base, gpio_pin_t pin);
+void gpio_irq_trigger_config(gpio_base_t base, gpio_pin_t pin, int trigger);
+
+void __eclic_irq_set_vector(int irq, int handler);
+void eclic_irq_enable(int irq);
+void eclic_irq_disable(int irq);
+
+// 在中断中返回非0
+int check_curr_trap(void);
+
+// mcycle由仿真的虚拟时钟换算
+uint32_t sim_mcycle(void);
+#define read_csr(reg) sim_mcycle()
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * PWM夜灯供电电流模型, 在电脑上运行, 对比各路PWM同时导通和按pwm_phase_plan错开相位时的峰值和有效值电流
+ *
+ * 编译: gcc -I../src -o pwm_current_model pwm_current_model.c ../src/pwm_phase.c
+ * 用法: pwm_current_model [电流mA 占空比% ...]
+ *      不带参数时计算light_pwm.c中暖白/冷白两路在各档色温最亮时的情况, 以及几组多路的例子
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "pwm_phase.h"
+
+// 用足够细的时间单位表示一个周期, 占空比按万分之一取整
+#define PERIOD 10000
+
+// 和light_pwm.c的标定参数一致
+#define CCT_STEPS 5
+#define CCT_WARM_FLUX 85.0
+#define CCT_COOL_FLUX 100.0
+#define CCT_DUTY_CAP 100.0
+#define CCT_CHANNEL_MA 60
+
+static void report(const char *name, const uint32_t *current, const double *percent, int count)
+{
+    uint32_t duty[PWM_PHASE_MAX_CHANNELS], offset[PWM_PHASE_MAX_CHANNELS];
+    uint32_t peak0, rms0, peak1, rms1;
+
+    for (int i = 0; i < count; i++)
+    {
+        duty[i] = (uint32_t) (percent[i] * PERIOD / 100 + 0.5);
+    }
+    pwm_phase_current(duty, NULL, current, count, PERIOD, &peak0, &rms0);
+    pwm_phase_plan(duty, count, PERIOD, offset);
+    pwm_phase_current(duty, offset, current, count, PERIOD, &peak1, &rms1);
+
+    printf("%-24s", name);
+    for (int i = 0; i < count; i++)
+    {
+        printf(" %umA@%5.1f%%", (unsigned int) current[i], percent[i]);
+    }
+    printf("\n    aligned:   peak %4u mA, rms %4u mA\n", (unsigned int) peak0, (unsigned int) rms0);
+    printf("    staggered: peak %4u mA, rms %4u mA, offsets", (unsigned int) peak1, (unsigned int) rms1);
+    for (int i = 0; i < count; i++)
+    {
+        printf(" %5.1f%%", offset[i] * 100.0 / PERIOD);
+    }
+    printf("\n");
+}
+
+static void report_cct(void)
+{
+    double flux_max = (CCT_WARM_FLUX < CCT_COOL_FLUX ? CCT_WARM_FLUX : CCT_COOL_FLUX)
+            * (CCT_DUTY_CAP < 100.0 ? CCT_DUTY_CAP / 100.0 : 1.0);
+    uint32_t current[2] = { CCT_CHANNEL_MA, CCT_CHANNEL_MA };
+
+    for (int i = 0; i < CCT_STEPS; i++)
+    {
+        double share = (double) i / (CCT_STEPS - 1);
+        double percent[2] =
+        {
+            flux_max * (1 - share) / CCT_WARM_FLUX * 100,
+            flux_max * share / CCT_COOL_FLUX * 100,
+        };
+        char name[32];
+        snprintf(name, sizeof(name), "cct %d/%d", i, CCT_STEPS - 1);
+        report(name, current, percent, 2);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        uint32_t current[PWM_PHASE_MAX_CHANNELS];
+        double percent[PWM_PHASE_MAX_CHANNELS];
+        int count = (argc - 1) / 2;
+
+        if ((argc - 1) % 2 != 0 || count > PWM_PHASE_MAX_CHANNELS)
+        {
+            fprintf(stderr, "usage: %s [current_mA duty_percent ...] (up to %d channels)\n", argv[0], PWM_PHASE_MAX_CHANNELS);
+            return 1;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            current[i] = strtoul(argv[1 + i * 2], NULL, 0);
+            percent[i] = atof(argv[2 + i * 2]);
+        }
+        report("custom", current, percent, count);
+        return 0;
+    }
+
+    report_cct();
+    {
+        uint32_t current[3] = { 60, 60, 60 };
+        double percent[3] = { 30, 30, 30 };
+        report("3 channels, 30%", current, percent, 3);
+    }
+    {
+        uint32_t current[4] = { 40, 40, 40, 40 };
+        double percent[4] = { 50, 50, 50, 50 };
+        report("4 channels, 50%", current, percent, 4);
+    }
+    return 0;
+}